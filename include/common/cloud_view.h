@@ -0,0 +1,56 @@
+//cloud_view.h
+// Read only range of a shared point buffer. The points of every detection
+// of a frame live in one buffer; a detection, its copies and the track
+// which keeps it share that buffer instead of copying their points.
+#ifndef CLOUD_VIEW_H
+#define CLOUD_VIEW_H
+
+#include <memory>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+class cloudView
+{
+public:
+    typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+    cloudView():
+    data_(nullptr),
+    size_(0)
+    {}
+
+    // the whole cloud
+    explicit cloudView(const std::shared_ptr<const Cloud> & cloud):
+    cloud_(cloud),
+    data_(cloud && !cloud->empty() ? &cloud->points[0] : nullptr),
+    size_(cloud ? cloud->size() : 0)
+    {}
+
+    // points [begin, end) of cloud
+    cloudView(const std::shared_ptr<const Cloud> & cloud, size_t begin, size_t end):
+    cloud_(cloud),
+    data_(end > begin ? &cloud->points[begin] : nullptr),
+    size_(end > begin ? end - begin : 0)
+    {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const pcl::PointXYZI & operator[](size_t pt_idx) const { return data_[pt_idx]; }
+    const pcl::PointXYZI * begin() const { return data_; }
+    const pcl::PointXYZI * end() const { return data_ + size_; }
+
+    // for the pcl calls which need a cloud of their own
+    void appendTo(Cloud & cloud) const
+    {
+        cloud.points.insert(cloud.points.end(), begin(), end());
+        cloud.width = cloud.points.size();
+        cloud.height = 1;
+    }
+
+private:
+    std::shared_ptr<const Cloud> cloud_;
+    const pcl::PointXYZI * data_;
+    size_t size_;
+};
+
+#endif //CLOUD_VIEW_H
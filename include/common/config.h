@@ -15,12 +15,19 @@ class Config
     friend class assignment;
     friend class Frame;
     friend class fusion_tracker;
+    friend class associationBenchmark;
+    friend class FeatureTrackManager;
+    friend class opticalBenchmark;
+    friend class velocityBenchmark;
+    friend class SceneFlow;
     
 private:
 
     double camera_factor_ = 256.0;
     int imageRows_ = 568;
     int imageCols_ = 1520;
+    // per frame logs of the pipeline, warnings and errors are always printed
+    bool log_verbose_ = true;
 
     size_t integrator_threads_ = std::thread::hardware_concurrency();
 
@@ -29,6 +36,61 @@ private:
     std::string pose_path_, raw_img_path_, pcd_path_, label_img_path_, bbox_path_, cube_path_;
 
     double maxCorners_, qualityLevel_, minDistance_, blockSize_, Harris_k_value_;
+    int roi_margin_ = 10;
+    int roi_min_corners_ = 20;
+    double fb_max_error_ = 1.0;
+    double feature_replenish_ratio_ = 0.5;
+    int flow_max_level_ = 2;
+    int flow_min_box_px_ = 48;
+    std::string pixel_motion_estimator_ = "irls";
+    int pixel_motion_irls_iterations_ = 3;
+    double pixel_motion_min_sigma_ = 0.5;
+    std::string optical_flow_engine_ = "sparse";
+    int dense_min_inliers_ = 10;
+    int dense_stride_ = 2;
+
+    bool assignment_warm_start_ = true;
+    bool assignment_verify_ = false;
+    double association_max_speed_ = 60.0;
+    int track_max_age_ = 3;
+    int track_min_hits_ = 3;
+
+    std::string point_vel_solver_ = "irls";
+    bool point_vel_validate_ = false;
+    int point_vel_max_iterations_ = 20;
+    double point_vel_degenerate_var_ = 100.0;
+    size_t point_vel_budget_ = 800;
+    std::string point_vel_sampling_ = "time";
+    double point_vel_voxel_size_ = 0.1;
+    bool point_vel_budget_compare_ = false;
+    std::string point_vel_direction_ = "cube";
+    double bev_search_max_speed_ = 20.0;
+    double bev_search_coarse_step_ = 2.0;
+    int bev_search_levels_ = 5;
+    double bev_search_cell_ = 0.2;
+    double bev_search_min_cell_ = 0.025;
+    double bev_search_min_speed_ = 0.5;
+    std::string velocity_engine_ = "points";
+    bool velocity_engine_compare_ = false;
+    int registration_max_iterations_ = 10;
+    double registration_max_distance_ = 0.5;
+    double registration_epsilon_ = 1e-3;
+    size_t registration_min_points_ = 10;
+    size_t velocity_window_size_ = 1;
+    bool velocity_window_acceleration_ = false;
+    double velocity_window_position_var_ = 0.04;
+    double velocity_window_epoch_ = 1.0;
+
+    bool scene_flow_enable_ = false;
+    double scene_flow_voxel_size_ = 0.2;
+    double scene_flow_min_speed_ = 2.0;
+    double scene_flow_max_speed_ = 20.0;
+    int scene_flow_min_voxels_ = 8;
+    double scene_flow_max_extent_ = 8.0;
+    double scene_flow_coherence_ = 0.5;
+    double scene_flow_confidence_ = 0.3;
+    // threads of the per object velocity loop, 0 : integrator_threads_
+    size_t velocity_threads_ = 0;
 
     Eigen::Matrix4d lidar_to_apx_extrinsic_, rtk_to_lidar_extrinsic_;
     Eigen::Matrix3d camera_intrinsic_;
@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////////////////////////
+// detection_record.h: Header file for the compact detection records.
+//
+// The box part of a detection as a trivially copyable record : the class
+// is an interned id, the cube and the image box are float / int arrays and
+// the pose is an index into the PoseTable. Association and the kf read the
+// records only, so a list of them is one contiguous array which is copied
+// and streamed without touching strings or shared buffers.
+//
+
+#ifndef DETECTION_RECORD_H
+#define DETECTION_RECORD_H
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+#include <opencv2/core.hpp>
+
+// 8 cube vertices, one per row
+typedef Eigen::Matrix<float, 8, 3, Eigen::RowMajor> cubeVertexs;
+
+// class names as small ids, 0 is the empty name
+class ClassTable {
+public:
+    static uint16_t intern(const std::string & class_name);
+    static const std::string & name(uint16_t class_id);
+
+private:
+    ClassTable();
+
+    static ClassTable & instance();
+
+    std::mutex mutex_;
+    // a deque, the returned names stay valid while others are added
+    std::deque<std::string> names_;
+    std::unordered_map<std::string, uint16_t> ids_;
+};
+
+// global poses of the last frames, one per frame, with their inverses. A
+// ring of kPoseSlots poses : an index stays valid for kPoseSlots frames,
+// far longer than a retired track (track_max_age) keeps the detection of
+// its last update. The frame thread adds, the velocity workers only read
+// between two adds. Index 0 is the identity and is never overwritten.
+class PoseTable {
+public:
+    static const uint32_t kPoseSlots = 1024;
+
+    static PoseTable & global();
+
+    uint32_t add(const Eigen::Matrix4d & global_pose);
+    const Eigen::Matrix4d & pose(uint32_t pose_idx) const { return poses_[slot(pose_idx)]; }
+    // lidar -> global, inverted once when the pose is added
+    const Eigen::Matrix4d & inverse(uint32_t pose_idx) const { return inverses_[slot(pose_idx)]; }
+
+private:
+    PoseTable();
+
+    static uint32_t slot(uint32_t pose_idx) { return pose_idx == 0 ? 0 : 1 + (pose_idx - 1) % kPoseSlots; }
+
+    // slot 0 and the kPoseSlots ring slots, allocated once
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> poses_;
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> inverses_;
+    uint32_t next_idx_;
+};
+
+typedef struct alignas(16) detRecord
+{
+    // x y z of the 8 vertices
+    float vertexs_[24] = {};
+    // image box x y width height
+    int32_t box2d_[4] = {};
+    float confidence2d_ = 0.0f;
+    float confidence3d_ = 0.0f;
+    uint64_t time_stamp_ = 0;
+    uint32_t pose_idx_ = 0;
+    uint16_t class_id_ = 0;
+
+    Eigen::Map<cubeVertexs> vertex3d() { return Eigen::Map<cubeVertexs>(vertexs_); }
+    Eigen::Map<const cubeVertexs> vertex3d() const { return Eigen::Map<const cubeVertexs>(vertexs_); }
+    cv::Rect vertex2d() const { return cv::Rect(box2d_[0], box2d_[1], box2d_[2], box2d_[3]); }
+    void setVertex2d(const cv::Rect & box)
+    {
+        box2d_[0] = box.x;
+        box2d_[1] = box.y;
+        box2d_[2] = box.width;
+        box2d_[3] = box.height;
+    }
+} detRecord;
+
+static_assert(
+    std::is_trivially_copyable<detRecord>::value,
+    "detection records are copied as plain memory"
+);
+
+typedef std::vector<detRecord, Eigen::aligned_allocator<detRecord>> detRecords;
+
+#endif //DETECTION_RECORD_H
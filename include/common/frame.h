@@ -2,6 +2,7 @@
 #ifndef FRAME_H
 #define FRAME_H
 
+#include <type_traits>
 #include <pcl/filters/extract_indices.h>
 #include <pcl/kdtree/kdtree.h>
 #include <pcl/ModelCoefficients.h>
@@ -29,29 +30,33 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/eigen.hpp>
 #include "tracker/Hungarian.h"
+#include "tracker/SceneFlow.h"
 
 #include "common/config.h"
+#include "common/cloud_view.h"
+#include "common/detection_record.h"
+#include "common/frame_memory.h"
 
 #define hubLidarNum 6
 
 struct obBBOX
 {
-    std::string object_type_;
-    double score_;
+    uint16_t class_id_;
+    float score_;
     int bbox_x1_;
     int bbox_x2_;
     int bbox_y1_;
     int bbox_y2_;
 
     obBBOX(
-        std::string object_type,
+        const std::string & object_type,
         double score,
         int bbox_x1,
         int bbox_x2,
         int bbox_y1,
         int bbox_y2
     ):
-    object_type_(object_type),
+    class_id_(ClassTable::intern(object_type)),
     score_(score),
     bbox_x1_(bbox_x1),
     bbox_x2_(bbox_x2),
@@ -62,34 +67,59 @@ struct obBBOX
 
 struct cube3d
 {
-    std::string object_type_;
-    double confidence_;
-    Eigen::Matrix<double, 8, 3> cube_vertexs_;
+    uint16_t class_id_;
+    float confidence_;
+    // x y z of the 8 vertices
+    float vertexs_[24];
 
     cube3d(
-        std::string object_type,
+        const std::string & object_type,
         double confidence,
-        Eigen::Matrix<double, 8, 3> cube_vertexs
+        const Eigen::Matrix<double, 8, 3> & vertexs
     )
     {
-        object_type_ = object_type;
+        class_id_ = ClassTable::intern(object_type);
         confidence_ = confidence;
-        cube_vertexs_ = cube_vertexs;
+        cube_vertexs() = vertexs.cast<float>();
     }
+
+    Eigen::Map<cubeVertexs> cube_vertexs() { return Eigen::Map<cubeVertexs>(vertexs_); }
+    Eigen::Map<const cubeVertexs> cube_vertexs() const { return Eigen::Map<const cubeVertexs>(vertexs_); }
 };
 
-typedef struct alignedDet
+static_assert(
+    std::is_trivially_copyable<obBBOX>::value && std::is_trivially_copyable<cube3d>::value,
+    "the detector outputs are copied as plain memory"
+);
+
+// immutable data of one frame, shared by all its detections
+typedef struct frameResources
 {
-    std::string type_;
-    float confidence2d_;
-    float confidence3d_;
-    Eigen::Matrix<double, 8, 3> vertex3d_;
-    cv::Rect vertex2d_;
-    pcl::PointCloud<pcl::PointXYZI> cloud_;
     cv::Mat img_;
-    Eigen::Matrix4d global_pose_;
+    // object points of every detection, each detection views its range
+    std::shared_ptr<const pcl::PointCloud<pcl::PointXYZI>> points_;
+    uint64_t time_stamp_;
+}frameResources;
+
+// the box of a detection (detRecord) and its points. Association and the
+// kf take the detRecord part only.
+typedef struct alignedDet : detRecord
+{
+    cloudView cloud_;
+    std::shared_ptr<const frameResources> frame_;
 }alignedDet;
 
+// per stage cost of one association (ms)
+typedef struct associationProfile
+{
+    double cost_matrix_ms_;
+    double iou_ms_;
+    double solver_ms_;
+    double bookkeeping_ms_;
+    int iou_evaluations_;
+    int repaired_rows_;
+}associationProfile;
+
 typedef std::vector<std::pair<uint64_t, pcl::PointCloud<pcl::PointXYZRGB>>> pcdWithTime;
 typedef std::vector<obBBOX> frameBboxs;
 typedef std::vector<cube3d> frameCubes;
@@ -98,6 +128,36 @@ typedef std::pair<uint64_t, cv::Mat> imageWithTime;
 typedef std::pair<uint64_t, pcdWithTime> pcdsWithTime;
 typedef std::pair<uint64_t, frameBboxs> frameBboxsWithTime;
 typedef std::pair<uint64_t, frameCubes> frameCubesWithTime;
+typedef std::pair<uint64_t, Eigen::Matrix4d> poseWithTime;
+
+// inputs of one frame. It is moved from loading to the frame, the later
+// stages read it through const references; a copy doesn't compile.
+struct FramePacket
+{
+    imageWithTime raw_img_;
+    imageWithTime label_img_;
+    pcdsWithTime pcds_;
+    frameBboxsWithTime bboxes_;
+    frameCubesWithTime cubes_;
+    poseWithTime pose_;
+
+    FramePacket() {}
+    FramePacket(FramePacket &&) = default;
+    FramePacket & operator=(FramePacket &&) = default;
+    FramePacket(const FramePacket &) = delete;
+    FramePacket & operator=(const FramePacket &) = delete;
+};
+
+static_assert(
+    !std::is_copy_constructible<FramePacket>::value && 
+    !std::is_copy_assignable<FramePacket>::value,
+    "the clouds and images of a frame packet must not be copied"
+);
+static_assert(
+    std::is_move_constructible<FramePacket>::value && 
+    std::is_move_assignable<FramePacket>::value,
+    "a frame packet moves between the stages"
+);
 
 struct detection_object
 {
@@ -114,14 +174,9 @@ struct detection_object
 class Frame
 {
 private:
-    Config global_config_;
-    cv::Mat raw_img_;
-    cv::Mat label_img_;
-    cv::Mat depth_img_frame_;
-    std::vector<pcl::PointCloud<pcl::PointXYZRGB>> pointclouds_;
-    pcl::PointCloud<pcl::PointXYZRGB> frame_pointcloud_;
-    frameBboxs objs_;
-    frameCubes cubes_;
+    // must outlive the frame
+    const Config & global_config_;
+    FramePacket packet_;
 
     // [0]->raw_img_time  [1]->label_img_time [2]->pcds_time [3~7]->pcd_time 
     uint64_t time_stamp_[9];
@@ -129,30 +184,36 @@ private:
 
     detection_object frame_detections_;
 
+    // the clouds above take their point buffers from memory_ and give them
+    // back in the destructor, NULL for plain clouds
+    FrameMemory * memory_;
+
+    // index of the frame pose in the PoseTable, 0 until it is added
+    uint32_t pose_idx_;
+
 public:
     Frame(
-        imageWithTime& raw_img,
-        imageWithTime& label_img,
-        pcdsWithTime& pcd,
-        frameBboxsWithTime& bbox,
-        frameCubesWithTime& cube,
-        Config config
+        FramePacket && packet,
+        const Config & config,
+        FrameMemory * memory = NULL
     );
     ~Frame();
 
+    const FramePacket & packet() const { return packet_; }
+
     bool verboseFrame();
 
     cv::Mat PointCloudToDepth(
-        pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_in, Config global_config);
+        const pcl::PointCloud<pcl::PointXYZI> & cloud_in, const Config & global_config);
 
     cv::Mat PointCloudToDepthWithintensity(
-        pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_in, 
+        const pcl::PointCloud<pcl::PointXYZI> & cloud_in, 
         cv::Mat & intensity_map,
-        Config global_config);
+        const Config & global_config);
 
     pcl::PointCloud<pcl::PointXYZRGB> depth_to_pointcloud(
-        cv::Mat& depthImageIn, 
-        Config global_config
+        const cv::Mat & depthImageIn, 
+        const Config & global_config
     );
 
     pcl::PointCloud<pcl::PointXYZI>::Ptr roi_depth_to_pointcloud(
@@ -162,20 +223,17 @@ public:
         int y_start, 
         int x_len, 
         int y_len,
-        Config global_config
+        const Config & global_config
     );
     
     
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr getFramePointcloud();
-    pcl::PointCloud<pcl::PointXYZI>::Ptr getBackgroundcloud();
+    const pcl::PointCloud<pcl::PointXYZI> & getBackgroundcloud() const;
     std::vector<pcl::PointCloud<pcl::PointXYZI>> * getObjcloud();
-    pcl::PointCloud<pcl::PointXYZI>::Ptr getCloud();
+    const pcl::PointCloud<pcl::PointXYZI> & getCloud() const;
 
-    void full_detection(
-        pcdsWithTime * pcd_in
-    );
+    void full_detection();
     void point_extraction(
-        const pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_,
+        const pcl::PointCloud<pcl::PointXYZI> & cloud_,
         const frameCubes * cubes_,
         pcl::PointCloud<pcl::PointXYZI> * background_cloud,
         std::vector<pcl::PointCloud<pcl::PointXYZI>> * obj_cloud
@@ -186,6 +244,16 @@ public:
         const frameCubes * cubes_,
         const frameBboxs * objs_,
         const Eigen::Matrix4d * global_pose_,
+        std::vector<alignedDet> & aligned_detections,
+        associationProfile * profile = NULL
+    );
+
+    // moving clusters of the background cloud as extra detections, appended
+    // to aligned_detections. scene_flow keeps the voxels of the last frame.
+    void scene_flow_detection(
+        SceneFlow & scene_flow,
+        const cv::Mat * rawimg_,
+        const Eigen::Matrix4d * global_pose_,
         std::vector<alignedDet> & aligned_detections
     );
 
@@ -200,11 +268,21 @@ public:
         const cv::Rect detection2d
     );
     void findHungarianAssignment(
-        std::vector<std::vector<double>> iouMatrix_,
+        const std::vector<std::vector<double>> & iouMatrix_,
         vector<cv::Point> & results
     );
+
+private:
+    // PoseTable index of the frame, the pose is added on the first call
+    uint32_t frame_pose(const Eigen::Matrix4d & global_pose);
 };
 
+// a copied frame would give its pooled buffers back twice
+static_assert(
+    !std::is_copy_constructible<Frame>::value,
+    "a frame owns its packet and buffers, it is never copied"
+);
+
 class VisHandel
 {
 private:
@@ -231,10 +309,10 @@ public:
         const std::vector<alignedDet> & detection_in
     );
 
-    void raw_cloud_publisher(sensor_msgs::PointCloud2 cloud_in);
-    void raw_obj_cloud_publisher(sensor_msgs::PointCloud2 cloud_in);
-    void undistorted_obj_cloud_publisher(sensor_msgs::PointCloud2 cloud_in);
-    void background_cloud_publisher(sensor_msgs::PointCloud2 cloud_in);
+    void raw_cloud_publisher(sensor_msgs::PointCloud2 & cloud_in);
+    void raw_obj_cloud_publisher(sensor_msgs::PointCloud2 & cloud_in);
+    void undistorted_obj_cloud_publisher(sensor_msgs::PointCloud2 & cloud_in);
+    void background_cloud_publisher(sensor_msgs::PointCloud2 & cloud_in);
 
     void raw_img_publisher(cv::Mat img_in);
     void label_img_publisher(cv::Mat img_in);
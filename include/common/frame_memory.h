@@ -0,0 +1,257 @@
+///////////////////////////////////////////////////////////////////////////////
+// frame_memory.h: Header file for Class FrameMemory.
+//
+// Memory which lives for one frame. FrameArena hands out temporary memory
+// by bumping a pointer and frees all of it at once at the end of the frame;
+// CloudPool keeps the point buffers of a frame for the next one, which has
+// the same sizes. The counters of endFrame cover the arena and the cloud
+// pools only; the other containers of a frame (detections, flow images,
+// feature tracks, tracking vectors) still take their memory from the heap.
+//
+
+#ifndef FRAME_MEMORY_H
+#define FRAME_MEMORY_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+class FrameArena {
+public:
+    explicit FrameArena(size_t block_size = 1 << 20);
+
+    ~FrameArena();
+
+    // not thread safe, allocate on the frame thread only
+    void * allocate(size_t bytes, size_t alignment);
+    // frees everything. The blocks of a frame which needed more than one are
+    // merged into one, so the next frame of that size fits it.
+    void reset();
+
+    size_t usedBytes() const { return used_bytes_; }
+    size_t peakBytes() const { return peak_bytes_; }
+    size_t capacity() const;
+    // blocks taken from the heap since the last resetCounters
+    size_t blockAllocations() const { return block_allocations_; }
+    void resetCounters() { block_allocations_ = 0; }
+
+private:
+    typedef struct arenaBlock
+    {
+        std::unique_ptr<char[]> data_;
+        size_t size_;
+    } arenaBlock;
+
+    void addBlock(size_t size);
+
+    std::vector<arenaBlock> blocks_;
+    size_t block_size_;
+    size_t offset_;
+    size_t used_bytes_;
+    size_t peak_bytes_;
+    size_t block_allocations_;
+};
+
+// std allocator on a FrameArena, deallocate is a no-op. Without an arena it
+// falls back to the heap, so code can take one optionally.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator(FrameArena * arena = nullptr): arena_(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> & other): arena_(other.arena()) {}
+
+    T * allocate(size_t n)
+    {
+        if (!arena_)
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T * ptr, size_t)
+    {
+        if (!arena_)
+        {
+            ::operator delete(ptr);
+        }
+    }
+
+    FrameArena * arena() const { return arena_; }
+
+private:
+    FrameArena * arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> & lhs, const ArenaAllocator<U> & rhs)
+{
+    return lhs.arena() == rhs.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> & lhs, const ArenaAllocator<U> & rhs)
+{
+    return lhs.arena() != rhs.arena();
+}
+
+// temporaries of one frame, must not outlive FrameMemory::endFrame
+template <typename T>
+using arenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// point buffers of pcl clouds. A cloud keeps its pooled buffer from acquire
+// to release, so the clouds of a frame are plain value clouds.
+template <typename PointT>
+class CloudPool {
+public:
+    typedef pcl::PointCloud<PointT> Cloud;
+    typedef typename Cloud::VectorType PointVector;
+
+    CloudPool()
+    {
+        heap_allocations_ = 0;
+    }
+
+    ~CloudPool()
+    {
+    }
+
+    // cloud takes the smallest pooled buffer of at least reserve_points, or
+    // the biggest one if none is big enough, cleared
+    void acquire(Cloud & cloud, size_t reserve_points = 0)
+    {
+        PointVector points;
+        if (!free_.empty())
+        {
+            size_t best_idx = 0;
+            for (size_t free_idx = 1; free_idx < free_.size(); free_idx++)
+            {
+                size_t capacity = free_[free_idx].capacity();
+                size_t best_capacity = free_[best_idx].capacity();
+                bool fits = capacity >= reserve_points;
+                bool best_fits = best_capacity >= reserve_points;
+                if ((fits && (!best_fits || capacity < best_capacity)) ||
+                    (!fits && !best_fits && capacity > best_capacity))
+                {
+                    best_idx = free_idx;
+                }
+            }
+            points.swap(free_[best_idx]);
+            free_[best_idx].swap(free_.back());
+            free_.pop_back();
+        }
+        if (points.capacity() < reserve_points)
+        {
+            points.reserve(reserve_points);
+            heap_allocations_++;
+        }
+        points.clear();
+        cloud.points.swap(points);
+        cloud.width = 0;
+        cloud.height = 1;
+        issued_.push_back(std::make_pair(&cloud, cloud.points.capacity()));
+    }
+
+    // the buffer of cloud goes back to the pool, cloud is left empty. A
+    // buffer which grew while out counts as an allocation, a cloud which
+    // never had one is left alone.
+    void release(Cloud & cloud)
+    {
+        bool issued = false;
+        for (size_t issued_idx = 0; issued_idx < issued_.size(); issued_idx++)
+        {
+            if (issued_[issued_idx].first == &cloud)
+            {
+                if (cloud.points.capacity() > issued_[issued_idx].second)
+                {
+                    heap_allocations_++;
+                }
+                issued_[issued_idx] = issued_.back();
+                issued_.pop_back();
+                issued = true;
+                break;
+            }
+        }
+        if (!issued)
+        {
+            if (cloud.points.capacity() == 0)
+            {
+                return;
+            }
+            // a buffer from outside the pool joins it
+            heap_allocations_++;
+        }
+        free_.push_back(PointVector());
+        free_.back().swap(cloud.points);
+        cloud.width = 0;
+        cloud.height = 1;
+    }
+
+    size_t pooled() const { return free_.size(); }
+    size_t heapAllocations() const { return heap_allocations_; }
+    void resetCounters() { heap_allocations_ = 0; }
+
+private:
+    std::vector<PointVector> free_;
+    // clouds holding a pooled buffer and its capacity when acquired
+    std::vector<std::pair<const Cloud *, size_t>> issued_;
+    size_t heap_allocations_;
+};
+
+typedef struct frameMemoryStats
+{
+    size_t arena_bytes_;
+    size_t arena_capacity_;
+    size_t arena_blocks_;
+    size_t cloud_allocations_;
+    size_t pooled_clouds_;
+    // frames in a row in which the arena and the cloud pools took nothing
+    // from the heap, other allocations of the frame are not counted
+    size_t pool_steady_frames_;
+} frameMemoryStats;
+
+class FrameMemory {
+public:
+    FrameMemory();
+
+    ~FrameMemory();
+
+    FrameArena & arena() { return arena_; }
+    CloudPool<pcl::PointXYZI> & xyziClouds() { return xyzi_clouds_; }
+    CloudPool<pcl::PointXYZRGB> & rgbClouds() { return rgb_clouds_; }
+
+    // call when every temporary of the frame is gone : frees the arena and
+    // returns the arena and cloud pool allocations of the frame
+    frameMemoryStats endFrame();
+
+private:
+    FrameArena arena_;
+    CloudPool<pcl::PointXYZI> xyzi_clouds_;
+    CloudPool<pcl::PointXYZRGB> rgb_clouds_;
+    size_t pool_steady_frames_;
+};
+
+// ends the frame of memory when it goes out of scope and, if verbose,
+// prints what the arena and the cloud pools of the frame allocated.
+// Declared before the objects of a frame, it runs after they gave their
+// buffers back.
+class FrameScope {
+public:
+    explicit FrameScope(FrameMemory & memory, bool verbose = true):
+        memory_(memory), verbose_(verbose) {}
+
+    ~FrameScope();
+
+private:
+    FrameMemory & memory_;
+    bool verbose_;
+};
+
+#endif //FRAME_MEMORY_H
@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////
+// thread_pool.h: Header file for Class ThreadPool.
+//
+// A fixed set of workers, each with its own task deque. Tasks are dealt
+// round-robin in the order given, a worker takes from the front of its own
+// deque and, once it is empty, steals from the back of the others. Giving
+// the tasks biggest-first keeps the large ones from starting last.
+//
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // threads : workers besides the calling thread, 0 runs everything inline
+    explicit ThreadPool(size_t threads);
+
+    ~ThreadPool();
+
+    // runs task(order[0]), task(order[1]), ... and returns when all are
+    // done, the calling thread works on the tasks as well
+    void run(
+        const std::vector<size_t> & order,
+        const std::function<void(size_t)> & task
+    );
+
+    size_t threads() const { return workers_.size(); }
+    // tasks taken from another deque in the last run
+    size_t stolenTasks() const { return stolen_tasks_; }
+
+private:
+    struct taskQueue
+    {
+        std::mutex mutex_;
+        std::deque<size_t> tasks_;
+    };
+
+    void workerLoop(size_t queue_idx);
+    // own queue front first, then the back of the others
+    bool takeTask(size_t queue_idx, size_t & task_idx);
+    void drain(size_t queue_idx);
+
+    std::vector<std::thread> workers_;
+    // one per worker and the last one for the calling thread
+    std::vector<std::unique_ptr<taskQueue>> queues_;
+
+    std::mutex run_mutex_;
+    std::condition_variable run_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(size_t)> * task_;
+    size_t generation_;
+    size_t pending_tasks_;
+    size_t busy_workers_;
+    size_t stolen_tasks_;
+    bool stop_;
+};
+
+#endif //THREAD_POOL_H
@@ -0,0 +1,130 @@
+///////////////////////////////////////////////////////////////////////////////
+// FeatureTrackManager.h: Header file for Class FeatureTrackManager.
+//
+// Keeps KLT features alive across frames. Every feature belongs to the
+// kfTracker (its slot id m_id) whose box it was detected in, it is
+// tracked forward with LK and dropped when the backward track does not
+// return to its start or when it leaves the box of its owner. New corners are only
+// detected for objects which have run out of features.
+//
+
+#ifndef FEATURE_TRACK_MANAGER_H
+#define FEATURE_TRACK_MANAGER_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "common/config.h"
+#include "tracker/SlotMap.h"
+
+// grey image and LK pyramid of one camera image, built once and handed
+// forward as the previous image of the next frame
+typedef struct flowImageCache
+{
+    cv::Mat img_;
+    cv::Mat gray_;
+    std::vector<cv::Mat> pyramid_;
+} flowImageCache;
+
+// coarsest pyramid level, up to max_level, at which the short side of
+// the box keeps min_box_px
+int flowLevel(const cv::Rect & box, int max_level, int min_box_px);
+
+// grey image of a pyramid level of the cache and the number of levels
+const cv::Mat & pyramidImage(const flowImageCache & cache, int level);
+int pyramidLevels(const flowImageCache & cache);
+
+// paints the boxes far to near into a CV_32S map, a pixel belongs to the
+// nearest box, -1 for background
+void paintLabelMap(
+    const std::vector<cv::Rect> & rois,
+    const std::vector<double> & box_depths,
+    const cv::Size & image_size,
+    cv::Mat & labels
+);
+
+inline int labelAt(const cv::Mat & labels, const cv::Point2f & pt)
+{
+    int x = cvFloor(pt.x);
+    int y = cvFloor(pt.y);
+    if (x < 0 || y < 0 || x >= labels.cols || y >= labels.rows)
+    {
+        return -1;
+    }
+    return labels.at<int>(y, x);
+}
+
+typedef struct featureTrack
+{
+    // position in the last image
+    cv::Point2f pt_;
+    // m_id of the owning kfTracker
+    slotId owner_id_;
+    // frames the feature has been tracked
+    int age_;
+} featureTrack;
+
+class FeatureTrackManager {
+public:
+    FeatureTrackManager(const cv::Size & win_size, int max_level);
+
+    ~FeatureTrackManager();
+
+    // owner_ids[k] : track id of the object in cur_boxes[k]
+    // box_depths[k] : distance of the object, nearer boxes cover farther ones
+    // obj_features_prev / obj_features_cur : feature pairs of every object
+    void update(
+        const flowImageCache & prev_cache,
+        const flowImageCache & cur_cache,
+        const std::vector<slotId> & owner_ids,
+        const std::vector<cv::Rect> & cur_boxes,
+        const std::vector<double> & box_depths,
+        const Config & config_,
+        std::vector<std::vector<cv::Point2f>> & obj_features_prev,
+        std::vector<std::vector<cv::Point2f>> & obj_features_cur
+    );
+
+    int trackedFeatures() const { return tracked_features_; }
+    int detectedCorners() const { return detected_corners_; }
+    int replenishedObjects() const { return replenished_objects_; }
+    // objects tracked at every pyramid level in the last update
+    const std::vector<int> & levelObjects() const { return level_objects_; }
+    size_t size() const { return features_.size(); }
+    // object index of every pixel of the last image, -1 for background
+    const cv::Mat & labels() const { return labels_; }
+
+private:
+    // splits the points by their pyramid level and runs forwardBackward
+    void trackByLevel(
+        const std::vector<cv::Mat> & from_pyramid,
+        const std::vector<cv::Mat> & to_pyramid,
+        const std::vector<cv::Point2f> & from_pts,
+        const std::vector<int> & pt_levels,
+        double max_error,
+        std::vector<cv::Point2f> & to_pts,
+        std::vector<bool> & valid
+    );
+    // LK in both directions starting at a pyramid level, keeps the points
+    // which come back to their start, points are full resolution pixels
+    void forwardBackward(
+        const std::vector<cv::Mat> & from_pyramid,
+        const std::vector<cv::Mat> & to_pyramid,
+        const std::vector<cv::Point2f> & from_pts,
+        int level,
+        double max_error,
+        std::vector<cv::Point2f> & to_pts,
+        std::vector<bool> & valid
+    );
+
+    cv::Size win_size_;
+    int max_level_;
+    std::vector<featureTrack> features_;
+    cv::Mat labels_;
+
+    int tracked_features_;
+    int detected_corners_;
+    int replenished_objects_;
+    std::vector<int> level_objects_;
+};
+
+#endif //FEATURE_TRACK_MANAGER_H
@@ -21,7 +21,7 @@ public:
 
     ~HungarianAlgorithm();
 
-    double Solve(vector<vector<double>> &DistMatrix, vector<int> &Assignment);
+    double Solve(const vector<vector<double>> &DistMatrix, vector<int> &Assignment);
 
 private:
     void assignmentoptimal(int *assignment, double *cost, double *distMatrix, int nOfRows, int nOfColumns);
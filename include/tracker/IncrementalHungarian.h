@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////
+// IncrementalHungarian.h: Header file for Class IncrementalHungarian.
+//
+// A primal-dual (shortest augmenting path) assignment solver which can be
+// warm-started from the row duals of the previous frame. Rows whose dual is
+// still tight keep their match, only the remaining rows are augmented.
+//
+
+#ifndef INCREMENTAL_HUNGARIAN_H
+#define INCREMENTAL_HUNGARIAN_H
+
+#include <iostream>
+#include <vector>
+
+class IncrementalHungarian {
+public:
+    IncrementalHungarian();
+
+    ~IncrementalHungarian();
+
+    // DistMatrix : nRows x nCols cost matrix
+    // Assignment : column of every row, -1 for unassigned rows
+    // RowDuals   : in -> duals of the last solve, out -> duals of this solve
+    // WarmRows   : rows whose RowDuals entry is valid (others start from 0)
+    double Solve(
+        const std::vector<std::vector<double>> &DistMatrix,
+        std::vector<int> &Assignment,
+        std::vector<double> &RowDuals,
+        const std::vector<bool> &WarmRows
+    );
+
+    // rows which had to be augmented in the last solve
+    int repairedRows() const { return repaired_rows_; }
+    // true if the last solve fell back to the full HungarianAlgorithm
+    bool usedFallback() const { return used_fallback_; }
+
+private:
+    bool augment(int row);
+    bool checkOptimality() const;
+    double fallbackSolve(
+        const std::vector<std::vector<double>> &DistMatrix,
+        std::vector<int> &Assignment,
+        std::vector<double> &RowDuals
+    );
+
+    inline double cost(int row, int col) const
+    {
+        return cost_[(row - 1) * dim_ + (col - 1)];
+    }
+
+    // square problem, padded with zero cost dummy rows / columns,
+    // 1-based indices, col 0 is the virtual start column of an augmentation
+    int dim_;
+    std::vector<double> cost_;
+    std::vector<double> u_;
+    std::vector<double> v_;
+    std::vector<int> row_of_col_;
+    std::vector<int> way_;
+    std::vector<double> minv_;
+    std::vector<bool> used_;
+
+    int repaired_rows_;
+    bool used_fallback_;
+};
+
+#endif //INCREMENTAL_HUNGARIAN_H
@@ -0,0 +1,327 @@
+///////////////////////////////////////////////////////////////////////////////
+// KalmanBank.h: Header file for Class KalmanBank.
+//
+// Linear Kalman filters of all tracks with compile time state and
+// measurement sizes. The states and covariances are stored structure of
+// arrays : row k holds element k of every track, so one element of all
+// tracks is contiguous and the prediction of the whole bank is a short
+// list of vectorized row operations. The transition is
+// F = transition_fixed + dt * transition_rate with a dt per track, every
+// covariance element of F P F^T is a fixed combination of a few elements
+// of P which is found once in configure.
+//
+
+#ifndef KALMAN_BANK_H
+#define KALMAN_BANK_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+template <int StateDim, int MeasureDim>
+class KalmanBank {
+public:
+    typedef Eigen::Matrix<float, StateDim, 1> StateVector;
+    typedef Eigen::Matrix<float, StateDim, StateDim> StateMatrix;
+    typedef Eigen::Matrix<float, MeasureDim, 1> MeasureVector;
+    typedef Eigen::Matrix<float, MeasureDim, MeasureDim> MeasureMatrix;
+    typedef Eigen::Matrix<float, MeasureDim, StateDim> MeasureModel;
+    typedef std::vector<MeasureVector, Eigen::aligned_allocator<MeasureVector>> MeasureVectors;
+    typedef std::vector<MeasureMatrix, Eigen::aligned_allocator<MeasureMatrix>> MeasureMatrices;
+
+    KalmanBank()
+    {
+        size_ = 0;
+        capacity_ = 0;
+        configure(
+            StateMatrix::Identity(),
+            StateMatrix::Zero(),
+            StateMatrix::Identity(),
+            MeasureModel::Identity()
+        );
+    }
+
+    ~KalmanBank()
+    {
+    }
+
+    void configure(
+        const StateMatrix & transition_fixed,
+        const StateMatrix & transition_rate,
+        const StateMatrix & process_noise,
+        const MeasureModel & measurement_model
+    )
+    {
+        process_noise_ = process_noise;
+        measurement_model_ = measurement_model;
+
+        state_terms_.clear();
+        state_term_begin_.assign(StateDim + 1, 0);
+        for (int row = 0; row < StateDim; row++)
+        {
+            state_term_begin_[row] = state_terms_.size();
+            for (int col = 0; col < StateDim; col++)
+            {
+                addTerm(state_terms_, col, transition_fixed(row, col), transition_rate(row, col), 0.0f);
+            }
+        }
+        state_term_begin_[StateDim] = state_terms_.size();
+
+        // (F P F^T)(a, b) = sum_cd F(a, c) P(c, d) F(b, d), F = F0 + dt F1
+        cov_terms_.clear();
+        cov_term_begin_.assign(StateDim * StateDim + 1, 0);
+        for (int col = 0; col < StateDim; col++)
+        {
+            for (int row = 0; row < StateDim; row++)
+            {
+                cov_term_begin_[element(row, col)] = cov_terms_.size();
+                for (int src_col = 0; src_col < StateDim; src_col++)
+                {
+                    for (int src_row = 0; src_row < StateDim; src_row++)
+                    {
+                        addTerm(
+                            cov_terms_,
+                            element(src_row, src_col),
+                            transition_fixed(row, src_row) * transition_fixed(col, src_col),
+                            transition_rate(row, src_row) * transition_fixed(col, src_col) +
+                                transition_fixed(row, src_row) * transition_rate(col, src_col),
+                            transition_rate(row, src_row) * transition_rate(col, src_col)
+                        );
+                    }
+                }
+            }
+        }
+        cov_term_begin_[StateDim * StateDim] = cov_terms_.size();
+    }
+
+    size_t size() const { return size_; }
+
+    void clear()
+    {
+        size_ = 0;
+        time_stamps_.clear();
+    }
+
+    void push_back(
+        const StateVector & state,
+        const StateMatrix & covariance,
+        uint64_t time_stamp
+    )
+    {
+        if (size_ == capacity_)
+        {
+            reserve(std::max<size_t>(2 * capacity_, 16));
+        }
+        stateMap(size_) = state;
+        covarianceMap(size_) = covariance;
+        time_stamps_.push_back(time_stamp);
+        size_++;
+    }
+
+    // the last track moves into the hole, as in SlotMap::eraseAt
+    void erase(size_t track)
+    {
+        size_t last = size_ - 1;
+        if (track != last)
+        {
+            states_.col(track) = states_.col(last);
+            covariances_.col(track) = covariances_.col(last);
+            time_stamps_[track] = time_stamps_[last];
+        }
+        time_stamps_.pop_back();
+        size_--;
+    }
+
+    // every track to time_stamp, default_dt if its time stamp can't be used
+    void predict(uint64_t time_stamp, float default_dt)
+    {
+        if (size_ == 0)
+        {
+            return;
+        }
+        Eigen::Array<float, 1, Eigen::Dynamic> dt(size_);
+        for (size_t track = 0; track < size_; track++)
+        {
+            dt[track] = default_dt;
+            if (time_stamps_[track] > 0 && time_stamp > time_stamps_[track])
+            {
+                dt[track] = (time_stamp - time_stamps_[track]) / 1e9;
+            }
+            time_stamps_[track] = time_stamp;
+        }
+        Eigen::Array<float, 1, Eigen::Dynamic> dt_sq = dt.square();
+
+        predicted_states_.resize(StateDim, size_);
+        for (int row = 0; row < StateDim; row++)
+        {
+            auto out = predicted_states_.row(row).array();
+            out.setZero();
+            for (int term_idx = state_term_begin_[row]; term_idx < state_term_begin_[row + 1]; term_idx++)
+            {
+                const predictTerm & term = state_terms_[term_idx];
+                auto src = states_.row(term.src_).head(size_).array();
+                out += term.fixed_ * src + term.rate_ * dt * src;
+            }
+        }
+        for (int row = 0; row < StateDim; row++)
+        {
+            states_.row(row).head(size_) = predicted_states_.row(row);
+        }
+
+        predicted_covariances_.resize(StateDim * StateDim, size_);
+        for (int col = 0; col < StateDim; col++)
+        {
+            for (int row = 0; row < StateDim; row++)
+            {
+                int elem = element(row, col);
+                auto out = predicted_covariances_.row(elem).array();
+                out.setConstant(process_noise_(row, col));
+                for (int term_idx = cov_term_begin_[elem]; term_idx < cov_term_begin_[elem + 1]; term_idx++)
+                {
+                    const predictTerm & term = cov_terms_[term_idx];
+                    auto src = covariances_.row(term.src_).head(size_).array();
+                    out += term.fixed_ * src + term.rate_ * dt * src + term.rate_sq_ * dt_sq * src;
+                }
+            }
+        }
+        for (int row = 0; row < StateDim * StateDim; row++)
+        {
+            covariances_.row(row).head(size_) = predicted_covariances_.row(row);
+        }
+    }
+
+    // tracks[i] takes measurements[i] with the noise measurement_noises[i],
+    // one small fixed size solve per track
+    void update(
+        const std::vector<size_t> & tracks,
+        const MeasureVectors & measurements,
+        const MeasureMatrices & measurement_noises
+    )
+    {
+        for (size_t update_idx = 0; update_idx < tracks.size(); update_idx++)
+        {
+            size_t track = tracks[update_idx];
+            StateVector state = stateMap(track);
+            StateMatrix covariance = covarianceMap(track);
+
+            Eigen::Matrix<float, StateDim, MeasureDim> cov_ht = covariance * measurement_model_.transpose();
+            MeasureMatrix innovation_cov = measurement_model_ * cov_ht + measurement_noises[update_idx];
+            Eigen::LDLT<MeasureMatrix> ldlt(innovation_cov);
+            if (ldlt.info() != Eigen::Success)
+            {
+                continue;
+            }
+            // K = P H^T S^-1
+            Eigen::Matrix<float, StateDim, MeasureDim> gain = ldlt.solve(cov_ht.transpose()).transpose();
+            state += gain * (measurements[update_idx] - measurement_model_ * state);
+            covariance -= gain * cov_ht.transpose();
+
+            stateMap(track) = state;
+            covarianceMap(track) = 0.5f * (covariance + covariance.transpose());
+        }
+    }
+
+    StateVector state(size_t track) const
+    {
+        return constStateMap(track);
+    }
+
+    StateMatrix covariance(size_t track) const
+    {
+        return constCovarianceMap(track);
+    }
+
+    uint64_t timeStamp(size_t track) const { return time_stamps_[track]; }
+
+private:
+    typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+    typedef Eigen::InnerStride<Eigen::Dynamic> TrackStride;
+
+    // out += (fixed_ + rate_ dt + rate_sq_ dt^2) * row src_
+    typedef struct predictTerm
+    {
+        int src_;
+        float fixed_;
+        float rate_;
+        float rate_sq_;
+    } predictTerm;
+
+    static int element(int row, int col) { return row + StateDim * col; }
+
+    static void addTerm(
+        std::vector<predictTerm> & terms,
+        int src,
+        float fixed,
+        float rate,
+        float rate_sq
+    )
+    {
+        if (fixed != 0.0f || rate != 0.0f || rate_sq != 0.0f)
+        {
+            predictTerm term;
+            term.src_ = src;
+            term.fixed_ = fixed;
+            term.rate_ = rate;
+            term.rate_sq_ = rate_sq;
+            terms.push_back(term);
+        }
+    }
+
+    void reserve(size_t capacity)
+    {
+        RowMatrix states = RowMatrix::Zero(StateDim, capacity);
+        RowMatrix covariances = RowMatrix::Zero(StateDim * StateDim, capacity);
+        if (size_ > 0)
+        {
+            states.leftCols(size_) = states_.leftCols(size_);
+            covariances.leftCols(size_) = covariances_.leftCols(size_);
+        }
+        states_.swap(states);
+        covariances_.swap(covariances);
+        capacity_ = capacity;
+    }
+
+    // one track seen through the rows, element k is k * capacity_ apart
+    Eigen::Map<StateVector, Eigen::Unaligned, TrackStride> stateMap(size_t track)
+    {
+        return Eigen::Map<StateVector, Eigen::Unaligned, TrackStride>(
+            states_.data() + track, TrackStride(capacity_));
+    }
+    Eigen::Map<StateMatrix, Eigen::Unaligned, TrackStride> covarianceMap(size_t track)
+    {
+        return Eigen::Map<StateMatrix, Eigen::Unaligned, TrackStride>(
+            covariances_.data() + track, TrackStride(capacity_));
+    }
+    Eigen::Map<const StateVector, Eigen::Unaligned, TrackStride> constStateMap(size_t track) const
+    {
+        return Eigen::Map<const StateVector, Eigen::Unaligned, TrackStride>(
+            states_.data() + track, TrackStride(capacity_));
+    }
+    Eigen::Map<const StateMatrix, Eigen::Unaligned, TrackStride> constCovarianceMap(size_t track) const
+    {
+        return Eigen::Map<const StateMatrix, Eigen::Unaligned, TrackStride>(
+            covariances_.data() + track, TrackStride(capacity_));
+    }
+
+    size_t size_;
+    size_t capacity_;
+    // StateDim rows, StateDim^2 rows (column major element order), one
+    // column per track
+    RowMatrix states_;
+    RowMatrix covariances_;
+    std::vector<uint64_t> time_stamps_;
+    // predict output, kept to reuse the allocation
+    RowMatrix predicted_states_;
+    RowMatrix predicted_covariances_;
+
+    StateMatrix process_noise_;
+    MeasureModel measurement_model_;
+    std::vector<predictTerm> state_terms_;
+    std::vector<int> state_term_begin_;
+    std::vector<predictTerm> cov_terms_;
+    std::vector<int> cov_term_begin_;
+};
+
+#endif //KALMAN_BANK_H
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+// SceneFlow.h: Header file for Class SceneFlow.
+//
+// Motion of the points outside every detection. The background cloud of
+// each frame is moved to the global frame and hashed into voxels. Voxels
+// which have no occupied neighbour in the last frame seed a cluster, which
+// grows into the connected voxels of the object; one motion per cluster is
+// searched against the voxels of the last frame, over the time between the
+// mean point times. Clusters with a coherent motion are returned for the
+// tracker.
+//
+
+#ifndef SCENE_FLOW_H
+#define SCENE_FLOW_H
+
+#include <vector>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <Eigen/Dense>
+
+#include "common/config.h"
+
+typedef struct flowCluster
+{
+    // points in the lidar frame, intensity is the point time
+    pcl::PointCloud<pcl::PointXYZI> cloud_;
+    // cluster motion in the lidar frame (m/s)
+    Eigen::Vector3d flow_;
+    int voxel_num_;
+} flowCluster;
+
+class SceneFlow {
+public:
+    SceneFlow();
+
+    ~SceneFlow();
+
+    // global = global_pose^-1 * lidar, as for the detections
+    void update(
+        const pcl::PointCloud<pcl::PointXYZI> & background,
+        const Eigen::Matrix4d & global_pose,
+        uint64_t time_stamp,
+        const Config & config_,
+        std::vector<flowCluster> & clusters
+    );
+
+    size_t voxelNum() const { return cur_.keys_.size(); }
+    int movingVoxels() const { return moving_voxels_; }
+
+private:
+    // voxels of one frame, points sorted by voxel so a voxel is one range
+    typedef struct voxelHash
+    {
+        std::vector<uint64_t> keys_;
+        // global points, in the order of the background cloud
+        std::vector<Eigen::Vector3f> points_;
+        std::vector<Eigen::Vector3f> centroids_;
+        std::vector<float> mean_times_;
+        // point range of every voxel in point_order_
+        std::vector<int> point_begin_;
+        std::vector<int> point_order_;
+        // open addressing table of voxel indices, -1 for empty slots
+        std::vector<int> slots_;
+        uint64_t slot_mask_;
+        int slot_shift_;
+        uint64_t time_stamp_;
+        bool valid_;
+    } voxelHash;
+
+    void build(
+        const pcl::PointCloud<pcl::PointXYZI> & background,
+        const Eigen::Matrix4d & global_pose,
+        uint64_t time_stamp,
+        float voxel_size,
+        voxelHash & hash
+    );
+    // shift (m) of the cur_ voxels since the last frame, matches : the
+    // prev_ voxel of every voxel, -1 if none. false if most don't match
+    bool estimateMotion(
+        const std::vector<int> & voxels,
+        int search_radius,
+        float voxel_size,
+        Eigen::Vector3f & shift,
+        std::vector<int> & matches
+    );
+    // voxel of hash with the nearest centroid to pt in the 27 around it
+    static int nearestVoxel(const voxelHash & hash, const Eigen::Vector3f & pt, float voxel_size);
+    static uint64_t slotOf(const voxelHash & hash, uint64_t key);
+    static int find(const voxelHash & hash, uint64_t key);
+    static uint64_t voxelKey(int vx, int vy, int vz);
+    static void keyVoxel(uint64_t key, int & vx, int & vy, int & vz);
+
+    voxelHash prev_;
+    voxelHash cur_;
+    int moving_voxels_;
+};
+
+#endif //SCENE_FLOW_H
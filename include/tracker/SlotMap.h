@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+// SlotMap.h: Header file for Class SlotMap.
+//
+// Values stored densely with stable ids. An id is the slot of the value
+// and the generation of that slot; erasing a value frees its slot and
+// bumps the generation, so an old id never finds the value which reuses
+// the slot. Insert and erase are O(1) : erase moves the last value into
+// the hole, the dense order is not kept.
+//
+
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// id of a slot map value : generation << 32 | slot, 0 is never a valid id.
+// Not a member type, so a value can keep its own id.
+typedef uint64_t slotId;
+
+template <typename T>
+class SlotMap {
+public:
+    typedef slotId Id;
+
+    SlotMap()
+    {
+    }
+
+    ~SlotMap()
+    {
+    }
+
+    Id insert(const T & value)
+    {
+        uint32_t slot;
+        if (free_slots_.empty())
+        {
+            slot = slot_generations_.size();
+            slot_generations_.push_back(1);
+            slot_values_.push_back(0);
+        }
+        else
+        {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        }
+        slot_values_[slot] = values_.size();
+        values_.push_back(value);
+        value_slots_.push_back(slot);
+        return makeId(slot, slot_generations_[slot]);
+    }
+
+    // erases the value at dense index value_idx, the last value takes its index
+    void eraseAt(size_t value_idx)
+    {
+        uint32_t slot = value_slots_[value_idx];
+        size_t last_idx = values_.size() - 1;
+        if (value_idx != last_idx)
+        {
+            values_[value_idx] = std::move(values_[last_idx]);
+            value_slots_[value_idx] = value_slots_[last_idx];
+            slot_values_[value_slots_[value_idx]] = value_idx;
+        }
+        values_.pop_back();
+        value_slots_.pop_back();
+        slot_generations_[slot]++;
+        free_slots_.push_back(slot);
+    }
+
+    bool contains(Id id) const
+    {
+        uint32_t slot = slotOf(id);
+        return slot < slot_generations_.size() && slot_generations_[slot] == generationOf(id);
+    }
+
+    T * find(Id id)
+    {
+        return contains(id) ? &values_[slot_values_[slotOf(id)]] : nullptr;
+    }
+
+    // slot of an id, unique among the live values
+    static uint32_t slotOf(Id id) { return (uint32_t)(id & 0xffffffffu); }
+
+    T & operator[](size_t value_idx) { return values_[value_idx]; }
+    const T & operator[](size_t value_idx) const { return values_[value_idx]; }
+
+    size_t size() const { return values_.size(); }
+    bool empty() const { return values_.empty(); }
+    // slots ever allocated, live values + free slots
+    size_t slotCount() const { return slot_generations_.size(); }
+    size_t freeSlots() const { return free_slots_.size(); }
+
+    void clear()
+    {
+        for (size_t value_idx = 0; value_idx < value_slots_.size(); value_idx++)
+        {
+            slot_generations_[value_slots_[value_idx]]++;
+            free_slots_.push_back(value_slots_[value_idx]);
+        }
+        values_.clear();
+        value_slots_.clear();
+    }
+
+private:
+    static Id makeId(uint32_t slot, uint32_t generation)
+    {
+        return ((Id)generation << 32) | slot;
+    }
+    static uint32_t generationOf(Id id) { return (uint32_t)(id >> 32); }
+
+    std::vector<T> values_;
+    // slot of every value
+    std::vector<uint32_t> value_slots_;
+    // dense index and generation of every slot
+    std::vector<uint32_t> slot_values_;
+    std::vector<uint32_t> slot_generations_;
+    std::vector<uint32_t> free_slots_;
+};
+
+#endif //SLOT_MAP_H
@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////////////
+// VelocityWindow.h: Header file for Class VelocityWindow.
+//
+// Joint velocity (and optionally acceleration) of one track over its last
+// K frames. Every frame adds its global box center and its velocity
+// estimate to the normal equations of p(t) = p0 + v t + a t^2 / 2, the
+// frame leaving the window is subtracted again, so a frame costs the same
+// for any K. Times are relative to an anchor which is moved to the newest
+// frame once it is older than the epoch, rebuilding the sums from the
+// stored frames to drop the subtraction round off.
+//
+
+#ifndef VELOCITY_WINDOW_H
+#define VELOCITY_WINDOW_H
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <Eigen/Dense>
+
+typedef struct windowFrame
+{
+    uint64_t time_stamp_;
+    // box center and velocity in the global frame
+    Eigen::Vector3d center_;
+    Eigen::Vector3d vel_;
+    Eigen::Matrix3d vel_cov_;
+} windowFrame;
+
+class VelocityWindow {
+public:
+    VelocityWindow();
+
+    ~VelocityWindow();
+
+    // window_size : K frames, position_var : variance of a box center (m^2)
+    void configure(
+        size_t window_size,
+        bool with_acceleration,
+        double position_var,
+        double epoch_s
+    );
+
+    void add(const windowFrame & frame);
+    // velocity and its covariance at time_stamp, false until the window
+    // constrains the velocity
+    bool solve(
+        uint64_t time_stamp,
+        Eigen::Vector3d & vel,
+        Eigen::Matrix3d & vel_cov
+    ) const;
+
+    size_t size() const { return frames_.size(); }
+    void clear();
+
+private:
+    typedef Eigen::Matrix<double, 9, 9> Matrix9d;
+    typedef Eigen::Matrix<double, 9, 1> Vector9d;
+
+    // sign : +1 adds the frame to the sums, -1 takes it out
+    void accumulate(const windowFrame & frame, double sign);
+    // moves the anchor to time_stamp and rebuilds the sums
+    void reanchor(uint64_t time_stamp);
+    double relativeTime(uint64_t time_stamp) const;
+
+    size_t window_size_;
+    bool with_acceleration_;
+    double position_var_;
+    double epoch_s_;
+
+    std::deque<windowFrame> frames_;
+    uint64_t anchor_time_stamp_;
+    // normal equations of [p0, v, a]
+    Matrix9d information_;
+    Vector9d rhs_;
+};
+
+#endif //VELOCITY_WINDOW_H
@@ -17,16 +17,30 @@
 #include <pcl/registration/icp.h>
 #include <pcl/registration/icp_nl.h>
 #include <pcl/filters/statistical_outlier_removal.h>
+#include <pcl/kdtree/kdtree_flann.h>
 
 #include <ceres/ceres.h>
 
 #include "common/time.h"
+#include "common/thread_pool.h"
+#include "tracker/IncrementalHungarian.h"
+#include "tracker/FeatureTrackManager.h"
+#include "tracker/VelocityWindow.h"
+#include "tracker/KalmanBank.h"
+#include "tracker/SlotMap.h"
 
 using namespace std;
 using namespace cv;
 
 #define StateType Cube
 
+// center xyz, yaw, long, width, depth, velocity xyz, measured in full
+typedef KalmanBank<10, 10> trackKalmanBank;
+
+// pixel motion variance (px^2) of an object without flow inliers, an
+// uninformative measurement : vel_fusion gives its pixel velocity no weight
+const double kNoPixelMotionVar = 1e6;
+
 typedef struct Cube
 {
     double centerx_;
@@ -45,87 +59,136 @@ typedef struct Cube
     Eigen::Matrix4d pose_;
 };
 
+
+// per point terms of the 1-d point velocity fit, see point_velocity_terms
+typedef struct pointVelocityTerms
+{
+    Eigen::ArrayXf a1_;
+    Eigen::ArrayXf b1_;
+    Eigen::ArrayXf a2_;
+    Eigen::ArrayXf b2_;
+    Eigen::ArrayXf r3_sq_;
+    float w1_;
+    float w2_;
+} pointVelocityTerms;
+
+// output of one matched object, filled on a pool thread and merged in
+// object order
+typedef struct objectVelocitySlot
+{
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_;
+    visualization_msgs::Marker arrow_;
+    visualization_msgs::MarkerArray txt_;
+} objectVelocitySlot;
+
 class kfTracker
 {
 public:
     kfTracker()
     {
-        init_kf(alignedDet());
+        init_track(alignedDet());
         m_time_since_update = 0;
 		m_hits = 0;
 		m_hit_streak = 0;
 		m_age = 0;
-		m_id = kf_count;
+		m_id = 0;
         estimated_vel_.setZero();
+        assignment_dual_ = 0.0;
+        has_assignment_dual_ = false;
     }
     kfTracker(
-        alignedDet detection_in
+        const alignedDet & detection_in
     )
     {
-		init_kf(detection_in);
+		init_track(detection_in);
         m_time_since_update = 0;
 		m_hits = 0;
 		m_hit_streak = 0;
 		m_age = 0;
-		m_id = kf_count;
+		m_id = 0;
         estimated_vel_.setZero();
+        assignment_dual_ = 0.0;
+        has_assignment_dual_ = false;
     }
     ~kfTracker()
     {
-        measurement_history_.clear();
     }
-    alignedDet predict();
-    void update(
-        alignedDet detection_in,
-        const Eigen::Vector3d & vel_,
-        const Eigen::Matrix3d & vel_cov_
+    // the kf state lives in the kalman bank of fusion_tracker, these keep
+    // the track counters and the last box
+    detRecord predict(
+        uint64_t time_stamp,
+        const Eigen::Vector3d & predicted_center
     );
-    void get_kf_vel(
-        Eigen::Vector3d & vel_
+    void update(
+        const alignedDet & detection_in
     );
     void update_estimated_vel(
         const Eigen::Vector3d & vel_
     );
+    // motion compensated copy and kd-tree of the current object cloud for
+    // the registration of the next frame, call after update
+    void cache_registration(
+        const Eigen::Vector3d & vel_
+    );
 
-    static int kf_count;
 	int m_time_since_update;
 	int m_hits;
 	int m_hit_streak;
 	int m_age;
-	int m_id;
+	// id of the track in fusion_tracker::trackers_, set by add_track. The
+	// generation of the id is never reused, feature ownership and the
+	// markers of the track key on it.
+	slotId m_id;
 
     int rgb3[3];
     alignedDet detection_cur_;
 
     Eigen::Vector3d estimated_vel_;
 
-private:
-    cv::KalmanFilter kf_;
-    cv::Mat measurement_;
-	std::vector<alignedDet> measurement_history_;
+    // object cloud of the last update moved to its frame time, its kd-tree
+    // is built once per frame and queried by the next registration
+    pcl::PointCloud<pcl::PointXYZ>::Ptr registration_cloud_;
+    pcl::KdTreeFLANN<pcl::PointXYZ>::Ptr registration_tree_;
+
+    // box centers and velocity estimates of the last frames
+    VelocityWindow velocity_window_;
+
+    // row dual of this track in the last assignment, warm starts the next one
+    double assignment_dual_;
+    bool has_assignment_dual_;
 
-	void init_kf(alignedDet detection_in);
-	std::vector<float> getState(
-        alignedDet detection_in
+	static std::vector<float> getState(
+        const detRecord & detection_in
     );
 
-    
+private:
+	void init_track(const alignedDet & detection_in);
 };
 
 class fusion_tracker
 {
+    friend class associationBenchmark;
+    friend class opticalBenchmark;
+    friend class velocityBenchmark;
+
 private:
     vector<alignedDet> last_detection_;
     vector<alignedDet> cur_detection_;
     cv::Mat last_img_;
     cv::Mat cur_img_;
-	vector<cv::Point2f> prev_pts_;
-    cv::Mat prev_gray_;
+    flowImageCache prev_cache_;
+    // swapped with prev_cache_ at the end of a frame, the grey image and
+    // pyramid of a frame reuse the buffers of two frames back
+    flowImageCache cur_cache_;
+    FeatureTrackManager feature_tracks_;
 
-    vector<kfTracker> trackers_;
+    // dense track i : trackers_[i] and track i of the bank, a retired
+    // track is replaced by the last one in both
+    SlotMap<kfTracker> trackers_;
+    trackKalmanBank kalman_bank_;
     int total_frames_;
     int frame_count_;
-    vector<alignedDet> predictedBoxes_;
+    detRecords predictedBoxes_;
     unsigned int trkNum_;
     unsigned int detNum_;
     vector<vector<double>> iouMatrix_;
@@ -136,29 +199,105 @@ private:
     set<int> matchedItems_;
     vector<cv::Point> matchedPairs_;
     double iouThreshold_;
+    IncrementalHungarian warmHungarian_;
+    // per object velocity estimation, rebuilt when the thread count changes
+    std::unique_ptr<ThreadPool> velocity_pool_;
+    // temporaries and images of a frame, NULL for plain allocations
+    FrameMemory * frame_memory_;
+    // undistorted clouds and message, kept to reuse the allocations
+    std::vector<pcl::PointCloud<pcl::PointXYZRGB>::Ptr> slot_clouds_;
+    pcl::PointCloud<pcl::PointXYZRGB> undistorted_obj_clouds_;
+    sensor_msgs::PointCloud2 undistorted_obj_cloud_msg_;
 public:
     fusion_tracker();
     ~fusion_tracker();
 
+    // frame_memory must outlive the tracker
+    void set_frame_memory(FrameMemory * frame_memory) { frame_memory_ = frame_memory; }
+
     void tracking(
-        const std::vector<alignedDet> detections_in,
-        cv::Mat img_in,
-        Config config_,
+        const std::vector<alignedDet> & detections_in,
+        const cv::Mat & img_in,
+        uint64_t time_stamp,
+        const Config & config_,
         boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer,
         visualization_msgs::MarkerArray & obj_vel_txt_markerarray,
         VisHandel * vis_
     );
-    cv::RotatedRect alignedDet2rotaterect(alignedDet detection_in);
-    double GetIOU(alignedDet bb_test, alignedDet bb_gt);
+    void add_track(
+        const alignedDet & detection_in,
+        const Config & config_
+    );
+    void remove_track(size_t trk_idx);
+    // drops the tracks missed for more than max_age frames and the
+    // tentative tracks (less than min_hits updates) missed once
+    int retire_tracks(const Config & config_);
+    void predict_tracks(uint64_t time_stamp);
+    // one batched kf update, pairs[i] (track, detection) measures vels[i]
+    void update_tracks(
+        const std::vector<alignedDet> & detections_in,
+        const std::vector<cv::Point> & pairs,
+        const std::vector<Eigen::Vector3d> & vels,
+        const std::vector<Eigen::Matrix3d> & vel_covs
+    );
+    void get_kf_vel(
+        size_t trk_idx,
+        Eigen::Vector3d & vel_
+    ) const;
+    void associate(
+        const std::vector<alignedDet> & detections_in,
+        const Config & config_,
+        associationProfile & profile
+    );
+    cv::RotatedRect alignedDet2rotaterect(const detRecord & detection_in);
+    double GetIOU(const detRecord & bb_test, const detRecord & bb_gt);
+    double GetIOU(const cv::RotatedRect & rect1, const cv::RotatedRect & rect2);
+    void build_flow_cache(
+        const cv::Mat & img_in,
+        flowImageCache & cache
+    );
     void optical_estimator(
-        cv::Mat prev_,
-        cv::Mat cur_,
+        const flowImageCache & prev_cache,
+        const flowImageCache & cur_cache,
         const std::vector<alignedDet> & prev_detection,
         const std::vector<alignedDet> & cur_detection,
+        const std::vector<slotId> & track_ids,
         const Config & config_,
         std::vector<Eigen::Vector2d> & obj_means,
         std::vector<Eigen::Matrix2d> & obj_covariances
     );
+    void dense_estimator(
+        const flowImageCache & prev_cache,
+        const flowImageCache & cur_cache,
+        const std::vector<alignedDet> & prev_detection,
+        const std::vector<alignedDet> & cur_detection,
+        const std::vector<double> & box_depths,
+        const std::vector<int> & dense_objs,
+        const Config & config_,
+        std::vector<Eigen::Vector2d> & obj_means,
+        std::vector<Eigen::Matrix2d> & obj_covariances
+    );
+    void estimate_pixel_motion(
+        const std::vector<std::vector<cv::Point2f>> & obj_features_prev,
+        const std::vector<std::vector<cv::Point2f>> & obj_features_cur,
+        const Config & config_,
+        std::vector<std::vector<uchar>> & inlier_status,
+        std::vector<Eigen::Vector2d> & obj_means,
+        std::vector<Eigen::Matrix2d> & obj_covariances
+    );
+    void robust_pixel_motion(
+        const std::vector<cv::Point2f> & features_prev,
+        const std::vector<cv::Point2f> & features_cur,
+        const Config & config_,
+        std::vector<uchar> & inlier_status
+    );
+    void pixel_motion_moments(
+        const std::vector<cv::Point2f> & features_prev,
+        const std::vector<cv::Point2f> & features_cur,
+        const std::vector<uchar> & inlier_status,
+        Eigen::Vector2d & mean_,
+        Eigen::Matrix2d & covariance_
+    );
     void points_estimator(
         const alignedDet & prev_detection,
         const alignedDet & cur_detection,
@@ -168,24 +307,86 @@ public:
         const Eigen::Vector3d & estimated_vel,
         Eigen::Vector3d & fused_vel,
         Eigen::Matrix3d & fused_vel_cov,
-        Config config_
+        const Config & config_
+    );
+    void ceres_point_velocity(
+        const cloudView & cloud,
+        const Eigen::Vector3d & target_centroid,
+        const Eigen::Vector3d & direction,
+        const Eigen::Vector3d & axis_weight,
+        double & vel_weight
+    );
+    bool bev_velocity_search(
+        const cloudView & cloud,
+        const Config & config_,
+        Eigen::Vector2d & best_vel
+    );
+    bool sample_velocity_points(
+        const cloudView & cloud,
+        const Config & config_,
+        cloudView & sampled_cloud
+    );
+    void point_velocity_terms(
+        const cloudView & cloud,
+        const Eigen::Vector3d & target_centroid,
+        const Eigen::Vector3d & direction,
+        const Eigen::Vector3d & axis_weight,
+        pointVelocityTerms & terms
+    );
+    void irls_point_velocity(
+        const pointVelocityTerms & terms,
+        double init_vel,
+        int max_iterations,
+        double & vel_weight
+    );
+    bool point_velocity_covariance(
+        const pointVelocityTerms & terms,
+        double vel_weight,
+        double & vel_cov
+    );
+    bool window_estimator(
+        kfTracker & trk,
+        const alignedDet & cur_detection,
+        const Config & config_,
+        Eigen::Vector3d & vel,
+        Eigen::Matrix3d & vel_cov
+    );
+    bool registration_estimator(
+        const kfTracker & trk,
+        const alignedDet & cur_detection,
+        const Eigen::Vector2d & pix_vel,
+        const Eigen::Matrix2d & pix_vel_cov,
+        Eigen::Vector3d & fused_vel,
+        Eigen::Matrix3d & fused_vel_cov,
+        const Config & config_
+    );
+    bool register_translation(
+        const pcl::PointCloud<pcl::PointXYZ> & source,
+        const pcl::KdTreeFLANN<pcl::PointXYZ> & target_tree,
+        const pcl::PointCloud<pcl::PointXYZ> & target,
+        const Config & config_,
+        Eigen::Vector3d & translation,
+        double & residual_var,
+        int & inlier_num
     );
     void vel_fusion(
-        const alignedDet cur_detection,
-        const alignedDet prev_detection,
-        const Eigen::Vector3d points_vel,
-        const Eigen::Matrix3d points_vel_cov,
-        const Eigen::Vector2d pix_vel,
-        const Eigen::Matrix2d pix_vel_cov,
+        const alignedDet & cur_detection,
+        const alignedDet & prev_detection,
+        const Eigen::Vector3d & points_vel,
+        const Eigen::Matrix3d & points_vel_cov,
+        const Eigen::Vector2d & pix_vel,
+        const Eigen::Matrix2d & pix_vel_cov,
         Eigen::Vector3d & fusion_vel,
         Eigen::Matrix3d & fusion_vel_cov,
-        Config config_
+        const Config & config_
     );
 };
 
+// obj_id : track id, picks the color and the text marker id
 void cloud_undistortion(
-    const alignedDet detection_in,
-    const Eigen::Vector3d vel_,
+    const alignedDet & detection_in,
+    const Eigen::Vector3d & vel_,
+    slotId track_id,
 	pcl::PointCloud<pcl::PointXYZRGB>::Ptr clouds_buffer,
 	visualization_msgs::Marker & arrow_buffer,
 	visualization_msgs::MarkerArray & txt_buffer
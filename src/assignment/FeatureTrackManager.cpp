@@ -0,0 +1,360 @@
+///////////////////////////////////////////////////////////////////////////////
+// FeatureTrackManager.cpp: Implementation file for Class FeatureTrackManager.
+//
+
+#include "tracker/FeatureTrackManager.h"
+#include <algorithm>
+#include <map>
+
+// buildOpticalFlowPyramid stores every level with its derivatives
+static const int kPyramidStep = 2;
+
+int flowLevel(const cv::Rect & box, int max_level, int min_box_px)
+{
+    int short_side = std::min(box.width, box.height);
+    int level = 0;
+    while (level < max_level && (short_side >> (level + 1)) >= min_box_px)
+    {
+        level++;
+    }
+    return level;
+}
+
+const cv::Mat & pyramidImage(const flowImageCache & cache, int level)
+{
+    return cache.pyramid_[level * kPyramidStep];
+}
+
+int pyramidLevels(const flowImageCache & cache)
+{
+    return cache.pyramid_.size() / kPyramidStep;
+}
+
+void paintLabelMap(
+    const std::vector<cv::Rect> & rois,
+    const std::vector<double> & box_depths,
+    const cv::Size & image_size,
+    cv::Mat & labels
+)
+{
+    std::vector<int> far_to_near(rois.size());
+    for (size_t obj_idx = 0; obj_idx < rois.size(); obj_idx++)
+    {
+        far_to_near[obj_idx] = obj_idx;
+    }
+    std::stable_sort(far_to_near.begin(), far_to_near.end(),
+        [&box_depths](int a, int b) { return box_depths[a] > box_depths[b]; });
+
+    labels.create(image_size, CV_32SC1);
+    labels.setTo(-1);
+    for (size_t order_idx = 0; order_idx < far_to_near.size(); order_idx++)
+    {
+        int obj_idx = far_to_near[order_idx];
+        if (rois[obj_idx].area() > 0)
+        {
+            labels(rois[obj_idx]).setTo(obj_idx);
+        }
+    }
+}
+
+FeatureTrackManager::FeatureTrackManager(const cv::Size & win_size, int max_level)
+{
+    win_size_ = win_size;
+    max_level_ = max_level;
+    tracked_features_ = 0;
+    detected_corners_ = 0;
+    replenished_objects_ = 0;
+}
+
+FeatureTrackManager::~FeatureTrackManager() {}
+
+
+void FeatureTrackManager::update(
+    const flowImageCache & prev_cache,
+    const flowImageCache & cur_cache,
+    const std::vector<slotId> & owner_ids,
+    const std::vector<cv::Rect> & cur_boxes,
+    const std::vector<double> & box_depths,
+    const Config & config_,
+    std::vector<std::vector<cv::Point2f>> & obj_features_prev,
+    std::vector<std::vector<cv::Point2f>> & obj_features_cur
+)
+{
+    int obj_num = cur_boxes.size();
+    obj_features_prev.assign(obj_num, std::vector<cv::Point2f>());
+    obj_features_cur.assign(obj_num, std::vector<cv::Point2f>());
+    tracked_features_ = 0;
+    detected_corners_ = 0;
+    replenished_objects_ = 0;
+
+    const cv::Mat & cur_gray = cur_cache.gray_;
+    cv::Rect image_rect(0, 0, cur_gray.cols, cur_gray.rows);
+    double image_area = image_rect.area();
+
+    // flow level of every object, bounded by the levels of both pyramids
+    int pyramid_levels = std::min(pyramidLevels(prev_cache), pyramidLevels(cur_cache));
+    int max_flow_level = std::max(0, std::min(config_.flow_max_level_, pyramid_levels - 1));
+    std::vector<int> obj_levels(obj_num, 0);
+    level_objects_.assign(max_flow_level + 1, 0);
+
+    std::map<slotId, int> obj_of_owner;
+    std::vector<cv::Rect> rois(obj_num);
+    for (int obj_idx = 0; obj_idx < obj_num; obj_idx++)
+    {
+        obj_of_owner[owner_ids[obj_idx]] = obj_idx;
+        obj_levels[obj_idx] = flowLevel(cur_boxes[obj_idx], max_flow_level, config_.flow_min_box_px_);
+        level_objects_[obj_levels[obj_idx]]++;
+        cv::Rect roi = cur_boxes[obj_idx];
+        roi.x -= config_.roi_margin_;
+        roi.y -= config_.roi_margin_;
+        roi.width += 2 * config_.roi_margin_;
+        roi.height += 2 * config_.roi_margin_;
+        rois[obj_idx] = roi & image_rect;
+    }
+    paintLabelMap(rois, box_depths, cur_gray.size(), labels_);
+
+    // ------- track the living features -------
+    std::vector<featureTrack> survivors;
+    if (features_.size() > 0 && !prev_cache.pyramid_.empty())
+    {
+        // features of unmatched tracks are dropped without tracking them
+        std::vector<featureTrack> owned;
+        std::vector<cv::Point2f> prev_pts, cur_pts;
+        std::vector<int> pt_levels;
+        for (size_t ft_idx = 0; ft_idx < features_.size(); ft_idx++)
+        {
+            std::map<slotId, int>::iterator owner = obj_of_owner.find(features_[ft_idx].owner_id_);
+            if (owner == obj_of_owner.end())
+            {
+                continue;
+            }
+            owned.push_back(features_[ft_idx]);
+            prev_pts.push_back(features_[ft_idx].pt_);
+            pt_levels.push_back(obj_levels[owner->second]);
+        }
+        features_.swap(owned);
+        std::vector<bool> valid;
+        trackByLevel(
+            prev_cache.pyramid_,
+            cur_cache.pyramid_,
+            prev_pts,
+            pt_levels,
+            config_.fb_max_error_,
+            cur_pts,
+            valid
+        );
+        for (size_t ft_idx = 0; ft_idx < features_.size(); ft_idx++)
+        {
+            if (!valid[ft_idx])
+            {
+                continue;
+            }
+            std::map<slotId, int>::iterator owner = obj_of_owner.find(features_[ft_idx].owner_id_);
+            if (owner == obj_of_owner.end() || labelAt(labels_, cur_pts[ft_idx]) != owner->second)
+            {
+                continue;
+            }
+            obj_features_prev[owner->second].push_back(prev_pts[ft_idx]);
+            obj_features_cur[owner->second].push_back(cur_pts[ft_idx]);
+
+            featureTrack feature = features_[ft_idx];
+            feature.pt_ = cur_pts[ft_idx];
+            feature.age_++;
+            survivors.push_back(feature);
+        }
+    }
+    tracked_features_ = survivors.size();
+
+    // ------- replenish objects which ran out of features -------
+    // only the visible pixels of a box, the living features keep
+    // minDistance free around them
+    cv::Mat claimed = cv::Mat::zeros(cur_gray.size(), CV_8UC1);
+    for (size_t ft_idx = 0; ft_idx < survivors.size(); ft_idx++)
+    {
+        cv::circle(claimed, survivors[ft_idx].pt_, config_.minDistance_, cv::Scalar(255), -1);
+    }
+    std::vector<cv::Point2f> new_pts;
+    std::vector<slotId> new_owners;
+    std::vector<int> new_levels;
+    for (int obj_idx = 0; obj_idx < obj_num; obj_idx++)
+    {
+        cv::Rect roi = rois[obj_idx];
+        if (roi.area() == 0)
+        {
+            continue;
+        }
+        int corner_budget = std::max(
+            config_.roi_min_corners_,
+            (int)(config_.maxCorners_ * roi.area() / image_area)
+        );
+        int missing = corner_budget - (int)obj_features_cur[obj_idx].size();
+        if (obj_features_cur[obj_idx].size() < config_.feature_replenish_ratio_ * corner_budget)
+        {
+            cv::Mat roi_mask = (labels_(roi) == obj_idx);
+            roi_mask.setTo(0, claimed(roi));
+            std::vector<cv::Point2f> roi_pts;
+            cv::goodFeaturesToTrack(
+                cur_gray(roi),
+                roi_pts,
+                missing,
+                config_.qualityLevel_,
+                config_.minDistance_,
+                roi_mask,
+                config_.blockSize_,
+                false, config_.Harris_k_value_
+            );
+            for (size_t pt_idx = 0; pt_idx < roi_pts.size(); pt_idx++)
+            {
+                new_pts.push_back(roi_pts[pt_idx] + cv::Point2f(roi.x, roi.y));
+                new_owners.push_back(owner_ids[obj_idx]);
+                new_levels.push_back(obj_levels[obj_idx]);
+            }
+            detected_corners_ += roi_pts.size();
+            replenished_objects_++;
+        }
+    }
+
+    // new corners are tracked back into the previous image, so they
+    // give a displacement in the frame they are born
+    if (new_pts.size() > 0 && !prev_cache.pyramid_.empty())
+    {
+        std::vector<cv::Point2f> prev_pts;
+        std::vector<bool> valid;
+        trackByLevel(
+            cur_cache.pyramid_,
+            prev_cache.pyramid_,
+            new_pts,
+            new_levels,
+            config_.fb_max_error_,
+            prev_pts,
+            valid
+        );
+        for (size_t pt_idx = 0; pt_idx < new_pts.size(); pt_idx++)
+        {
+            if (!valid[pt_idx])
+            {
+                continue;
+            }
+            int obj_idx = obj_of_owner[new_owners[pt_idx]];
+            obj_features_prev[obj_idx].push_back(prev_pts[pt_idx]);
+            obj_features_cur[obj_idx].push_back(new_pts[pt_idx]);
+
+            featureTrack feature;
+            feature.pt_ = new_pts[pt_idx];
+            feature.owner_id_ = new_owners[pt_idx];
+            feature.age_ = 1;
+            survivors.push_back(feature);
+        }
+    }
+
+    features_.swap(survivors);
+}
+
+void FeatureTrackManager::trackByLevel(
+    const std::vector<cv::Mat> & from_pyramid,
+    const std::vector<cv::Mat> & to_pyramid,
+    const std::vector<cv::Point2f> & from_pts,
+    const std::vector<int> & pt_levels,
+    double max_error,
+    std::vector<cv::Point2f> & to_pts,
+    std::vector<bool> & valid
+)
+{
+    to_pts.assign(from_pts.size(), cv::Point2f());
+    valid.assign(from_pts.size(), false);
+    int top_level = 0;
+    for (size_t pt_idx = 0; pt_idx < pt_levels.size(); pt_idx++)
+    {
+        top_level = std::max(top_level, pt_levels[pt_idx]);
+    }
+    for (int level = 0; level <= top_level; level++)
+    {
+        std::vector<size_t> level_idx;
+        std::vector<cv::Point2f> level_from, level_to;
+        for (size_t pt_idx = 0; pt_idx < from_pts.size(); pt_idx++)
+        {
+            if (pt_levels[pt_idx] == level)
+            {
+                level_idx.push_back(pt_idx);
+                level_from.push_back(from_pts[pt_idx]);
+            }
+        }
+        if (level_idx.empty())
+        {
+            continue;
+        }
+        std::vector<bool> level_valid;
+        forwardBackward(
+            from_pyramid,
+            to_pyramid,
+            level_from,
+            level,
+            max_error,
+            level_to,
+            level_valid
+        );
+        for (size_t idx = 0; idx < level_idx.size(); idx++)
+        {
+            to_pts[level_idx[idx]] = level_to[idx];
+            valid[level_idx[idx]] = level_valid[idx];
+        }
+    }
+}
+
+void FeatureTrackManager::forwardBackward(
+    const std::vector<cv::Mat> & from_pyramid,
+    const std::vector<cv::Mat> & to_pyramid,
+    const std::vector<cv::Point2f> & from_pts,
+    int level,
+    double max_error,
+    std::vector<cv::Point2f> & to_pts,
+    std::vector<bool> & valid
+)
+{
+    // LK on the pyramid from this level down, in the pixels of that level
+    std::vector<cv::Mat> from_levels(from_pyramid.begin() + level * kPyramidStep, from_pyramid.end());
+    std::vector<cv::Mat> to_levels(to_pyramid.begin() + level * kPyramidStep, to_pyramid.end());
+    float scale = 1 << level;
+    std::vector<cv::Point2f> level_pts(from_pts.size());
+    for (size_t pt_idx = 0; pt_idx < from_pts.size(); pt_idx++)
+    {
+        level_pts[pt_idx] = from_pts[pt_idx] * (1.0f / scale);
+    }
+
+    std::vector<cv::Point2f> back_pts;
+    std::vector<uchar> status, back_status;
+    std::vector<float> err, back_err;
+    cv::calcOpticalFlowPyrLK(
+        from_levels,
+        to_levels,
+        level_pts,
+        to_pts,
+        status,
+        err,
+        win_size_, std::max(0, max_level_ - level)
+    );
+    cv::calcOpticalFlowPyrLK(
+        to_levels,
+        from_levels,
+        to_pts,
+        back_pts,
+        back_status,
+        back_err,
+        win_size_, std::max(0, max_level_ - level)
+    );
+
+    // back to full resolution pixels, displacements and the forward
+    // backward check scale with the level
+    double max_error2 = max_error * max_error;
+    valid.assign(from_pts.size(), false);
+    for (size_t pt_idx = 0; pt_idx < from_pts.size(); pt_idx++)
+    {
+        to_pts[pt_idx] *= scale;
+        if (status[pt_idx] == 0 || back_status[pt_idx] == 0)
+        {
+            continue;
+        }
+        cv::Point2f diff = (back_pts[pt_idx] - level_pts[pt_idx]) * scale;
+        valid[pt_idx] = diff.x * diff.x + diff.y * diff.y <= max_error2;
+    }
+}
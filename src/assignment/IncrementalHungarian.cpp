@@ -0,0 +1,250 @@
+///////////////////////////////////////////////////////////////////////////////
+// IncrementalHungarian.cpp: Implementation file for Class IncrementalHungarian.
+//
+// Costs are padded to a square matrix, so the duals u (rows) and v (columns)
+// are free and the solution is optimal iff
+//     cost(i, j) - u(i) - v(j) >= 0   for every pair
+//     cost(i, j) - u(i) - v(j) == 0   for every matched pair
+// Any feasible (u, v) together with a matching on tight pairs is a valid
+// start, which is what makes the warm start possible.
+//
+
+#include "tracker/IncrementalHungarian.h"
+#include "tracker/Hungarian.h"
+#include <cmath>
+#include <limits>
+
+static const double kTightEps = 1e-9;
+
+IncrementalHungarian::IncrementalHungarian()
+{
+    dim_ = 0;
+    repaired_rows_ = 0;
+    used_fallback_ = false;
+}
+
+IncrementalHungarian::~IncrementalHungarian() {}
+
+
+double IncrementalHungarian::Solve(
+    const std::vector<std::vector<double>> &DistMatrix,
+    std::vector<int> &Assignment,
+    std::vector<double> &RowDuals,
+    const std::vector<bool> &WarmRows
+)
+{
+    int nRows = DistMatrix.size();
+    int nCols = nRows > 0 ? DistMatrix[0].size() : 0;
+
+    repaired_rows_ = 0;
+    used_fallback_ = false;
+    Assignment.assign(nRows, -1);
+    if (nRows == 0 || nCols == 0)
+    {
+        RowDuals.assign(nRows, 0.0);
+        return 0.0;
+    }
+
+    dim_ = std::max(nRows, nCols);
+    cost_.assign(dim_ * dim_, 0.0);
+    for (int i = 0; i < nRows; i++)
+    {
+        for (int j = 0; j < nCols; j++)
+        {
+            if (!std::isfinite(DistMatrix[i][j]))
+            {
+                return fallbackSolve(DistMatrix, Assignment, RowDuals);
+            }
+            cost_[i * dim_ + j] = DistMatrix[i][j];
+        }
+    }
+
+    u_.assign(dim_ + 1, 0.0);
+    v_.assign(dim_ + 1, 0.0);
+    row_of_col_.assign(dim_ + 1, 0);
+    way_.assign(dim_ + 1, 0);
+
+    // row duals carried over from the last frame
+    for (int i = 0; i < nRows; i++)
+    {
+        if (i < (int)WarmRows.size() && WarmRows[i]
+            && i < (int)RowDuals.size() && std::isfinite(RowDuals[i]))
+        {
+            u_[i + 1] = RowDuals[i];
+        }
+    }
+
+    // tightest feasible column duals for these row duals
+    for (int j = 1; j <= dim_; j++)
+    {
+        double min_reduced = std::numeric_limits<double>::max();
+        for (int i = 1; i <= dim_; i++)
+        {
+            min_reduced = std::min(min_reduced, cost(i, j) - u_[i]);
+        }
+        v_[j] = min_reduced;
+    }
+
+    // seed : every row keeps a free tight column if it still has one
+    std::vector<int> col_of_row(dim_ + 1, 0);
+    for (int i = 1; i <= dim_; i++)
+    {
+        for (int j = 1; j <= dim_; j++)
+        {
+            if (row_of_col_[j] == 0 && cost(i, j) - u_[i] - v_[j] <= kTightEps)
+            {
+                row_of_col_[j] = i;
+                col_of_row[i] = j;
+                break;
+            }
+        }
+    }
+
+    // repair : augment the rows left without a tight column
+    for (int i = 1; i <= dim_; i++)
+    {
+        if (col_of_row[i] != 0)
+        {
+            continue;
+        }
+        if (!augment(i))
+        {
+            return fallbackSolve(DistMatrix, Assignment, RowDuals);
+        }
+        repaired_rows_++;
+    }
+
+    if (!checkOptimality())
+    {
+        return fallbackSolve(DistMatrix, Assignment, RowDuals);
+    }
+
+    double total_cost = 0.0;
+    for (int j = 1; j <= nCols; j++)
+    {
+        int row = row_of_col_[j];
+        if (row >= 1 && row <= nRows)
+        {
+            Assignment[row - 1] = j - 1;
+            total_cost += DistMatrix[row - 1][j - 1];
+        }
+    }
+
+    RowDuals.resize(nRows);
+    for (int i = 0; i < nRows; i++)
+    {
+        RowDuals[i] = u_[i + 1];
+    }
+
+    return total_cost;
+}
+
+//********************************************************//
+// Shortest augmenting path from a free row, keeps (u, v) feasible
+// and every matched pair tight.
+//********************************************************//
+bool IncrementalHungarian::augment(int row)
+{
+    minv_.assign(dim_ + 1, std::numeric_limits<double>::max());
+    used_.assign(dim_ + 1, false);
+
+    row_of_col_[0] = row;
+    int j0 = 0;
+    do
+    {
+        used_[j0] = true;
+        int i0 = row_of_col_[j0];
+        int j1 = 0;
+        double delta = std::numeric_limits<double>::max();
+        for (int j = 1; j <= dim_; j++)
+        {
+            if (used_[j])
+            {
+                continue;
+            }
+            double reduced = cost(i0, j) - u_[i0] - v_[j];
+            if (reduced < minv_[j])
+            {
+                minv_[j] = reduced;
+                way_[j] = j0;
+            }
+            if (minv_[j] < delta)
+            {
+                delta = minv_[j];
+                j1 = j;
+            }
+        }
+        if (j1 == 0)
+        {
+            return false;
+        }
+        for (int j = 0; j <= dim_; j++)
+        {
+            if (used_[j])
+            {
+                u_[row_of_col_[j]] += delta;
+                v_[j] -= delta;
+            }
+            else
+            {
+                minv_[j] -= delta;
+            }
+        }
+        j0 = j1;
+    } while (row_of_col_[j0] != 0);
+
+    do
+    {
+        int j1 = way_[j0];
+        row_of_col_[j0] = row_of_col_[j1];
+        j0 = j1;
+    } while (j0 != 0);
+
+    return true;
+}
+
+//********************************************************//
+// Dual feasibility and a zero duality gap prove the warm
+// started solution is the same optimum a full solve finds.
+//********************************************************//
+bool IncrementalHungarian::checkOptimality() const
+{
+    double primal = 0.0;
+    double dual = 0.0;
+    double scale = 1.0;
+    for (int j = 1; j <= dim_; j++)
+    {
+        int row = row_of_col_[j];
+        if (row == 0)
+        {
+            return false;
+        }
+        primal += cost(row, j);
+        dual += u_[j] + v_[j];
+        for (int i = 1; i <= dim_; i++)
+        {
+            double reduced = cost(i, j) - u_[i] - v_[j];
+            if (reduced < -1e-6)
+            {
+                return false;
+            }
+            scale = std::max(scale, std::abs(cost(i, j)));
+        }
+    }
+    return std::abs(primal - dual) <= 1e-6 * scale * dim_;
+}
+
+double IncrementalHungarian::fallbackSolve(
+    const std::vector<std::vector<double>> &DistMatrix,
+    std::vector<int> &Assignment,
+    std::vector<double> &RowDuals
+)
+{
+    used_fallback_ = true;
+    repaired_rows_ = DistMatrix.size();
+    // no duals from the full solver, the next frame starts cold
+    RowDuals.assign(DistMatrix.size(), 0.0);
+
+    HungarianAlgorithm HungAlgo;
+    return HungAlgo.Solve(DistMatrix, Assignment);
+}
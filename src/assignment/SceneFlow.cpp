@@ -0,0 +1,561 @@
+///////////////////////////////////////////////////////////////////////////////
+// SceneFlow.cpp: Implementation file for Class SceneFlow.
+//
+
+#include "tracker/SceneFlow.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+#include <opencv2/core.hpp>
+
+// 21 bits per axis, voxel coordinates are offset to stay positive
+static const int kVoxelBits = 21;
+static const int kVoxelOffset = 1 << (kVoxelBits - 1);
+static const uint64_t kVoxelMask = (1ull << kVoxelBits) - 1;
+
+SceneFlow::SceneFlow()
+{
+    prev_.valid_ = false;
+    cur_.valid_ = false;
+    moving_voxels_ = 0;
+}
+
+SceneFlow::~SceneFlow()
+{
+}
+
+uint64_t SceneFlow::voxelKey(int vx, int vy, int vz)
+{
+    return ((static_cast<uint64_t>(vx + kVoxelOffset) & kVoxelMask) << (2 * kVoxelBits)) |
+        ((static_cast<uint64_t>(vy + kVoxelOffset) & kVoxelMask) << kVoxelBits) |
+        (static_cast<uint64_t>(vz + kVoxelOffset) & kVoxelMask);
+}
+
+void SceneFlow::keyVoxel(uint64_t key, int & vx, int & vy, int & vz)
+{
+    vx = static_cast<int>((key >> (2 * kVoxelBits)) & kVoxelMask) - kVoxelOffset;
+    vy = static_cast<int>((key >> kVoxelBits) & kVoxelMask) - kVoxelOffset;
+    vz = static_cast<int>(key & kVoxelMask) - kVoxelOffset;
+}
+
+// fibonacci hashing, the high bits of the product mix every axis
+uint64_t SceneFlow::slotOf(const voxelHash & hash, uint64_t key)
+{
+    return (key * 0x9E3779B97F4A7C15ull) >> hash.slot_shift_;
+}
+
+int SceneFlow::find(const voxelHash & hash, uint64_t key)
+{
+    if (hash.slots_.empty())
+    {
+        return -1;
+    }
+    uint64_t slot = slotOf(hash, key);
+    while (hash.slots_[slot] >= 0)
+    {
+        if (hash.keys_[hash.slots_[slot]] == key)
+        {
+            return hash.slots_[slot];
+        }
+        slot = (slot + 1) & hash.slot_mask_;
+    }
+    return -1;
+}
+
+void SceneFlow::build(
+    const pcl::PointCloud<pcl::PointXYZI> & background,
+    const Eigen::Matrix4d & global_pose,
+    uint64_t time_stamp,
+    float voxel_size,
+    voxelHash & hash
+)
+{
+    int pt_num = background.size();
+    Eigen::Matrix4f lidar_to_global = global_pose.inverse().cast<float>();
+    Eigen::Matrix3f rotation = lidar_to_global.block<3, 3>(0, 0);
+    Eigen::Vector3f translation = lidar_to_global.block<3, 1>(0, 3);
+    float inv_voxel = 1.0f / voxel_size;
+
+    // (key, point) pairs, sorted so every voxel is one contiguous range
+    std::vector<std::pair<uint64_t, int>> point_keys(pt_num);
+    hash.points_.resize(pt_num);
+    cv::parallel_for_(cv::Range(0, pt_num), [&](const cv::Range & range)
+    {
+        for (int pt_idx = range.start; pt_idx < range.end; pt_idx++)
+        {
+            const pcl::PointXYZI & pt = background.points[pt_idx];
+            Eigen::Vector3f global_pt = rotation * Eigen::Vector3f(pt.x, pt.y, pt.z) + translation;
+            hash.points_[pt_idx] = global_pt;
+            point_keys[pt_idx] = std::make_pair(
+                voxelKey(
+                    static_cast<int>(std::floor(global_pt[0] * inv_voxel)),
+                    static_cast<int>(std::floor(global_pt[1] * inv_voxel)),
+                    static_cast<int>(std::floor(global_pt[2] * inv_voxel))
+                ),
+                pt_idx
+            );
+        }
+    });
+    std::sort(point_keys.begin(), point_keys.end());
+
+    hash.keys_.clear();
+    hash.centroids_.clear();
+    hash.mean_times_.clear();
+    hash.point_begin_.clear();
+    hash.point_order_.resize(pt_num);
+    for (int order_idx = 0; order_idx < pt_num; order_idx++)
+    {
+        hash.point_order_[order_idx] = point_keys[order_idx].second;
+        if (order_idx == 0 || point_keys[order_idx].first != point_keys[order_idx - 1].first)
+        {
+            hash.keys_.push_back(point_keys[order_idx].first);
+            hash.point_begin_.push_back(order_idx);
+        }
+    }
+    hash.point_begin_.push_back(pt_num);
+
+    int voxel_num = hash.keys_.size();
+    hash.centroids_.resize(voxel_num);
+    hash.mean_times_.resize(voxel_num);
+    cv::parallel_for_(cv::Range(0, voxel_num), [&](const cv::Range & range)
+    {
+        for (int voxel_idx = range.start; voxel_idx < range.end; voxel_idx++)
+        {
+            Eigen::Vector3f centroid(0.0f, 0.0f, 0.0f);
+            float time_sum = 0.0f;
+            int begin = hash.point_begin_[voxel_idx];
+            int end = hash.point_begin_[voxel_idx + 1];
+            for (int order_idx = begin; order_idx < end; order_idx++)
+            {
+                int pt_idx = hash.point_order_[order_idx];
+                centroid += hash.points_[pt_idx];
+                time_sum += background.points[pt_idx].intensity;
+            }
+            hash.centroids_[voxel_idx] = centroid / (end - begin);
+            hash.mean_times_[voxel_idx] = time_sum / (end - begin);
+        }
+    });
+
+    // load factor <= 0.5
+    size_t slot_num = 16;
+    hash.slot_shift_ = 60;
+    while (slot_num < 2 * static_cast<size_t>(voxel_num))
+    {
+        slot_num <<= 1;
+        hash.slot_shift_--;
+    }
+    hash.slots_.assign(slot_num, -1);
+    hash.slot_mask_ = slot_num - 1;
+    for (int voxel_idx = 0; voxel_idx < voxel_num; voxel_idx++)
+    {
+        uint64_t slot = slotOf(hash, hash.keys_[voxel_idx]);
+        while (hash.slots_[slot] >= 0)
+        {
+            slot = (slot + 1) & hash.slot_mask_;
+        }
+        hash.slots_[slot] = voxel_idx;
+    }
+    hash.time_stamp_ = time_stamp;
+    hash.valid_ = true;
+}
+
+int SceneFlow::nearestVoxel(const voxelHash & hash, const Eigen::Vector3f & pt, float voxel_size)
+{
+    float inv_voxel = 1.0f / voxel_size;
+    int vx = static_cast<int>(std::floor(pt[0] * inv_voxel));
+    int vy = static_cast<int>(std::floor(pt[1] * inv_voxel));
+    int vz = static_cast<int>(std::floor(pt[2] * inv_voxel));
+    float best_dist2 = std::numeric_limits<float>::max();
+    int best_idx = -1;
+    for (int dz = -1; dz <= 1; dz++)
+    {
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int voxel_idx = find(hash, voxelKey(vx + dx, vy + dy, vz + dz));
+                if (voxel_idx < 0)
+                {
+                    continue;
+                }
+                float dist2 = (hash.centroids_[voxel_idx] - pt).squaredNorm();
+                if (dist2 < best_dist2)
+                {
+                    best_dist2 = dist2;
+                    best_idx = voxel_idx;
+                }
+            }
+        }
+    }
+    return best_idx;
+}
+
+// coarse : the whole voxel shift in x y which moves the most voxels of the
+// cluster back onto voxels of the last frame, ties go to the smaller shift.
+// A rigid object matches itself at its motion, at a zero shift only the
+// part it still covers matches. fine : the same count on the points with
+// cells and steps halved per level around the best shift. Voxel centroids
+// would pull the shift to whole voxels along the faces of the object, the
+// points of a face don't prefer a shift along it.
+bool SceneFlow::estimateMotion(
+    const std::vector<int> & voxels,
+    int search_radius,
+    float voxel_size,
+    Eigen::Vector3f & shift,
+    std::vector<int> & matches
+)
+{
+    int cluster_num = voxels.size();
+    std::vector<Eigen::Vector3i> coords(cluster_num);
+    for (int member_idx = 0; member_idx < cluster_num; member_idx++)
+    {
+        keyVoxel(cur_.keys_[voxels[member_idx]], coords[member_idx][0], coords[member_idx][1], coords[member_idx][2]);
+    }
+
+    std::vector<Eigen::Vector2i> hypotheses;
+    for (int sy = -search_radius; sy <= search_radius; sy++)
+    {
+        for (int sx = -search_radius; sx <= search_radius; sx++)
+        {
+            if (sx * sx + sy * sy <= search_radius * search_radius)
+            {
+                hypotheses.push_back(Eigen::Vector2i(sx, sy));
+            }
+        }
+    }
+    // hypotheses are independent, every score is written by one worker
+    std::vector<int> scores(hypotheses.size(), 0);
+    cv::parallel_for_(cv::Range(0, hypotheses.size()), [&](const cv::Range & range)
+    {
+        for (int hyp_idx = range.start; hyp_idx < range.end; hyp_idx++)
+        {
+            for (int member_idx = 0; member_idx < cluster_num; member_idx++)
+            {
+                const Eigen::Vector3i & coord = coords[member_idx];
+                if (find(prev_, voxelKey(
+                    coord[0] - hypotheses[hyp_idx][0], 
+                    coord[1] - hypotheses[hyp_idx][1], 
+                    coord[2])) >= 0)
+                {
+                    scores[hyp_idx]++;
+                }
+            }
+        }
+    });
+    size_t best_idx = 0;
+    for (size_t hyp_idx = 1; hyp_idx < hypotheses.size(); hyp_idx++)
+    {
+        if (scores[hyp_idx] > scores[best_idx] || 
+            (scores[hyp_idx] == scores[best_idx] && 
+            hypotheses[hyp_idx].squaredNorm() < hypotheses[best_idx].squaredNorm()))
+        {
+            best_idx = hyp_idx;
+        }
+    }
+    Eigen::Vector2f center = hypotheses[best_idx].cast<float>() * voxel_size;
+
+    // points of the cluster and of the last frame voxels around it
+    std::vector<Eigen::Vector3f> cur_points;
+    std::vector<Eigen::Vector3f> prev_points;
+    std::unordered_set<int> prev_voxels;
+    for (int member_idx = 0; member_idx < cluster_num; member_idx++)
+    {
+        int voxel_idx = voxels[member_idx];
+        for (int order_idx = cur_.point_begin_[voxel_idx]; order_idx < cur_.point_begin_[voxel_idx + 1]; order_idx++)
+        {
+            cur_points.push_back(cur_.points_[cur_.point_order_[order_idx]]);
+        }
+        const Eigen::Vector3i & coord = coords[member_idx];
+        for (int dz = -1; dz <= 1; dz++)
+        {
+            for (int dy = -2; dy <= 2; dy++)
+            {
+                for (int dx = -2; dx <= 2; dx++)
+                {
+                    int prev_idx = find(prev_, voxelKey(
+                        coord[0] - hypotheses[best_idx][0] + dx, 
+                        coord[1] - hypotheses[best_idx][1] + dy, 
+                        coord[2] + dz));
+                    if (prev_idx >= 0 && prev_voxels.insert(prev_idx).second)
+                    {
+                        for (int order_idx = prev_.point_begin_[prev_idx]; order_idx < prev_.point_begin_[prev_idx + 1]; order_idx++)
+                        {
+                            prev_points.push_back(prev_.points_[prev_.point_order_[order_idx]]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    float cell = voxel_size;
+    for (int level = 0; level < 3; level++)
+    {
+        cell *= 0.5f;
+        float inv_cell = 1.0f / cell;
+        std::unordered_set<uint64_t> prev_cells;
+        prev_cells.reserve(2 * prev_points.size());
+        for (size_t pt_idx = 0; pt_idx < prev_points.size(); pt_idx++)
+        {
+            prev_cells.insert(voxelKey(
+                static_cast<int>(std::floor(prev_points[pt_idx][0] * inv_cell)),
+                static_cast<int>(std::floor(prev_points[pt_idx][1] * inv_cell)),
+                static_cast<int>(std::floor(prev_points[pt_idx][2] * inv_cell))
+            ));
+        }
+
+        std::vector<Eigen::Vector2f> fine_hypotheses;
+        for (int iy = -2; iy <= 2; iy++)
+        {
+            for (int ix = -2; ix <= 2; ix++)
+            {
+                fine_hypotheses.push_back(center + cell * Eigen::Vector2f(ix, iy));
+            }
+        }
+        std::vector<int> fine_scores(fine_hypotheses.size(), 0);
+        cv::parallel_for_(cv::Range(0, fine_hypotheses.size()), [&](const cv::Range & range)
+        {
+            for (int hyp_idx = range.start; hyp_idx < range.end; hyp_idx++)
+            {
+                for (size_t pt_idx = 0; pt_idx < cur_points.size(); pt_idx++)
+                {
+                    const Eigen::Vector3f & pt = cur_points[pt_idx];
+                    if (prev_cells.count(voxelKey(
+                        static_cast<int>(std::floor((pt[0] - fine_hypotheses[hyp_idx][0]) * inv_cell)),
+                        static_cast<int>(std::floor((pt[1] - fine_hypotheses[hyp_idx][1]) * inv_cell)),
+                        static_cast<int>(std::floor(pt[2] * inv_cell))
+                    )))
+                    {
+                        fine_scores[hyp_idx]++;
+                    }
+                }
+            }
+        });
+        size_t fine_best = 0;
+        for (size_t hyp_idx = 1; hyp_idx < fine_hypotheses.size(); hyp_idx++)
+        {
+            if (fine_scores[hyp_idx] > fine_scores[fine_best] || 
+                (fine_scores[hyp_idx] == fine_scores[fine_best] && 
+                (fine_hypotheses[hyp_idx] - center).squaredNorm() < (fine_hypotheses[fine_best] - center).squaredNorm()))
+            {
+                fine_best = hyp_idx;
+            }
+        }
+        center = fine_hypotheses[fine_best];
+    }
+    shift = Eigen::Vector3f(center[0], center[1], 0.0f);
+
+    // the voxel of the last frame every voxel came from
+    matches.assign(cluster_num, -1);
+    int matched_num = 0;
+    for (int member_idx = 0; member_idx < cluster_num; member_idx++)
+    {
+        matches[member_idx] = nearestVoxel(prev_, cur_.centroids_[voxels[member_idx]] - shift, voxel_size);
+        matched_num += matches[member_idx] >= 0 ? 1 : 0;
+    }
+    return 2 * matched_num >= cluster_num;
+}
+
+void SceneFlow::update(
+    const pcl::PointCloud<pcl::PointXYZI> & background,
+    const Eigen::Matrix4d & global_pose,
+    uint64_t time_stamp,
+    const Config & config_,
+    std::vector<flowCluster> & clusters
+)
+{
+    clusters.clear();
+    moving_voxels_ = 0;
+    std::swap(prev_, cur_);
+    build(background, global_pose, time_stamp, config_.scene_flow_voxel_size_, cur_);
+    if (!prev_.valid_ || time_stamp <= prev_.time_stamp_)
+    {
+        return;
+    }
+
+    float voxel_size = config_.scene_flow_voxel_size_;
+    float frame_dt = (time_stamp - prev_.time_stamp_) / 1e9;
+    int search_radius = std::max(1, static_cast<int>(std::ceil(
+        config_.scene_flow_max_speed_ * frame_dt / voxel_size)));
+    int voxel_num = cur_.keys_.size();
+
+    // seeds : a voxel with an occupied neighbour in the last frame is
+    // static, the others are seeds if a voxel of the last frame is within
+    // the radius. Only the leading faces of a moving object are seeds, the
+    // rest of it was occupied in the last frame too.
+    std::vector<char> seeds(voxel_num, 0);
+    cv::parallel_for_(cv::Range(0, voxel_num), [&](const cv::Range & range)
+    {
+        for (int voxel_idx = range.start; voxel_idx < range.end; voxel_idx++)
+        {
+            int vx, vy, vz;
+            keyVoxel(cur_.keys_[voxel_idx], vx, vy, vz);
+            bool is_static = false;
+            for (int dz = -1; dz <= 1 && !is_static; dz++)
+            {
+                for (int dy = -1; dy <= 1 && !is_static; dy++)
+                {
+                    for (int dx = -1; dx <= 1 && !is_static; dx++)
+                    {
+                        is_static = find(prev_, voxelKey(vx + dx, vy + dy, vz + dz)) >= 0;
+                    }
+                }
+            }
+            if (is_static)
+            {
+                continue;
+            }
+            // newly seen if nothing of the last frame is in reach
+            bool reachable = false;
+            for (int dz = -1; dz <= 1 && !reachable; dz++)
+            {
+                for (int dy = -search_radius; dy <= search_radius && !reachable; dy++)
+                {
+                    for (int dx = -search_radius; dx <= search_radius && !reachable; dx++)
+                    {
+                        reachable = find(prev_, voxelKey(vx + dx, vy + dy, vz + dz)) >= 0;
+                    }
+                }
+            }
+            seeds[voxel_idx] = reachable;
+        }
+    });
+
+    // clusters : the 26 connected seeds grown into the connected voxels of
+    // the object, above the lowest seed layer (ground) and within
+    // max_extent of the seeds (static scene touching the object)
+    Eigen::Matrix4f global_to_lidar = global_pose.cast<float>();
+    Eigen::Matrix3f global_to_lidar_rot = global_to_lidar.block<3, 3>(0, 0);
+    float max_extent2 = config_.scene_flow_max_extent_ * config_.scene_flow_max_extent_;
+    std::vector<char> visited(voxel_num, 0);
+    std::vector<int> queue;
+    std::vector<int> matches;
+    for (int seed_idx = 0; seed_idx < voxel_num; seed_idx++)
+    {
+        if (!seeds[seed_idx])
+        {
+            continue;
+        }
+        moving_voxels_++;
+        if (visited[seed_idx])
+        {
+            continue;
+        }
+        queue.clear();
+        queue.push_back(seed_idx);
+        visited[seed_idx] = 1;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            int seed_min_vz = std::numeric_limits<int>::max();
+            Eigen::Vector2f seed_center(0.0f, 0.0f);
+            if (pass == 1)
+            {
+                for (size_t queue_idx = 0; queue_idx < queue.size(); queue_idx++)
+                {
+                    int vx, vy, vz;
+                    keyVoxel(cur_.keys_[queue[queue_idx]], vx, vy, vz);
+                    seed_min_vz = std::min(seed_min_vz, vz);
+                    seed_center += cur_.centroids_[queue[queue_idx]].head<2>();
+                }
+                seed_center /= queue.size();
+            }
+            // pass 0 : the seeds, pass 1 : the object around them
+            for (size_t queue_idx = 0; queue_idx < queue.size(); queue_idx++)
+            {
+                int vx, vy, vz;
+                keyVoxel(cur_.keys_[queue[queue_idx]], vx, vy, vz);
+                for (int dz = -1; dz <= 1; dz++)
+                {
+                    for (int dy = -1; dy <= 1; dy++)
+                    {
+                        for (int dx = -1; dx <= 1; dx++)
+                        {
+                            int next_idx = find(cur_, voxelKey(vx + dx, vy + dy, vz + dz));
+                            if (next_idx < 0 || visited[next_idx])
+                            {
+                                continue;
+                            }
+                            bool member = seeds[next_idx] != 0 || (pass == 1 &&
+                                vz + dz > seed_min_vz && 
+                                (cur_.centroids_[next_idx].head<2>() - seed_center).squaredNorm() <= max_extent2);
+                            if (member)
+                            {
+                                visited[next_idx] = 1;
+                                queue.push_back(next_idx);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if (static_cast<int>(queue.size()) < config_.scene_flow_min_voxels_)
+        {
+            continue;
+        }
+
+        Eigen::Vector3f shift;
+        if (!estimateMotion(queue, search_radius, voxel_size, shift, matches))
+        {
+            continue;
+        }
+        // coherent : the voxel moved by about the cluster shift. The others
+        // (static scene touching the object) are dropped, a seed stays.
+        int coherent_num = 0;
+        float cur_time_sum = 0.0f;
+        float prev_time_sum = 0.0f;
+        float coherent_radius = std::max(voxel_size, 
+            static_cast<float>(config_.scene_flow_coherence_) * shift.head<2>().norm());
+        std::vector<char> keep(queue.size(), 0);
+        for (size_t queue_idx = 0; queue_idx < queue.size(); queue_idx++)
+        {
+            int voxel_idx = queue[queue_idx];
+            keep[queue_idx] = seeds[voxel_idx];
+            if (matches[queue_idx] < 0)
+            {
+                continue;
+            }
+            Eigen::Vector3f displacement = cur_.centroids_[voxel_idx] - prev_.centroids_[matches[queue_idx]];
+            if ((displacement - shift).head<2>().norm() <= coherent_radius)
+            {
+                keep[queue_idx] = 1;
+                coherent_num++;
+                cur_time_sum += cur_.mean_times_[voxel_idx];
+                prev_time_sum += prev_.mean_times_[matches[queue_idx]];
+            }
+        }
+        if (2 * coherent_num < static_cast<int>(queue.size()))
+        {
+            continue;
+        }
+        float dt = frame_dt + (cur_time_sum - prev_time_sum) / coherent_num;
+        if (dt <= 0.0f)
+        {
+            continue;
+        }
+        Eigen::Vector3f flow = shift / dt;
+        float speed = flow.head<2>().norm();
+        if (speed < config_.scene_flow_min_speed_ || speed > config_.scene_flow_max_speed_)
+        {
+            continue;
+        }
+
+        flowCluster cluster;
+        cluster.flow_ = (global_to_lidar_rot * flow).cast<double>();
+        cluster.voxel_num_ = 0;
+        for (size_t queue_idx = 0; queue_idx < queue.size(); queue_idx++)
+        {
+            if (!keep[queue_idx])
+            {
+                continue;
+            }
+            int voxel_idx = queue[queue_idx];
+            cluster.voxel_num_++;
+            for (int order_idx = cur_.point_begin_[voxel_idx]; order_idx < cur_.point_begin_[voxel_idx + 1]; order_idx++)
+            {
+                cluster.cloud_.push_back(background.points[cur_.point_order_[order_idx]]);
+            }
+        }
+        clusters.push_back(cluster);
+    }
+}
@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////
+// VelocityWindow.cpp: Implementation file for Class VelocityWindow.
+//
+
+#include "tracker/VelocityWindow.h"
+
+VelocityWindow::VelocityWindow()
+{
+    window_size_ = 5;
+    with_acceleration_ = false;
+    position_var_ = 0.04;
+    epoch_s_ = 1.0;
+    clear();
+}
+
+VelocityWindow::~VelocityWindow()
+{
+}
+
+void VelocityWindow::configure(
+    size_t window_size,
+    bool with_acceleration,
+    double position_var,
+    double epoch_s
+)
+{
+    if (window_size == window_size_ && with_acceleration == with_acceleration_ &&
+        position_var == position_var_ && epoch_s == epoch_s_)
+    {
+        return;
+    }
+    window_size_ = std::max<size_t>(window_size, 1);
+    with_acceleration_ = with_acceleration;
+    position_var_ = position_var;
+    epoch_s_ = epoch_s;
+    while (frames_.size() > window_size_)
+    {
+        frames_.pop_front();
+    }
+    if (!frames_.empty())
+    {
+        reanchor(frames_.back().time_stamp_);
+    }
+}
+
+void VelocityWindow::clear()
+{
+    frames_.clear();
+    anchor_time_stamp_ = 0;
+    information_.setZero();
+    rhs_.setZero();
+}
+
+double VelocityWindow::relativeTime(uint64_t time_stamp) const
+{
+    if (time_stamp >= anchor_time_stamp_)
+    {
+        return (time_stamp - anchor_time_stamp_) / 1e9;
+    }
+    return -((anchor_time_stamp_ - time_stamp) / 1e9);
+}
+
+void VelocityWindow::add(const windowFrame & frame)
+{
+    if (frames_.empty())
+    {
+        anchor_time_stamp_ = frame.time_stamp_;
+    }
+    if (frames_.size() >= window_size_)
+    {
+        accumulate(frames_.front(), -1.0);
+        frames_.pop_front();
+    }
+    frames_.push_back(frame);
+    accumulate(frame, 1.0);
+
+    if (relativeTime(frame.time_stamp_) > epoch_s_)
+    {
+        reanchor(frame.time_stamp_);
+    }
+}
+
+void VelocityWindow::accumulate(const windowFrame & frame, double sign)
+{
+    double tau = relativeTime(frame.time_stamp_);
+
+    // center : p0 + v tau + a tau^2 / 2, isotropic position_var_
+    Eigen::Matrix<double, 3, 9> position_jacobian;
+    position_jacobian <<
+        Eigen::Matrix3d::Identity(),
+        tau * Eigen::Matrix3d::Identity(),
+        0.5 * tau * tau * Eigen::Matrix3d::Identity();
+    information_ += sign / position_var_ * position_jacobian.transpose() * position_jacobian;
+    rhs_ += sign / position_var_ * position_jacobian.transpose() * frame.center_;
+
+    // velocity : v + a tau, weighted by the frame estimator covariance
+    Eigen::Matrix<double, 3, 9> vel_jacobian;
+    vel_jacobian <<
+        Eigen::Matrix3d::Zero(),
+        Eigen::Matrix3d::Identity(),
+        tau * Eigen::Matrix3d::Identity();
+    Eigen::Matrix3d vel_weight = frame.vel_cov_.ldlt().solve(Eigen::Matrix3d::Identity());
+    if (!vel_weight.allFinite())
+    {
+        return;
+    }
+    information_ += sign * vel_jacobian.transpose() * vel_weight * vel_jacobian;
+    rhs_ += sign * vel_jacobian.transpose() * vel_weight * frame.vel_;
+}
+
+void VelocityWindow::reanchor(uint64_t time_stamp)
+{
+    anchor_time_stamp_ = time_stamp;
+    information_.setZero();
+    rhs_.setZero();
+    for (size_t frame_idx = 0; frame_idx < frames_.size(); frame_idx++)
+    {
+        accumulate(frames_[frame_idx], 1.0);
+    }
+}
+
+bool VelocityWindow::solve(
+    uint64_t time_stamp,
+    Eigen::Vector3d & vel,
+    Eigen::Matrix3d & vel_cov
+) const
+{
+    if (frames_.empty())
+    {
+        return false;
+    }
+    int state_dim = with_acceleration_ ? 9 : 6;
+    Eigen::MatrixXd information = information_.topLeftCorner(state_dim, state_dim);
+    Eigen::LDLT<Eigen::MatrixXd> ldlt(information);
+    if (ldlt.info() != Eigen::Success || !ldlt.isPositive() ||
+        ldlt.vectorD().minCoeff() <= 1e-9 * ldlt.vectorD().maxCoeff())
+    {
+        return false;
+    }
+    Eigen::VectorXd state = ldlt.solve(rhs_.head(state_dim));
+    Eigen::MatrixXd state_cov = ldlt.solve(Eigen::MatrixXd::Identity(state_dim, state_dim));
+
+    // v(t) = v + a tau
+    double tau = relativeTime(time_stamp);
+    Eigen::MatrixXd vel_map = Eigen::MatrixXd::Zero(3, state_dim);
+    vel_map.block<3, 3>(0, 3).setIdentity();
+    if (with_acceleration_)
+    {
+        vel_map.block<3, 3>(0, 6) = tau * Eigen::Matrix3d::Identity();
+    }
+    vel = vel_map * state;
+    vel_cov = vel_map * state_cov * vel_map.transpose();
+    return vel.allFinite() && vel_cov.allFinite();
+}
@@ -336,50 +336,72 @@ bool assignment::run(int argc, char** argv)
     viewer_objs->setCameraPosition(-46.698877,8.333347,39.880589,0.449239,-0.004796,0.893399);
 
     // main frame loop
+    // point buffers, images and temporaries of a frame are reused by the next
+    FrameMemory frame_memory;
     fusion_tracker fusionTracker;
+    fusionTracker.set_frame_memory(&frame_memory);
+    SceneFlow scene_flow;
     size_t loop_count = 0;
+    sensor_msgs::PointCloud2 raw_cloud_msg;
+    sensor_msgs::PointCloud2 background_cloud_msg;
+    sensor_msgs::PointCloud2 obj_cloud_msg;
+    pcl::PointCloud<pcl::PointXYZI> obj_cloud;
     std::vector<pcl::PointCloud<pcl::PointXYZRGB>> final_last_pcs;
     visualization_msgs::MarkerArray obj_vel_txt_markerarray;
     for (size_t frame_idx = 0; frame_idx < pcd_buffer.size(); ++frame_idx)
     {
         Timer frame_timer("This frame time");
 
-        cout << "=========================== seq:" << 
-            frame_idx + 1 << " ===========================" << endl;
-
-        expand_3d_cube(detection_3d_buffer[frame_idx]);
-
-        Frame frame(
-            raw_img_buffer[frame_idx],
-            label_img_buffer[frame_idx],
-            pcd_buffer[frame_idx],      
-            bbox_buffer[frame_idx],
-            detection_3d_buffer[frame_idx],
-            config_
-        );
+        if (config_.log_verbose_)
+        {
+            cout << "=========================== seq:" << 
+                frame_idx + 1 << " ===========================" << endl;
+        }
 
-        frame.full_detection(&pcd_buffer[frame_idx]);
+        // the inputs of the frame move out of the loaded buffers
+        FramePacket packet;
+        packet.raw_img_ = std::move(raw_img_buffer[frame_idx]);
+        packet.label_img_ = std::move(label_img_buffer[frame_idx]);
+        packet.pcds_ = std::move(pcd_buffer[frame_idx]);
+        packet.bboxes_ = std::move(bbox_buffer[frame_idx]);
+        packet.cubes_ = std::move(detection_3d_buffer[frame_idx]);
+        packet.pose_ = pose_buffer[frame_idx];
+        expand_3d_cube(packet.cubes_);
+
+        // before the frame, so the frame gives its buffers back first
+        FrameScope frame_scope(frame_memory, config_.log_verbose_);
+        Frame frame(std::move(packet), config_, &frame_memory);
+        const FramePacket & frame_in = frame.packet();
+
+        frame.full_detection();
         // frame.verboseFrame();
 
         std::vector<alignedDet> aligned_detection_buffer;
         std::vector<pcl::PointCloud<pcl::PointXYZI>> * obj_clouds;
-        pcl::PointCloud<pcl::PointXYZI> obj_cloud;
         obj_clouds = frame.getObjcloud();
         // no detection obj order !
         frame.detection_align(
             obj_clouds,
-            &raw_img_buffer[frame_idx].second,
-            &detection_3d_buffer[frame_idx].second,
-            &bbox_buffer[frame_idx].second,
-            &pose_buffer[frame_idx].second,
+            &frame_in.raw_img_.second,
+            &frame_in.cubes_.second,
+            &frame_in.bboxes_.second,
+            &frame_in.pose_.second,
             aligned_detection_buffer
         );
+        if (config_.scene_flow_enable_)
+        {
+            frame.scene_flow_detection(
+                scene_flow,
+                &frame_in.raw_img_.second,
+                &frame_in.pose_.second,
+                aligned_detection_buffer
+            );
+        }
 
         vis.txt_marker_3d_publisher(aligned_detection_buffer);
 
-        // raw cloud
-        sensor_msgs::PointCloud2 raw_cloud_msg;
-        pcl::PointCloud<pcl::PointXYZI> frame_pcd = *frame.getCloud(); 
+        // raw cloud, the messages keep their buffers from the last frame
+        const pcl::PointCloud<pcl::PointXYZI> & frame_pcd = frame.getCloud(); 
         pcl::toROSMsg(frame_pcd, raw_cloud_msg);
         viewer_objs->addPointCloud<pcl::PointXYZI>(
             frame_pcd.makeShared(), 
@@ -388,34 +410,36 @@ bool assignment::run(int argc, char** argv)
         vis.raw_cloud_publisher(raw_cloud_msg);
 
         // background cloud
-        sensor_msgs::PointCloud2 background_cloud_msg;
-        pcl::PointCloud<pcl::PointXYZI> background_cloud = *frame.getBackgroundcloud(); 
-        pcl::toROSMsg(background_cloud, background_cloud_msg);
+        pcl::toROSMsg(frame.getBackgroundcloud(), background_cloud_msg);
         vis.background_cloud_publisher(background_cloud_msg);
 
         // obj cloud
+        obj_cloud.clear();
         for (size_t pcd_idx = 0; pcd_idx < aligned_detection_buffer.size(); pcd_idx++)
         {
-            obj_cloud += aligned_detection_buffer[pcd_idx].cloud_;
+            aligned_detection_buffer[pcd_idx].cloud_.appendTo(obj_cloud);
         }
-        sensor_msgs::PointCloud2 obj_cloud_msg;
         pcl::toROSMsg(obj_cloud, obj_cloud_msg);
         vis.raw_obj_cloud_publisher(obj_cloud_msg);
 
-        vis.raw_img_publisher(raw_img_buffer[frame_idx].second);
+        vis.raw_img_publisher(frame_in.raw_img_.second);
 
-        vis.label_img_publisher(label_img_buffer[frame_idx].second);
+        vis.label_img_publisher(frame_in.label_img_.second);
 
         fusionTracker.tracking(
             aligned_detection_buffer,
-            raw_img_buffer[frame_idx].second,
+            frame_in.raw_img_.second,
+            frame_in.pcds_.first,
             config_,
             viewer_objs,
             obj_vel_txt_markerarray,
             &vis
         );
 
-        frame_timer.rlog("This frame cost time");
+        if (config_.log_verbose_)
+        {
+            frame_timer.rlog("This frame cost time");
+        }
 
         loop_count++;
         while (1) 
@@ -569,18 +593,18 @@ void expand_3d_cube(
 {
     for (size_t obj_idx = 0; obj_idx < cubes_in.second.size(); obj_idx++)
     {
-        Eigen::Vector3d obj_center = cubes_in.second[obj_idx].cube_vertexs_.colwise().mean();
+        Eigen::Vector3d obj_center = cubes_in.second[obj_idx].cube_vertexs().colwise().mean().cast<double>();
         for (size_t pt_idx = 0; pt_idx < 8; pt_idx++)
         {
             Eigen::Vector3d expand_value;
             double expand_ratio = 0.2;
-            expand_value[0] = expand_ratio * (cubes_in.second[obj_idx].cube_vertexs_(pt_idx,0) - obj_center[0]);
-            expand_value[1] = expand_ratio * (cubes_in.second[obj_idx].cube_vertexs_(pt_idx,1) - obj_center[1]);
-            expand_value[2] = expand_ratio * (cubes_in.second[obj_idx].cube_vertexs_(pt_idx,2) - obj_center[2]);
+            expand_value[0] = expand_ratio * (cubes_in.second[obj_idx].cube_vertexs()(pt_idx,0) - obj_center[0]);
+            expand_value[1] = expand_ratio * (cubes_in.second[obj_idx].cube_vertexs()(pt_idx,1) - obj_center[1]);
+            expand_value[2] = expand_ratio * (cubes_in.second[obj_idx].cube_vertexs()(pt_idx,2) - obj_center[2]);
 
-            cubes_in.second[obj_idx].cube_vertexs_(pt_idx,0) += expand_value[0];
-            cubes_in.second[obj_idx].cube_vertexs_(pt_idx,1) += expand_value[1];
-            cubes_in.second[obj_idx].cube_vertexs_(pt_idx,2) += expand_value[2];
+            cubes_in.second[obj_idx].cube_vertexs()(pt_idx,0) += expand_value[0];
+            cubes_in.second[obj_idx].cube_vertexs()(pt_idx,1) += expand_value[1];
+            cubes_in.second[obj_idx].cube_vertexs()(pt_idx,2) += expand_value[2];
         }
     }
     
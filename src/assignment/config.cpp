@@ -144,6 +144,15 @@ bool Config::readParam()
     { 
         return false;
     }
+    if (config["log_verbose"]) 
+    {
+        log_verbose_ = config["log_verbose"].as<bool>();
+        std::cout << "\nlog_verbose_ :\n" << log_verbose_ << std::endl;
+    }
+    else
+    { 
+        return false;
+    }
     if (config["sparse_optical_flow_param"]["maxCorners"]) 
     {
         maxCorners_ = config["sparse_optical_flow_param"]["maxCorners"].as<double>();
@@ -189,6 +198,465 @@ bool Config::readParam()
     {
         return false;
     }
+    if (config["sparse_optical_flow_param"]["roi_margin"]) 
+    {
+        roi_margin_ = config["sparse_optical_flow_param"]["roi_margin"].as<int>();
+        std::cout << "\nroi_margin_ :\n" << roi_margin_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["roi_min_corners"]) 
+    {
+        roi_min_corners_ = config["sparse_optical_flow_param"]["roi_min_corners"].as<int>();
+        std::cout << "\nroi_min_corners_ :\n" << roi_min_corners_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["fb_max_error"]) 
+    {
+        fb_max_error_ = config["sparse_optical_flow_param"]["fb_max_error"].as<double>();
+        std::cout << "\nfb_max_error_ :\n" << fb_max_error_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["feature_replenish_ratio"]) 
+    {
+        feature_replenish_ratio_ = config["sparse_optical_flow_param"]["feature_replenish_ratio"].as<double>();
+        std::cout << "\nfeature_replenish_ratio_ :\n" << feature_replenish_ratio_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["flow_max_level"]) 
+    {
+        flow_max_level_ = config["sparse_optical_flow_param"]["flow_max_level"].as<int>();
+        std::cout << "\nflow_max_level_ :\n" << flow_max_level_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["flow_min_box_px"]) 
+    {
+        flow_min_box_px_ = config["sparse_optical_flow_param"]["flow_min_box_px"].as<int>();
+        std::cout << "\nflow_min_box_px_ :\n" << flow_min_box_px_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["pixel_motion_estimator"]) 
+    {
+        pixel_motion_estimator_ = config["sparse_optical_flow_param"]["pixel_motion_estimator"].as<std::string>();
+        std::cout << "\npixel_motion_estimator_ :\n" << pixel_motion_estimator_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["pixel_motion_irls_iterations"]) 
+    {
+        pixel_motion_irls_iterations_ = config["sparse_optical_flow_param"]["pixel_motion_irls_iterations"].as<int>();
+        std::cout << "\npixel_motion_irls_iterations_ :\n" << pixel_motion_irls_iterations_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["pixel_motion_min_sigma"]) 
+    {
+        pixel_motion_min_sigma_ = config["sparse_optical_flow_param"]["pixel_motion_min_sigma"].as<double>();
+        std::cout << "\npixel_motion_min_sigma_ :\n" << pixel_motion_min_sigma_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["optical_flow_engine"]) 
+    {
+        optical_flow_engine_ = config["sparse_optical_flow_param"]["optical_flow_engine"].as<std::string>();
+        std::cout << "\noptical_flow_engine_ :\n" << optical_flow_engine_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["dense_min_inliers"]) 
+    {
+        dense_min_inliers_ = config["sparse_optical_flow_param"]["dense_min_inliers"].as<int>();
+        std::cout << "\ndense_min_inliers_ :\n" << dense_min_inliers_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["sparse_optical_flow_param"]["dense_stride"]) 
+    {
+        dense_stride_ = config["sparse_optical_flow_param"]["dense_stride"].as<int>();
+        std::cout << "\ndense_stride_ :\n" << dense_stride_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["tracking_param"]["assignment_warm_start"]) 
+    {
+        assignment_warm_start_ = config["tracking_param"]["assignment_warm_start"].as<bool>();
+        std::cout << "\nassignment_warm_start_ :\n" << assignment_warm_start_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["tracking_param"]["assignment_verify"]) 
+    {
+        assignment_verify_ = config["tracking_param"]["assignment_verify"].as<bool>();
+        std::cout << "\nassignment_verify_ :\n" << assignment_verify_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["tracking_param"]["association_max_speed"]) 
+    {
+        association_max_speed_ = config["tracking_param"]["association_max_speed"].as<double>();
+        std::cout << "\nassociation_max_speed_ :\n" << association_max_speed_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["tracking_param"]["track_max_age"]) 
+    {
+        track_max_age_ = config["tracking_param"]["track_max_age"].as<int>();
+        std::cout << "\ntrack_max_age_ :\n" << track_max_age_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["tracking_param"]["track_min_hits"]) 
+    {
+        track_min_hits_ = config["tracking_param"]["track_min_hits"].as<int>();
+        std::cout << "\ntrack_min_hits_ :\n" << track_min_hits_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_solver"]) 
+    {
+        point_vel_solver_ = config["velocity_param"]["point_vel_solver"].as<std::string>();
+        std::cout << "\npoint_vel_solver_ :\n" << point_vel_solver_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_validate"]) 
+    {
+        point_vel_validate_ = config["velocity_param"]["point_vel_validate"].as<bool>();
+        std::cout << "\npoint_vel_validate_ :\n" << point_vel_validate_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_max_iterations"]) 
+    {
+        point_vel_max_iterations_ = config["velocity_param"]["point_vel_max_iterations"].as<int>();
+        std::cout << "\npoint_vel_max_iterations_ :\n" << point_vel_max_iterations_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_degenerate_var"]) 
+    {
+        point_vel_degenerate_var_ = config["velocity_param"]["point_vel_degenerate_var"].as<double>();
+        std::cout << "\npoint_vel_degenerate_var_ :\n" << point_vel_degenerate_var_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_budget"]) 
+    {
+        point_vel_budget_ = config["velocity_param"]["point_vel_budget"].as<size_t>();
+        std::cout << "\npoint_vel_budget_ :\n" << point_vel_budget_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_sampling"]) 
+    {
+        point_vel_sampling_ = config["velocity_param"]["point_vel_sampling"].as<std::string>();
+        std::cout << "\npoint_vel_sampling_ :\n" << point_vel_sampling_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_voxel_size"]) 
+    {
+        point_vel_voxel_size_ = config["velocity_param"]["point_vel_voxel_size"].as<double>();
+        std::cout << "\npoint_vel_voxel_size_ :\n" << point_vel_voxel_size_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_budget_compare"]) 
+    {
+        point_vel_budget_compare_ = config["velocity_param"]["point_vel_budget_compare"].as<bool>();
+        std::cout << "\npoint_vel_budget_compare_ :\n" << point_vel_budget_compare_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["point_vel_direction"]) 
+    {
+        point_vel_direction_ = config["velocity_param"]["point_vel_direction"].as<std::string>();
+        std::cout << "\npoint_vel_direction_ :\n" << point_vel_direction_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["bev_search_max_speed"]) 
+    {
+        bev_search_max_speed_ = config["velocity_param"]["bev_search_max_speed"].as<double>();
+        std::cout << "\nbev_search_max_speed_ :\n" << bev_search_max_speed_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["bev_search_coarse_step"]) 
+    {
+        bev_search_coarse_step_ = config["velocity_param"]["bev_search_coarse_step"].as<double>();
+        std::cout << "\nbev_search_coarse_step_ :\n" << bev_search_coarse_step_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["bev_search_levels"]) 
+    {
+        bev_search_levels_ = config["velocity_param"]["bev_search_levels"].as<int>();
+        std::cout << "\nbev_search_levels_ :\n" << bev_search_levels_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["bev_search_cell"]) 
+    {
+        bev_search_cell_ = config["velocity_param"]["bev_search_cell"].as<double>();
+        std::cout << "\nbev_search_cell_ :\n" << bev_search_cell_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["bev_search_min_cell"]) 
+    {
+        bev_search_min_cell_ = config["velocity_param"]["bev_search_min_cell"].as<double>();
+        std::cout << "\nbev_search_min_cell_ :\n" << bev_search_min_cell_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["bev_search_min_speed"]) 
+    {
+        bev_search_min_speed_ = config["velocity_param"]["bev_search_min_speed"].as<double>();
+        std::cout << "\nbev_search_min_speed_ :\n" << bev_search_min_speed_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["velocity_engine"]) 
+    {
+        velocity_engine_ = config["velocity_param"]["velocity_engine"].as<std::string>();
+        std::cout << "\nvelocity_engine_ :\n" << velocity_engine_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["velocity_engine_compare"]) 
+    {
+        velocity_engine_compare_ = config["velocity_param"]["velocity_engine_compare"].as<bool>();
+        std::cout << "\nvelocity_engine_compare_ :\n" << velocity_engine_compare_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["registration_max_iterations"]) 
+    {
+        registration_max_iterations_ = config["velocity_param"]["registration_max_iterations"].as<int>();
+        std::cout << "\nregistration_max_iterations_ :\n" << registration_max_iterations_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["registration_max_distance"]) 
+    {
+        registration_max_distance_ = config["velocity_param"]["registration_max_distance"].as<double>();
+        std::cout << "\nregistration_max_distance_ :\n" << registration_max_distance_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["registration_epsilon"]) 
+    {
+        registration_epsilon_ = config["velocity_param"]["registration_epsilon"].as<double>();
+        std::cout << "\nregistration_epsilon_ :\n" << registration_epsilon_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["registration_min_points"]) 
+    {
+        registration_min_points_ = config["velocity_param"]["registration_min_points"].as<size_t>();
+        std::cout << "\nregistration_min_points_ :\n" << registration_min_points_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["velocity_window_size"]) 
+    {
+        velocity_window_size_ = config["velocity_param"]["velocity_window_size"].as<size_t>();
+        std::cout << "\nvelocity_window_size_ :\n" << velocity_window_size_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["velocity_window_acceleration"]) 
+    {
+        velocity_window_acceleration_ = config["velocity_param"]["velocity_window_acceleration"].as<bool>();
+        std::cout << "\nvelocity_window_acceleration_ :\n" << velocity_window_acceleration_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["velocity_window_position_var"]) 
+    {
+        velocity_window_position_var_ = config["velocity_param"]["velocity_window_position_var"].as<double>();
+        std::cout << "\nvelocity_window_position_var_ :\n" << velocity_window_position_var_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["velocity_window_epoch"]) 
+    {
+        velocity_window_epoch_ = config["velocity_param"]["velocity_window_epoch"].as<double>();
+        std::cout << "\nvelocity_window_epoch_ :\n" << velocity_window_epoch_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["scene_flow_param"]["scene_flow_enable"]) 
+    {
+        scene_flow_enable_ = config["scene_flow_param"]["scene_flow_enable"].as<bool>();
+        std::cout << "\nscene_flow_enable_ :\n" << scene_flow_enable_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["scene_flow_param"]["scene_flow_voxel_size"]) 
+    {
+        scene_flow_voxel_size_ = config["scene_flow_param"]["scene_flow_voxel_size"].as<double>();
+        std::cout << "\nscene_flow_voxel_size_ :\n" << scene_flow_voxel_size_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["scene_flow_param"]["scene_flow_min_speed"]) 
+    {
+        scene_flow_min_speed_ = config["scene_flow_param"]["scene_flow_min_speed"].as<double>();
+        std::cout << "\nscene_flow_min_speed_ :\n" << scene_flow_min_speed_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["scene_flow_param"]["scene_flow_max_speed"]) 
+    {
+        scene_flow_max_speed_ = config["scene_flow_param"]["scene_flow_max_speed"].as<double>();
+        std::cout << "\nscene_flow_max_speed_ :\n" << scene_flow_max_speed_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["scene_flow_param"]["scene_flow_min_voxels"]) 
+    {
+        scene_flow_min_voxels_ = config["scene_flow_param"]["scene_flow_min_voxels"].as<int>();
+        std::cout << "\nscene_flow_min_voxels_ :\n" << scene_flow_min_voxels_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["scene_flow_param"]["scene_flow_max_extent"]) 
+    {
+        scene_flow_max_extent_ = config["scene_flow_param"]["scene_flow_max_extent"].as<double>();
+        std::cout << "\nscene_flow_max_extent_ :\n" << scene_flow_max_extent_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["scene_flow_param"]["scene_flow_coherence"]) 
+    {
+        scene_flow_coherence_ = config["scene_flow_param"]["scene_flow_coherence"].as<double>();
+        std::cout << "\nscene_flow_coherence_ :\n" << scene_flow_coherence_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["scene_flow_param"]["scene_flow_confidence"]) 
+    {
+        scene_flow_confidence_ = config["scene_flow_param"]["scene_flow_confidence"].as<double>();
+        std::cout << "\nscene_flow_confidence_ :\n" << scene_flow_confidence_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
+    if (config["velocity_param"]["velocity_threads"]) 
+    {
+        velocity_threads_ = config["velocity_param"]["velocity_threads"].as<size_t>();
+        std::cout << "\nvelocity_threads_ :\n" << velocity_threads_ << std::endl;
+    }
+    else
+    {
+        return false;
+    }
     std::cout << "-----------------config param-----------------" << std::endl;
     return true;
 }
\ No newline at end of file
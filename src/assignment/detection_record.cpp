@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+// detection_record.cpp: Implementation file for the compact detection records.
+//
+
+#include "common/detection_record.h"
+
+ClassTable::ClassTable()
+{
+    names_.push_back("");
+    ids_[""] = 0;
+}
+
+ClassTable & ClassTable::instance()
+{
+    static ClassTable table;
+    return table;
+}
+
+uint16_t ClassTable::intern(const std::string & class_name)
+{
+    ClassTable & table = instance();
+    std::lock_guard<std::mutex> lock(table.mutex_);
+    std::unordered_map<std::string, uint16_t>::const_iterator found = table.ids_.find(class_name);
+    if (found != table.ids_.end())
+    {
+        return found->second;
+    }
+    uint16_t class_id = table.names_.size();
+    table.names_.push_back(class_name);
+    table.ids_[class_name] = class_id;
+    return class_id;
+}
+
+const std::string & ClassTable::name(uint16_t class_id)
+{
+    ClassTable & table = instance();
+    std::lock_guard<std::mutex> lock(table.mutex_);
+    return table.names_[class_id];
+}
+
+PoseTable::PoseTable()
+{
+    poses_.assign(kPoseSlots + 1, Eigen::Matrix4d::Identity());
+    inverses_.assign(kPoseSlots + 1, Eigen::Matrix4d::Identity());
+    next_idx_ = 1;
+}
+
+PoseTable & PoseTable::global()
+{
+    static PoseTable table;
+    return table;
+}
+
+uint32_t PoseTable::add(const Eigen::Matrix4d & global_pose)
+{
+    uint32_t pose_idx = next_idx_;
+    // wraps past 0, which stays the identity
+    next_idx_ = next_idx_ == UINT32_MAX ? 1 : next_idx_ + 1;
+    poses_[slot(pose_idx)] = global_pose;
+    inverses_[slot(pose_idx)] = global_pose.inverse();
+    return pose_idx;
+}
@@ -1,36 +1,34 @@
 #include "common/frame.h"
+#include "common/time.h"
 
 Frame::Frame(
-    imageWithTime& raw_img,
-    imageWithTime& label_img,
-    pcdsWithTime& pcd,
-    frameBboxsWithTime& bbox,
-    frameCubesWithTime& cube,
-    Config config
-)
+    FramePacket && packet,
+    const Config & config,
+    FrameMemory * memory
+):
+global_config_(config),
+packet_(std::move(packet)),
+memory_(memory),
+pose_idx_(0)
 {
-    this->global_config_ = config;
-
-    this->raw_img_ = raw_img.second;
-    this->time_stamp_[0] = raw_img.first;
-
-    this->label_img_ = label_img.second;
-    this->time_stamp_[1] = label_img.first;
-
-    this->time_stamp_[2] = pcd.first;
-
-    this->objs_ = bbox.second;
-
-    this->cubes_ = cube.second;
-
+    this->time_stamp_[0] = packet_.raw_img_.first;
+    this->time_stamp_[1] = packet_.label_img_.first;
+    this->time_stamp_[2] = packet_.pcds_.first;
     for (size_t pcd_idx = 0; pcd_idx < hubLidarNum; pcd_idx++)
     {
-        this->time_stamp_[pcd_idx+3] = pcd.second[pcd_idx].first;
-        this->pointclouds_.push_back(pcd.second[pcd_idx].second);
-        frame_pointcloud_ = pcd.second[pcd_idx].second + frame_pointcloud_;
+        this->time_stamp_[pcd_idx+3] = packet_.pcds_.second[pcd_idx].first;
     }
 }
 
+uint32_t Frame::frame_pose(const Eigen::Matrix4d & global_pose)
+{
+    // add never returns 0, the identity
+    if (pose_idx_ == 0)
+    {
+        pose_idx_ = PoseTable::global().add(global_pose);
+    }
+    return pose_idx_;
+}
 
 bool Frame::verboseFrame()
 {
@@ -41,10 +39,10 @@ bool Frame::verboseFrame()
         << std::to_string(this->time_stamp_[1]).insert(10,"_") << std::endl;
     std::cout << "pcds      time : " 
         << std::to_string(this->time_stamp_[2]).insert(10,"_") 
-        << ",  points number = " << this->frame_pointcloud_.size()
+        << ",  points number = " << this->frame_detections_.cloud_.size()
         << std::endl;
-    std::cout << "detected \"" << this->objs_.size() << "\" objs" << std::endl; 
-    for (size_t pcd_idx = 0; pcd_idx < this->pointclouds_.size(); pcd_idx++)
+    std::cout << "detected \"" << this->packet_.bboxes_.second.size() << "\" objs" << std::endl; 
+    for (size_t pcd_idx = 0; pcd_idx < this->packet_.pcds_.second.size(); pcd_idx++)
     {
         std::cout << "lidar " << pcd_idx+1 << " time : " 
             <<  std::to_string(this->time_stamp_[pcd_idx+3]).insert(10,"_")
@@ -54,7 +52,7 @@ bool Frame::verboseFrame()
 }
 
 pcl::PointCloud<pcl::PointXYZRGB> Frame::depth_to_pointcloud(
-    cv::Mat& depthImageIn, Config global_config
+    const cv::Mat & depthImageIn, const Config & global_config
 )
 {
     double camera_fx = global_config.camera_intrinsic_(0,0);
@@ -93,7 +91,7 @@ pcl::PointCloud<pcl::PointXYZI>::Ptr Frame::roi_depth_to_pointcloud
     int y_start, 
     int x_len, 
     int y_len, 
-    Config global_config)
+    const Config & global_config)
 {
     double camera_fx = global_config.camera_intrinsic_(0,0);
     double camera_fy = global_config.camera_intrinsic_(1,1);
@@ -129,19 +127,14 @@ pcl::PointCloud<pcl::PointXYZI>::Ptr Frame::roi_depth_to_pointcloud
     return cloudOut.makeShared();
 }
 
-pcl::PointCloud<pcl::PointXYZRGB>::Ptr Frame::getFramePointcloud()
+const pcl::PointCloud<pcl::PointXYZI> & Frame::getBackgroundcloud() const
 {
-    return this->frame_pointcloud_.makeShared();
+    return this->frame_detections_.cloud_background_;
 }
 
-pcl::PointCloud<pcl::PointXYZI>::Ptr Frame::getBackgroundcloud()
+const pcl::PointCloud<pcl::PointXYZI> & Frame::getCloud() const
 {
-    return this->frame_detections_.cloud_background_.makeShared();
-}
-
-pcl::PointCloud<pcl::PointXYZI>::Ptr Frame::getCloud()
-{
-    return this->frame_detections_.cloud_.makeShared();
+    return this->frame_detections_.cloud_;
 }
 
 vector<pcl::PointCloud<pcl::PointXYZI>> * Frame::getObjcloud()
@@ -151,7 +144,7 @@ vector<pcl::PointCloud<pcl::PointXYZI>> * Frame::getObjcloud()
 
 
 cv::Mat Frame::PointCloudToDepth(
-    pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_in, Config global_config)
+    const pcl::PointCloud<pcl::PointXYZI> & cloud_in, const Config & global_config)
 {
 
     double camera_fx = global_config.camera_intrinsic_(0,0);
@@ -161,12 +154,12 @@ cv::Mat Frame::PointCloudToDepth(
     int n,m;
     cv::Mat depthImageOut(global_config.imageRows_,
         global_config.imageCols_,CV_16UC1,cv::Scalar::all(0) );
-    for(int i = 0;i < cloud_in->size();i++)
+    for(int i = 0;i < cloud_in.size();i++)
     {
         Eigen::Vector4d point_camera(
-            cloud_in->points[i].x, 
-            cloud_in->points[i].y, 
-            cloud_in->points[i].z,
+            cloud_in.points[i].x, 
+            cloud_in.points[i].y, 
+            cloud_in.points[i].z,
             1.0
         );
         point_camera = global_config.camera_extrinsic_ * point_camera;
@@ -194,9 +187,9 @@ cv::Mat Frame::PointCloudToDepth(
 }
 
 cv::Mat Frame::PointCloudToDepthWithintensity(
-    pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_in, 
+    const pcl::PointCloud<pcl::PointXYZI> & cloud_in, 
     cv::Mat & intensity_map,
-    Config global_config)
+    const Config & global_config)
 {
     double camera_fx = global_config.camera_intrinsic_(0,0);
     double camera_fy = global_config.camera_intrinsic_(1,1);
@@ -205,11 +198,11 @@ cv::Mat Frame::PointCloudToDepthWithintensity(
     int n,m;
     cv::Mat depthImageOut(global_config.imageRows_,
         global_config.imageCols_,CV_16UC1,cv::Scalar::all(0) );
-    for(int i = 0;i < cloud_in->size();i++)
+    for(int i = 0;i < cloud_in.size();i++)
     {
-        Eigen::Vector4d point_camera(cloud_in->points[i].x, 
-                                     cloud_in->points[i].y, 
-                                     cloud_in->points[i].z,
+        Eigen::Vector4d point_camera(cloud_in.points[i].x, 
+                                     cloud_in.points[i].y, 
+                                     cloud_in.points[i].z,
                                      1.0);
         point_camera = global_config.camera_extrinsic_ * point_camera;
         double pointDepth;
@@ -233,17 +226,16 @@ cv::Mat Frame::PointCloudToDepthWithintensity(
                 continue;
             }
             depthImageOut.at<uint16_t>(m,n) = pointDepth;
-            intensity_map.at<float>(m,n) = cloud_in->points[i].intensity;
+            intensity_map.at<float>(m,n) = cloud_in.points[i].intensity;
 
         }
     }
     return depthImageOut;
 }
 
-void Frame::full_detection(
-    pcdsWithTime * pcd_in
-)
+void Frame::full_detection()
 {
+    pcdsWithTime * pcd_in = &packet_.pcds_;
     double basetime = pcd_in->first / 1000000000.0;
     float offsettime[6] = {0.0,0.0,0.0,0.0,0.0,0.0};
     for (size_t cloudidx = 0; cloudidx < 6; cloudidx++)
@@ -253,8 +245,7 @@ void Frame::full_detection(
     }
 
     // -----------------get point time----------------- 
-    vector<pcl::PointCloud<pcl::PointXYZI>> pcds_xyzi_buffer;
-    pcl::PointCloud<pcl::PointXYZI> frame_pcd;
+    size_t frame_points_num = 0;
     for (size_t pcd_idx = 0; pcd_idx < pcd_in->second.size(); pcd_idx++)
     {
         pcd_in->second[pcd_idx].second.erase(
@@ -273,11 +264,26 @@ void Frame::full_detection(
             pcd_in->second[pcd_idx].second.begin() + 
             pcd_in->second[pcd_idx].second.size()
         );
+        frame_points_num += pcd_in->second[pcd_idx].second.size();
+    }
 
+    // the points go straight to the frame cloud, no per lidar copies
+    pcl::PointCloud<pcl::PointXYZI> & frame_pcd = frame_detections_.cloud_;
+    const frameCubes & cubes = packet_.cubes_.second;
+    frame_detections_.cloud_objects_buffer_.resize(cubes.size());
+    if (memory_)
+    {
+        memory_->xyziClouds().acquire(frame_pcd, frame_points_num);
+    }
+    else
+    {
+        frame_pcd.points.reserve(frame_points_num);
+    }
+    for (size_t pcd_idx = 0; pcd_idx < pcd_in->second.size(); pcd_idx++)
+    {
         int pointssize = pcd_in->second[pcd_idx].second.size();
         float step_t = 0.1 / (float)pointssize;
 
-        pcl::PointCloud<pcl::PointXYZI> pcd_xyzi;
         for (size_t pointidx = 0; pointidx < pointssize; pointidx++)
         {
             pcl::PointXYZI point_temp;
@@ -285,80 +291,80 @@ void Frame::full_detection(
             point_temp.y = pcd_in->second[pcd_idx].second[pointidx].y;
             point_temp.z = pcd_in->second[pcd_idx].second[pointidx].z;
             point_temp.intensity = (float)pointidx * step_t + (float)offsettime[pcd_idx];
-            pcd_xyzi.push_back(point_temp);
+            frame_pcd.push_back(point_temp);
         }
-        pcds_xyzi_buffer.push_back(pcd_xyzi);
-        frame_pcd += pcd_xyzi;
     }
-    frame_detections_.cloud_ = frame_pcd;
 
-    frame_detections_.cloud_objects_buffer_.resize(cubes_.size());
     point_extraction(
-        frame_detections_.cloud_.makeShared(),
-        &cubes_,
+        frame_pcd,
+        &cubes,
         &frame_detections_.cloud_background_,
         &frame_detections_.cloud_objects_buffer_
     );
 }
 
 void Frame::point_extraction(
-    const pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_,
+    const pcl::PointCloud<pcl::PointXYZI> & cloud_,
     const frameCubes * cubes,
     pcl::PointCloud<pcl::PointXYZI> * background_cloud,
     vector<pcl::PointCloud<pcl::PointXYZI>> * obj_cloud
 )
 {
-    for (size_t pt_idx = 0; pt_idx < cloud_->size(); pt_idx++)
+    // object of every point first, -1 for the background, so the clouds
+    // are sized once before they are filled
+    FrameArena * arena = memory_ ? &memory_->arena() : NULL;
+    arenaVector<int> point_objs(cloud_.size(), -1, ArenaAllocator<int>(arena));
+    arenaVector<size_t> obj_points_num(cubes->size() + 1, 0, ArenaAllocator<size_t>(arena));
+    for (size_t pt_idx = 0; pt_idx < cloud_.size(); pt_idx++)
     {
-        bool is_background = true;
         for (size_t obj_idx = 0; obj_idx < cubes->size(); obj_idx++)
         {
             Eigen::Vector3f pt(
-                cloud_->points[pt_idx].x,
-                cloud_->points[pt_idx].y,
-                cloud_->points[pt_idx].z
+                cloud_.points[pt_idx].x,
+                cloud_.points[pt_idx].y,
+                cloud_.points[pt_idx].z
             );
 
             Eigen::Vector3f vec0(
-                (*cubes)[obj_idx].cube_vertexs_(0,0) - pt[0],
-                (*cubes)[obj_idx].cube_vertexs_(0,1) - pt[1],
-                (*cubes)[obj_idx].cube_vertexs_(0,2) - pt[2]
+                (*cubes)[obj_idx].cube_vertexs()(0,0) - pt[0],
+                (*cubes)[obj_idx].cube_vertexs()(0,1) - pt[1],
+                (*cubes)[obj_idx].cube_vertexs()(0,2) - pt[2]
             );
 
             Eigen::Vector3f vec1(
-                (*cubes)[obj_idx].cube_vertexs_(1,0) - pt[0],
-                (*cubes)[obj_idx].cube_vertexs_(1,1) - pt[1],
-                (*cubes)[obj_idx].cube_vertexs_(1,2) - pt[2]
+                (*cubes)[obj_idx].cube_vertexs()(1,0) - pt[0],
+                (*cubes)[obj_idx].cube_vertexs()(1,1) - pt[1],
+                (*cubes)[obj_idx].cube_vertexs()(1,2) - pt[2]
             );
 
             Eigen::Vector3f vec3(
-                (*cubes)[obj_idx].cube_vertexs_(3,0) - pt[0],
-                (*cubes)[obj_idx].cube_vertexs_(3,1) - pt[1],
-                (*cubes)[obj_idx].cube_vertexs_(3,2) - pt[2]
+                (*cubes)[obj_idx].cube_vertexs()(3,0) - pt[0],
+                (*cubes)[obj_idx].cube_vertexs()(3,1) - pt[1],
+                (*cubes)[obj_idx].cube_vertexs()(3,2) - pt[2]
             );
 
             Eigen::Vector3f vec4(
-                (*cubes)[obj_idx].cube_vertexs_(4,0) - pt[0],
-                (*cubes)[obj_idx].cube_vertexs_(4,1) - pt[1],
-                (*cubes)[obj_idx].cube_vertexs_(4,2) - pt[2]
+                (*cubes)[obj_idx].cube_vertexs()(4,0) - pt[0],
+                (*cubes)[obj_idx].cube_vertexs()(4,1) - pt[1],
+                (*cubes)[obj_idx].cube_vertexs()(4,2) - pt[2]
             );
 
             Eigen::Vector3f nor1(
-                (*cubes)[obj_idx].cube_vertexs_(0,0) - (*cubes)[obj_idx].cube_vertexs_(1,0),
-                (*cubes)[obj_idx].cube_vertexs_(0,1) - (*cubes)[obj_idx].cube_vertexs_(1,1),
-                (*cubes)[obj_idx].cube_vertexs_(0,2) - (*cubes)[obj_idx].cube_vertexs_(1,2)
+                (*cubes)[obj_idx].cube_vertexs()(0,0) - (*cubes)[obj_idx].cube_vertexs()(1,0),
+                (*cubes)[obj_idx].cube_vertexs()(0,1) - (*cubes)[obj_idx].cube_vertexs()(1,1),
+                (*cubes)[obj_idx].cube_vertexs()(0,2) - (*cubes)[obj_idx].cube_vertexs()(1,2)
             );
 
             Eigen::Vector3f nor3(
-                (*cubes)[obj_idx].cube_vertexs_(0,0) - (*cubes)[obj_idx].cube_vertexs_(3,0),
-                (*cubes)[obj_idx].cube_vertexs_(0,1) - (*cubes)[obj_idx].cube_vertexs_(3,1),
-                (*cubes)[obj_idx].cube_vertexs_(0,2) - (*cubes)[obj_idx].cube_vertexs_(3,2)
+                (*cubes)[obj_idx].cube_vertexs()(0,0) - (*cubes)[obj_idx].cube_vertexs()(3,0),
+                (*cubes)[obj_idx].cube_vertexs()(0,1) - (*cubes)[obj_idx].cube_vertexs()(3,1),
+                (*cubes)[obj_idx].cube_vertexs()(0,2) - (*cubes)[obj_idx].cube_vertexs()(3,2)
             );
 
             Eigen::Vector3f nor4(
-                (*cubes)[obj_idx].cube_vertexs_(0,0) - (*cubes)[obj_idx].cube_vertexs_(4,0),
-                (*cubes)[obj_idx].cube_vertexs_(0,1) - (*cubes)[obj_idx].cube_vertexs_(4,1),
-                (*cubes)[obj_idx].cube_vertexs_(0,2) - (*cubes)[obj_idx].cube_vertexs_(4,2)
+                (*cubes)[obj_idx].cube_vertexs()(0,0) - (*cubes)[obj_idx].cube_vertexs()(4,0),
+                (*cubes)[obj_idx].cube_vertexs()(0,1) - (*cubes)[obj_idx].cube_vertexs()(4,1),
+                (*cubes)[obj_idx].cube_vertexs()(0,2) - (*cubes)[obj_idx].cube_vertexs()(4,2)
             );
 
             if (
@@ -367,14 +373,35 @@ void Frame::point_extraction(
                 nor4.dot(vec0) * nor4.dot(vec4) < 0
             )
             {
-                is_background = false;
-                (*obj_cloud)[obj_idx].push_back(cloud_->points[pt_idx]);
+                point_objs[pt_idx] = obj_idx;
                 break;
             }
         }
-        if(is_background)
+        obj_points_num[point_objs[pt_idx] + 1]++;
+    }
+
+    for (int obj_idx = -1; obj_idx < (int)cubes->size(); obj_idx++)
+    {
+        pcl::PointCloud<pcl::PointXYZI> & out_cloud = 
+            obj_idx < 0 ? *background_cloud : (*obj_cloud)[obj_idx];
+        if (memory_)
+        {
+            memory_->xyziClouds().acquire(out_cloud, obj_points_num[obj_idx + 1]);
+        }
+        else
+        {
+            out_cloud.points.reserve(out_cloud.size() + obj_points_num[obj_idx + 1]);
+        }
+    }
+    for (size_t pt_idx = 0; pt_idx < cloud_.size(); pt_idx++)
+    {
+        if (point_objs[pt_idx] < 0)
+        {
+            background_cloud->push_back(cloud_.points[pt_idx]);
+        }
+        else
         {
-            background_cloud->push_back(cloud_->points[pt_idx]);
+            (*obj_cloud)[point_objs[pt_idx]].push_back(cloud_.points[pt_idx]);
         }
     }
 }
@@ -385,16 +412,14 @@ void Frame::detection_align(
     const frameCubes * cubes_,
     const frameBboxs * objs_,
     const Eigen::Matrix4d * global_pose_,
-    std::vector<alignedDet> & aligned_detections
+    std::vector<alignedDet> & aligned_detections,
+    associationProfile * profile
 )
 {
+    Timer stage_timer("align stage");
     // 
-    vector<pcl::PointCloud<pcl::PointXYZI>> obj_cloud_buffer;
     vector<cv::Rect> proj2dvertex_buffer;
 
-    cv::Mat raw_img = *rawimg_;
-    cv::Mat test_img; 
-    rawimg_->copyTo(test_img);
     // proj all the 3d detection to 2d domain
     // cubes_ => proj2dvertex_buffer 
     for (size_t obj_idx = 0; obj_idx < cubes_->size(); obj_idx++)
@@ -405,13 +430,11 @@ void Frame::detection_align(
             &proj2dvertex
         );
         proj2dvertex_buffer.push_back(proj2dvertex);
-
-        obj_cloud_buffer.push_back((*obj_cloud_)[obj_idx]);
-
     }
 
     vector<vector<double>> iouMatrix;
     iouMatrix.resize(objs_->size(), vector<double>(cubes_->size(), 0));
+    double cost_matrix_ms = stage_timer.elapsed(true);
     for (size_t obj2d_idx = 0; obj2d_idx < objs_->size(); obj2d_idx++)
     {
         for (size_t obj3d_idx = 0; obj3d_idx < cubes_->size(); obj3d_idx++)
@@ -432,14 +455,39 @@ void Frame::detection_align(
         }
     }
 
+    double iou_ms = stage_timer.elapsed(true);
+
     vector<cv::Point> matchPairs;
-    findHungarianAssignment(iouMatrix, matchPairs);
+    if (objs_->size() > 0 && cubes_->size() > 0)
+    {
+        findHungarianAssignment(iouMatrix, matchPairs);
+    }
+    double solver_ms = stage_timer.elapsed(true);
 
-    std::vector<alignedDet> aligneddet_buffer;
+    // the points of all matched objects go to one frame buffer, each
+    // detection keeps its range of it
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZI>> frame_points(new pcl::PointCloud<pcl::PointXYZI>);
+    arenaVector<size_t> point_ranges(
+        matchPairs.size() + 1, 0, ArenaAllocator<size_t>(memory_ ? &memory_->arena() : NULL));
     for (size_t pair_idx = 0; pair_idx < matchPairs.size(); pair_idx++)
     {
-        
+        const pcl::PointCloud<pcl::PointXYZI> & obj_cloud = (*obj_cloud_)[matchPairs[pair_idx].y];
+        frame_points->points.insert(frame_points->points.end(), obj_cloud.points.begin(), obj_cloud.points.end());
+        point_ranges[pair_idx + 1] = frame_points->size();
+    }
+    frame_points->width = frame_points->size();
+    frame_points->height = 1;
+    std::shared_ptr<frameResources> frame_resources(new frameResources);
+    frame_resources->img_ = *rawimg_;
+    frame_resources->points_ = frame_points;
+    frame_resources->time_stamp_ = time_stamp_[2];
 
+    uint32_t pose_idx = frame_pose(*global_pose_);
+
+    std::vector<alignedDet> aligneddet_buffer;
+    aligneddet_buffer.reserve(matchPairs.size());
+    for (size_t pair_idx = 0; pair_idx < matchPairs.size(); pair_idx++)
+    {
         int idx_2d = matchPairs[pair_idx].x;
         int idx_3d = matchPairs[pair_idx].y;
 
@@ -456,19 +504,155 @@ void Frame::detection_align(
         int rand_b = (rand() % 255) + 0;
 
         alignedDet aligneddet_tmp;
-        aligneddet_tmp.type_ = (*cubes_)[idx_3d].object_type_;
+        aligneddet_tmp.class_id_ = (*cubes_)[idx_3d].class_id_;
         aligneddet_tmp.confidence3d_ = (*cubes_)[idx_3d].confidence_;
-        aligneddet_tmp.vertex3d_ = (*cubes_)[idx_3d].cube_vertexs_;
-        aligneddet_tmp.vertex2d_ = obj_bbox;
+        aligneddet_tmp.vertex3d() = (*cubes_)[idx_3d].cube_vertexs();
+        aligneddet_tmp.setVertex2d(obj_bbox);
         aligneddet_tmp.confidence2d_ = (*objs_)[idx_2d].score_;
 
-        aligneddet_tmp.cloud_ = (*obj_cloud_)[idx_3d];
-        aligneddet_tmp.img_ = *rawimg_;
-        aligneddet_tmp.global_pose_ = *global_pose_;
+        aligneddet_tmp.cloud_ = cloudView(frame_points, point_ranges[pair_idx], point_ranges[pair_idx + 1]);
+        aligneddet_tmp.frame_ = frame_resources;
+        aligneddet_tmp.pose_idx_ = pose_idx;
+        aligneddet_tmp.time_stamp_ = time_stamp_[2];
         aligneddet_buffer.push_back(aligneddet_tmp);
     }
-    aligned_detections = aligneddet_buffer;
+    aligned_detections.swap(aligneddet_buffer);
     // the matchpairs size sometimes are smaller than the above twos
+
+    if (profile)
+    {
+        profile->cost_matrix_ms_ = cost_matrix_ms;
+        profile->iou_ms_ = iou_ms;
+        profile->solver_ms_ = solver_ms;
+        profile->bookkeeping_ms_ = stage_timer.elapsed(true);
+        profile->iou_evaluations_ = objs_->size() * cubes_->size();
+        profile->repaired_rows_ = std::max(objs_->size(), cubes_->size());
+    }
+}
+
+void Frame::scene_flow_detection(
+    SceneFlow & scene_flow,
+    const cv::Mat * rawimg_,
+    const Eigen::Matrix4d * global_pose_,
+    std::vector<alignedDet> & aligned_detections
+)
+{
+    Timer stage_timer("scene flow stage");
+    std::vector<flowCluster> clusters;
+    scene_flow.update(
+        frame_detections_.cloud_background_,
+        *global_pose_,
+        time_stamp_[2],
+        global_config_,
+        clusters
+    );
+
+    uint32_t pose_idx = frame_pose(*global_pose_);
+    std::vector<alignedDet> flow_detections;
+    FrameArena * arena = memory_ ? &memory_->arena() : NULL;
+    arenaVector<size_t> flow_clusters{ArenaAllocator<size_t>(arena)};
+    for (size_t cluster_idx = 0; cluster_idx < clusters.size(); cluster_idx++)
+    {
+        const flowCluster & cluster = clusters[cluster_idx];
+
+        // box along the motion : 0-1 along the flow, 0-3 across, 0-4 up
+        Eigen::Vector3d axis_u(cluster.flow_[0], cluster.flow_[1], 0.0);
+        axis_u.normalize();
+        Eigen::Vector3d axis_w(-axis_u[1], axis_u[0], 0.0);
+        Eigen::Vector3d axis_z(0.0, 0.0, 1.0);
+        Eigen::Vector3d min_coord = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+        Eigen::Vector3d max_coord = -min_coord;
+        for (size_t pt_idx = 0; pt_idx < cluster.cloud_.size(); pt_idx++)
+        {
+            Eigen::Vector3d pt(
+                cluster.cloud_.points[pt_idx].x,
+                cluster.cloud_.points[pt_idx].y,
+                cluster.cloud_.points[pt_idx].z
+            );
+            Eigen::Vector3d coord(axis_u.dot(pt), axis_w.dot(pt), pt[2]);
+            min_coord = min_coord.cwiseMin(coord);
+            max_coord = max_coord.cwiseMax(coord);
+        }
+        Eigen::Matrix<double, 8, 3> cube_vertexs;
+        for (int vertex_idx = 0; vertex_idx < 8; vertex_idx++)
+        {
+            bool far_u = vertex_idx % 4 == 1 || vertex_idx % 4 == 2;
+            bool far_w = vertex_idx % 4 == 2 || vertex_idx % 4 == 3;
+            bool far_z = vertex_idx >= 4;
+            Eigen::Vector3d vertex = 
+                (far_u ? max_coord[0] : min_coord[0]) * axis_u + 
+                (far_w ? max_coord[1] : min_coord[1]) * axis_w + 
+                (far_z ? max_coord[2] : min_coord[2]) * axis_z;
+            cube_vertexs.row(vertex_idx) = vertex.transpose();
+        }
+
+        // the optical flow needs the box in front of the camera
+        bool in_front = true;
+        for (int vertex_idx = 0; vertex_idx < 8; vertex_idx++)
+        {
+            Eigen::Vector4d point_camera(
+                cube_vertexs(vertex_idx, 0),
+                cube_vertexs(vertex_idx, 1),
+                cube_vertexs(vertex_idx, 2),
+                1.0
+            );
+            point_camera = global_config_.camera_extrinsic_ * point_camera;
+            in_front = in_front && point_camera[2] > 0.0;
+        }
+        if (!in_front)
+        {
+            continue;
+        }
+        cube3d cube("scene_flow", global_config_.scene_flow_confidence_, cube_vertexs);
+        cv::Rect proj2dvertex;
+        detection3dProj2d(&cube, &proj2dvertex);
+        proj2dvertex &= cv::Rect(0, 0, rawimg_->cols, rawimg_->rows);
+        if (proj2dvertex.area() <= 0)
+        {
+            continue;
+        }
+
+        alignedDet aligneddet_tmp;
+        aligneddet_tmp.class_id_ = cube.class_id_;
+        aligneddet_tmp.confidence3d_ = cube.confidence_;
+        aligneddet_tmp.vertex3d() = cube.cube_vertexs();
+        aligneddet_tmp.setVertex2d(proj2dvertex);
+        aligneddet_tmp.confidence2d_ = 0.0;
+        aligneddet_tmp.pose_idx_ = pose_idx;
+        aligneddet_tmp.time_stamp_ = time_stamp_[2];
+        flow_detections.push_back(aligneddet_tmp);
+        flow_clusters.push_back(cluster_idx);
+    }
+
+    // one point buffer for the kept clusters, as in detection_align
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZI>> flow_points(new pcl::PointCloud<pcl::PointXYZI>);
+    arenaVector<size_t> point_ranges(flow_clusters.size() + 1, 0, ArenaAllocator<size_t>(arena));
+    for (size_t det_idx = 0; det_idx < flow_clusters.size(); det_idx++)
+    {
+        const pcl::PointCloud<pcl::PointXYZI> & cluster_cloud = clusters[flow_clusters[det_idx]].cloud_;
+        flow_points->points.insert(flow_points->points.end(), cluster_cloud.points.begin(), cluster_cloud.points.end());
+        point_ranges[det_idx + 1] = flow_points->size();
+    }
+    flow_points->width = flow_points->size();
+    flow_points->height = 1;
+    std::shared_ptr<frameResources> frame_resources(new frameResources);
+    frame_resources->img_ = *rawimg_;
+    frame_resources->points_ = flow_points;
+    frame_resources->time_stamp_ = time_stamp_[2];
+    for (size_t det_idx = 0; det_idx < flow_detections.size(); det_idx++)
+    {
+        flow_detections[det_idx].cloud_ = cloudView(flow_points, point_ranges[det_idx], point_ranges[det_idx + 1]);
+        flow_detections[det_idx].frame_ = frame_resources;
+        aligned_detections.push_back(flow_detections[det_idx]);
+    }
+    int added_num = flow_detections.size();
+    if (global_config_.log_verbose_)
+    {
+        std::cout << "scene flow voxels / moving / clusters / detections = "
+            << scene_flow.voxelNum() << " / " << scene_flow.movingVoxels() << " / "
+            << clusters.size() << " / " << added_num << " in " 
+            << stage_timer.elapsed() << " ms" << std::endl;
+    }
 }
 
 void Frame::detection3dProj2d(
@@ -483,12 +667,12 @@ void Frame::detection3dProj2d(
     double camera_cx = global_config_.camera_intrinsic_(0,2);
     double camera_cy = global_config_.camera_intrinsic_(1,2);
     int n,m;
-    for (size_t vertex_idx = 0; vertex_idx < vertex3d->cube_vertexs_.rows(); vertex_idx++)
+    for (size_t vertex_idx = 0; vertex_idx < vertex3d->cube_vertexs().rows(); vertex_idx++)
     {
         Eigen::Vector4d point_camera(
-            vertex3d->cube_vertexs_(vertex_idx,0),
-            vertex3d->cube_vertexs_(vertex_idx,1),
-            vertex3d->cube_vertexs_(vertex_idx,2),
+            vertex3d->cube_vertexs()(vertex_idx,0),
+            vertex3d->cube_vertexs()(vertex_idx,1),
+            vertex3d->cube_vertexs()(vertex_idx,2),
             1.0
         );
         point_camera = global_config_.camera_extrinsic_ * point_camera;
@@ -524,7 +708,7 @@ float Frame::fusionIoU(
 }
 
 void Frame::findHungarianAssignment(
-    vector<vector<double>> iouMatrix_,
+    const vector<vector<double>> & iouMatrix_,
     vector<cv::Point> & results
 )
 {
@@ -582,6 +766,15 @@ void Frame::findHungarianAssignment(
 
 Frame::~Frame()
 {
+    if (memory_)
+    {
+        memory_->xyziClouds().release(frame_detections_.cloud_);
+        memory_->xyziClouds().release(frame_detections_.cloud_background_);
+        for (size_t obj_idx = 0; obj_idx < frame_detections_.cloud_objects_buffer_.size(); obj_idx++)
+        {
+            memory_->xyziClouds().release(frame_detections_.cloud_objects_buffer_[obj_idx]);
+        }
+    }
 }
 
 
@@ -640,13 +833,13 @@ void VisHandel::txt_marker_3d_publisher(
         for (size_t line_idx = 0; line_idx < lines.rows(); line_idx++)
         {
             geometry_msgs::Point point1;
-            point1.x = detection_in[ob_idx].vertex3d_(lines(line_idx, 0),0);
-            point1.y = detection_in[ob_idx].vertex3d_(lines(line_idx, 0),1);
-            point1.z = detection_in[ob_idx].vertex3d_(lines(line_idx, 0),2);
+            point1.x = detection_in[ob_idx].vertex3d()(lines(line_idx, 0),0);
+            point1.y = detection_in[ob_idx].vertex3d()(lines(line_idx, 0),1);
+            point1.z = detection_in[ob_idx].vertex3d()(lines(line_idx, 0),2);
             geometry_msgs::Point point2;
-            point2.x = detection_in[ob_idx].vertex3d_(lines(line_idx, 1),0);
-            point2.y = detection_in[ob_idx].vertex3d_(lines(line_idx, 1),1);
-            point2.z = detection_in[ob_idx].vertex3d_(lines(line_idx, 1),2);
+            point2.x = detection_in[ob_idx].vertex3d()(lines(line_idx, 1),0);
+            point2.y = detection_in[ob_idx].vertex3d()(lines(line_idx, 1),1);
+            point2.z = detection_in[ob_idx].vertex3d()(lines(line_idx, 1),2);
             cube_3d_msg.points.push_back(point1);
             cube_3d_msg.points.push_back(point2);
         }
@@ -665,25 +858,25 @@ void VisHandel::obj_vel_txt_publisher(visualization_msgs::MarkerArray arrow_in)
     obj_velocity_txt_.publish(arrow_in);
 }
 
-void VisHandel::raw_cloud_publisher(sensor_msgs::PointCloud2 cloud_in)
+void VisHandel::raw_cloud_publisher(sensor_msgs::PointCloud2 & cloud_in)
 {
     cloud_in.header.frame_id = "livox";
     raw_cloud_.publish(cloud_in);
 }
 
-void VisHandel::background_cloud_publisher(sensor_msgs::PointCloud2 cloud_in)
+void VisHandel::background_cloud_publisher(sensor_msgs::PointCloud2 & cloud_in)
 {
     cloud_in.header.frame_id = "livox";
     background_cloud_.publish(cloud_in);
 }
 
-void VisHandel::raw_obj_cloud_publisher(sensor_msgs::PointCloud2 cloud_in)
+void VisHandel::raw_obj_cloud_publisher(sensor_msgs::PointCloud2 & cloud_in)
 {
     cloud_in.header.frame_id = "livox";
     raw_obj_cloud_pub_.publish(cloud_in);
 }
 
-void VisHandel::undistorted_obj_cloud_publisher(sensor_msgs::PointCloud2 cloud_in)
+void VisHandel::undistorted_obj_cloud_publisher(sensor_msgs::PointCloud2 & cloud_in)
 {
     cloud_in.header.frame_id = "livox";
     undistorted_obj_cloud_pub_.publish(cloud_in);
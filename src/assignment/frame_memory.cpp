@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+// frame_memory.cpp: Implementation file for Class FrameMemory.
+//
+
+#include <algorithm>
+#include <iostream>
+#include "common/frame_memory.h"
+
+FrameArena::FrameArena(size_t block_size)
+{
+    block_size_ = block_size;
+    offset_ = 0;
+    used_bytes_ = 0;
+    peak_bytes_ = 0;
+    block_allocations_ = 0;
+}
+
+FrameArena::~FrameArena()
+{
+}
+
+void * FrameArena::allocate(size_t bytes, size_t alignment)
+{
+    if (!blocks_.empty())
+    {
+        arenaBlock & block = blocks_.back();
+        size_t address = reinterpret_cast<size_t>(block.data_.get()) + offset_;
+        size_t padding = (alignment - address % alignment) % alignment;
+        if (offset_ + padding + bytes <= block.size_)
+        {
+            void * ptr = block.data_.get() + offset_ + padding;
+            offset_ += padding + bytes;
+            used_bytes_ += padding + bytes;
+            peak_bytes_ = std::max(peak_bytes_, used_bytes_);
+            return ptr;
+        }
+    }
+    // a new block, the rest of the current one stays unused until reset
+    addBlock(std::max(block_size_, bytes + alignment));
+    return allocate(bytes, alignment);
+}
+
+void FrameArena::reset()
+{
+    if (blocks_.size() > 1)
+    {
+        size_t total_size = capacity();
+        blocks_.clear();
+        addBlock(total_size);
+    }
+    offset_ = 0;
+    used_bytes_ = 0;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t total_size = 0;
+    for (size_t block_idx = 0; block_idx < blocks_.size(); block_idx++)
+    {
+        total_size += blocks_[block_idx].size_;
+    }
+    return total_size;
+}
+
+void FrameArena::addBlock(size_t size)
+{
+    arenaBlock block;
+    block.data_.reset(new char[size]);
+    block.size_ = size;
+    blocks_.push_back(std::move(block));
+    offset_ = 0;
+    block_allocations_++;
+}
+
+FrameMemory::FrameMemory()
+{
+    pool_steady_frames_ = 0;
+}
+
+FrameMemory::~FrameMemory()
+{
+}
+
+frameMemoryStats FrameMemory::endFrame()
+{
+    frameMemoryStats stats;
+    stats.arena_bytes_ = arena_.usedBytes();
+    // a reset which merges blocks allocates too, count it for this frame
+    arena_.reset();
+    stats.arena_capacity_ = arena_.capacity();
+    stats.arena_blocks_ = arena_.blockAllocations();
+    stats.cloud_allocations_ = xyzi_clouds_.heapAllocations() + rgb_clouds_.heapAllocations();
+    stats.pooled_clouds_ = xyzi_clouds_.pooled() + rgb_clouds_.pooled();
+
+    if (stats.arena_blocks_ == 0 && stats.cloud_allocations_ == 0)
+    {
+        pool_steady_frames_++;
+    }
+    else
+    {
+        pool_steady_frames_ = 0;
+    }
+    stats.pool_steady_frames_ = pool_steady_frames_;
+
+    arena_.resetCounters();
+    xyzi_clouds_.resetCounters();
+    rgb_clouds_.resetCounters();
+    return stats;
+}
+
+FrameScope::~FrameScope()
+{
+    frameMemoryStats stats = memory_.endFrame();
+    if (!verbose_)
+    {
+        return;
+    }
+    std::cout << "frame memory : arena " << stats.arena_bytes_ << " / " 
+        << stats.arena_capacity_ << " bytes, heap blocks / clouds = "
+        << stats.arena_blocks_ << " / " << stats.cloud_allocations_ 
+        << ", pooled clouds = " << stats.pooled_clouds_ 
+        << ", frames without arena / pool growth = " << stats.pool_steady_frames_ << std::endl;
+}
@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////
+// thread_pool.cpp: Implementation file for Class ThreadPool.
+//
+
+#include "common/thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads)
+{
+    task_ = nullptr;
+    generation_ = 0;
+    pending_tasks_ = 0;
+    busy_workers_ = 0;
+    stolen_tasks_ = 0;
+    stop_ = false;
+
+    for (size_t queue_idx = 0; queue_idx <= threads; queue_idx++)
+    {
+        queues_.emplace_back(new taskQueue);
+    }
+    for (size_t worker_idx = 0; worker_idx < threads; worker_idx++)
+    {
+        workers_.emplace_back(&ThreadPool::workerLoop, this, worker_idx);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(run_mutex_);
+        stop_ = true;
+    }
+    run_cv_.notify_all();
+    for (size_t worker_idx = 0; worker_idx < workers_.size(); worker_idx++)
+    {
+        workers_[worker_idx].join();
+    }
+}
+
+void ThreadPool::run(
+    const std::vector<size_t> & order,
+    const std::function<void(size_t)> & task
+)
+{
+    stolen_tasks_ = 0;
+    if (order.empty())
+    {
+        return;
+    }
+    size_t caller_queue = workers_.size();
+    if (workers_.empty() || order.size() == 1)
+    {
+        for (size_t idx = 0; idx < order.size(); idx++)
+        {
+            task(order[idx]);
+        }
+        return;
+    }
+
+    // deal round-robin, every queue starts with one of the biggest tasks
+    for (size_t idx = 0; idx < order.size(); idx++)
+    {
+        taskQueue & queue = *queues_[idx % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex_);
+        queue.tasks_.push_back(order[idx]);
+    }
+    {
+        std::lock_guard<std::mutex> lock(run_mutex_);
+        task_ = &task;
+        pending_tasks_ = order.size();
+        busy_workers_ = workers_.size();
+        generation_++;
+    }
+    run_cv_.notify_all();
+
+    drain(caller_queue);
+
+    // the last task may still run on a worker, and the workers must be
+    // back waiting before task_ goes out of scope
+    std::unique_lock<std::mutex> lock(run_mutex_);
+    done_cv_.wait(lock, [this]() { return pending_tasks_ == 0 && busy_workers_ == 0; });
+    task_ = nullptr;
+}
+
+void ThreadPool::workerLoop(size_t queue_idx)
+{
+    size_t seen_generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(run_mutex_);
+            run_cv_.wait(lock, [&]() { return stop_ || generation_ != seen_generation; });
+            if (stop_)
+            {
+                return;
+            }
+            seen_generation = generation_;
+        }
+
+        drain(queue_idx);
+
+        {
+            std::lock_guard<std::mutex> lock(run_mutex_);
+            busy_workers_--;
+        }
+        done_cv_.notify_all();
+    }
+}
+
+void ThreadPool::drain(size_t queue_idx)
+{
+    size_t task_idx;
+    while (takeTask(queue_idx, task_idx))
+    {
+        (*task_)(task_idx);
+        bool all_done;
+        {
+            std::lock_guard<std::mutex> lock(run_mutex_);
+            pending_tasks_--;
+            all_done = pending_tasks_ == 0;
+        }
+        if (all_done)
+        {
+            done_cv_.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::takeTask(size_t queue_idx, size_t & task_idx)
+{
+    {
+        taskQueue & own = *queues_[queue_idx];
+        std::lock_guard<std::mutex> lock(own.mutex_);
+        if (!own.tasks_.empty())
+        {
+            task_idx = own.tasks_.front();
+            own.tasks_.pop_front();
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < queues_.size(); offset++)
+    {
+        taskQueue & victim = *queues_[(queue_idx + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex_);
+        if (!victim.tasks_.empty())
+        {
+            task_idx = victim.tasks_.back();
+            victim.tasks_.pop_back();
+            std::lock_guard<std::mutex> run_lock(run_mutex_);
+            stolen_tasks_++;
+            return true;
+        }
+    }
+    return false;
+}
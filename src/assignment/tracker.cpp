@@ -1,8 +1,36 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "tracker/tracker.h"
-
-int kfTracker::kf_count = 0;
+#include <unordered_set>
+
+// LK window and pyramid depth, the cached pyramids are built with the same
+static const cv::Size kFlowWinSize(20, 20);
+static const int kFlowMaxLevel = 3;
+
+// measurement noise of the box part of the kf state
+static const float kBoxMeasureNoise = 1e-1f;
+// association gate : 99% of the chi-square distribution with 2 dof (x, y)
+static const double kGateChi2 = 9.21;
+
+// every point moved back to the frame time by vel * t (t : intensity)
+static void motionCompensate(
+	const cloudView & cloud,
+	const Eigen::Vector3d & vel,
+	pcl::PointCloud<pcl::PointXYZ> & compensated
+)
+{
+	compensated.clear();
+	compensated.reserve(cloud.size());
+	for (size_t pt_idx = 0; pt_idx < cloud.size(); pt_idx++)
+	{
+		const pcl::PointXYZI & pt = cloud[pt_idx];
+		pcl::PointXYZ pt_temp;
+		pt_temp.x = pt.x - vel[0] * pt.intensity;
+		pt_temp.y = pt.y - vel[1] * pt.intensity;
+		pt_temp.z = pt.z - vel[2] * pt.intensity;
+		compensated.push_back(pt_temp);
+	}
+}
 
 class POINT_COST
 {
@@ -108,9 +136,11 @@ private:
 };
 
 // ======================== kfTracker ========================
-alignedDet kfTracker::predict()
+detRecord kfTracker::predict(
+	uint64_t time_stamp,
+	const Eigen::Vector3d & predicted_center
+)
 {
-	cv::Mat p = kf_.predict();
 	m_age += 1;
 
 	if (m_time_since_update > 0)
@@ -119,51 +149,22 @@ alignedDet kfTracker::predict()
 	}
 	m_time_since_update += 1;
 
-	// ！！！
-	// TODO:
-	return detection_cur_;
+	// move the last box to the predicted center
+	detRecord predicted_det = detection_cur_;
+	Eigen::Vector3d cur_center = detection_cur_.vertex3d().colwise().mean().cast<double>();
+	predicted_det.vertex3d().rowwise() += (predicted_center - cur_center).transpose().cast<float>();
+	predicted_det.time_stamp_ = time_stamp;
+
+	return predicted_det;
 }
 
-void kfTracker::init_kf(
-	alignedDet detection_in
+void kfTracker::init_track(
+	const alignedDet & detection_in
 )
 {
-	int stateNum = 10;
-	int measureNum = 10;
-
-	kf_ = cv::KalmanFilter(stateNum, measureNum, 0);
-
-	measurement_ = cv::Mat::zeros(measureNum, 1, CV_32F);
-
-	kf_.transitionMatrix = (Mat_<float>(stateNum, stateNum) <<
-		1, 0, 0, 0, 0, 0, 0, 0.1, 0, 0,
-		0, 1, 0, 0, 0, 0, 0, 0, 0.1, 0,
-		0, 0, 1, 0, 0, 0, 0, 0, 0, 0.1,
-		0, 0, 0, 1, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 1, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 1, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 1
-	);
-
-	setIdentity(kf_.measurementMatrix); 
-	setIdentity(kf_.processNoiseCov, Scalar::all(1e-2));
-	setIdentity(kf_.measurementNoiseCov, Scalar::all(1e-1));
-	setIdentity(kf_.errorCovPost, Scalar::all(1));
-
-	std::vector<float> state_ = getState(detection_in);
-
-	kf_.statePost.at<float>(0, 0) = state_[0];
-	kf_.statePost.at<float>(1, 0) = state_[1];
-	kf_.statePost.at<float>(2, 0) = state_[2];
-	kf_.statePost.at<float>(3, 0) = state_[3];
-	kf_.statePost.at<float>(4, 0) = state_[4];
-	kf_.statePost.at<float>(5, 0) = state_[5];
-	kf_.statePost.at<float>(6, 0) = state_[6];
-
 	detection_cur_ = detection_in;
+	// the track never looks at the frame image, don't keep the frame alive
+	detection_cur_.frame_.reset();
 
 	rgb3[0] = (rand() % 255) + 0;
 	rgb3[1] = (rand() % 255) + 0;
@@ -171,22 +172,22 @@ void kfTracker::init_kf(
 }
 
 std::vector<float> kfTracker::getState(
-	alignedDet detection_in
+	const detRecord & detection_in
 )
 {
 	std::vector<float> out_state;
 	float centerx = 0.0;
 	float centery = 0.0;
 	float centerz = 0.0;
-	for (size_t pt_idx = 0; pt_idx < detection_in.vertex3d_.rows(); pt_idx++)
+	for (size_t pt_idx = 0; pt_idx < detection_in.vertex3d().rows(); pt_idx++)
 	{
-		centerx += detection_in.vertex3d_(pt_idx, 0);
-		centery += detection_in.vertex3d_(pt_idx, 1);
-		centerz += detection_in.vertex3d_(pt_idx, 2);
+		centerx += detection_in.vertex3d()(pt_idx, 0);
+		centery += detection_in.vertex3d()(pt_idx, 1);
+		centerz += detection_in.vertex3d()(pt_idx, 2);
 	}
-	centerx /= detection_in.vertex3d_.rows();
-	centery /= detection_in.vertex3d_.rows();
-	centerz /= detection_in.vertex3d_.rows();
+	centerx /= detection_in.vertex3d().rows();
+	centery /= detection_in.vertex3d().rows();
+	centerz /= detection_in.vertex3d().rows();
 	out_state.push_back(centerx);
 	out_state.push_back(centery);
 	out_state.push_back(centerz);
@@ -197,13 +198,13 @@ std::vector<float> kfTracker::getState(
 	out_state.push_back(yaw);
 
 	float long_ = std::abs(
-		2.0 * (detection_in.vertex3d_(0, 0) - centerx)
+		2.0 * (detection_in.vertex3d()(0, 0) - centerx)
 	);
 	float width_ = std::abs(
-		2.0 * (detection_in.vertex3d_(0, 1) - centery)
+		2.0 * (detection_in.vertex3d()(0, 1) - centery)
 	);
 	float depth_ = std::abs(
-		2.0 * (detection_in.vertex3d_(0, 2) - centerz)
+		2.0 * (detection_in.vertex3d()(0, 2) - centerz)
 	);
 	out_state.push_back(long_);
 	out_state.push_back(width_);
@@ -214,195 +215,228 @@ std::vector<float> kfTracker::getState(
 }
 
 void kfTracker::update(
-	alignedDet detection_in,
-	const Eigen::Vector3d & vel_,
-	const Eigen::Matrix3d & vel_cov_
+	const alignedDet & detection_in
 )
 {
 	m_time_since_update = 0;
-	measurement_history_.clear();
 	m_hits += 1;
 	m_hit_streak += 1;
 
-	std::vector<float> measuredata = getState(detection_in);
-	measurement_.at<float>(0, 0) = measuredata[0];
-	measurement_.at<float>(1, 0) = measuredata[1];
-	measurement_.at<float>(2, 0) = measuredata[2];
-	measurement_.at<float>(3, 0) = measuredata[3];
-	measurement_.at<float>(4, 0) = measuredata[4];
-	measurement_.at<float>(5, 0) = measuredata[5];
-	measurement_.at<float>(6, 0) = measuredata[6];
-	measurement_.at<float>(7, 0) = vel_(0);
-	measurement_.at<float>(8, 0) = vel_(1);
-	measurement_.at<float>(9, 0) = vel_(2);
-
-	cv::Mat vel_measurement_cov;
-	cv::eigen2cv(vel_cov_, vel_measurement_cov);
-	kf_.measurementNoiseCov(cv::Rect(7, 7, 3, 3)) = vel_measurement_cov;
-
-	kf_.correct(measurement_);
-
 	detection_cur_ = detection_in;
+	detection_cur_.frame_.reset();
 }
 
-// call after update
-void kfTracker::get_kf_vel(
-	Eigen::Vector3d & vel_
+void kfTracker::update_estimated_vel(
+	const Eigen::Vector3d & vel_
 )
 {
-	vel_(0) = kf_.statePost.at<float>(7, 0);
-	vel_(1) = kf_.statePost.at<float>(8, 0);
-	vel_(2) = kf_.statePost.at<float>(9, 0);
+	estimated_vel_ = vel_;
 }
 
-void kfTracker::update_estimated_vel(
+void kfTracker::cache_registration(
 	const Eigen::Vector3d & vel_
 )
 {
-	estimated_vel_ = vel_;
+	registration_cloud_.reset(new pcl::PointCloud<pcl::PointXYZ>);
+	motionCompensate(detection_cur_.cloud_, vel_, *registration_cloud_);
+	registration_tree_.reset(new pcl::KdTreeFLANN<pcl::PointXYZ>);
+	if (registration_cloud_->size() > 0)
+	{
+		registration_tree_->setInputCloud(registration_cloud_);
+	}
 }
 
-fusion_tracker::fusion_tracker()
+fusion_tracker::fusion_tracker():
+	feature_tracks_(kFlowWinSize, kFlowMaxLevel)
 {
 	total_frames_ = 0;
 	frame_count_ = 0;
 	trkNum_ = 0;
 	detNum_ = 0;
 	iouThreshold_ = 0.01;
+	frame_memory_ = NULL;
+
+	// constant velocity : center += dt * velocity
+	trackKalmanBank::StateMatrix transition_rate = trackKalmanBank::StateMatrix::Zero();
+	transition_rate(0, 7) = 1;
+	transition_rate(1, 8) = 1;
+	transition_rate(2, 9) = 1;
+	kalman_bank_.configure(
+		trackKalmanBank::StateMatrix::Identity(),
+		transition_rate,
+		1e-2f * trackKalmanBank::StateMatrix::Identity(),
+		trackKalmanBank::MeasureModel::Identity()
+	);
 }
 
 fusion_tracker::~fusion_tracker()
 {
 }
 
-void fusion_tracker::tracking(
-	const std::vector<alignedDet> detections_in,
-	cv::Mat img_in,
-	Config config_,
-	boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer,
-	visualization_msgs::MarkerArray & obj_vel_txt_markerarray,
-	VisHandel * vis_ros_
+void fusion_tracker::add_track(
+	const alignedDet & detection_in,
+	const Config & config_
 )
 {
-	std::cout << "--------------- tracking log ---------------" << std::endl;
-	Timer tracker_timer("tracking time");
-	total_frames_++;
-	frame_count_++;
-	if (trackers_.size() == 0)
-	{
-		for (size_t obj_idx = 0; obj_idx < detections_in.size(); obj_idx++)
-		{
-			kfTracker trk(detections_in[obj_idx]);
-			trackers_.push_back(trk);
-		}
-		if(frame_count_ = 1)
-		{
-			std::cout << "last frame tracker all fail!" << std::endl;
-			std::cout << "first tracking frame" << std::endl;
-			last_detection_ = detections_in;
-			last_img_ = img_in;
-			return;
-		}
-		else
-		{
-			std::cout << "first tracking frame" << std::endl;
-		}
-	}
-	else
+	SlotMap<kfTracker>::Id trk_id = trackers_.insert(kfTracker(detection_in));
+	trackers_.find(trk_id)->m_id = trk_id;
+
+	std::vector<float> box_state = kfTracker::getState(detection_in);
+	trackKalmanBank::StateVector state = trackKalmanBank::StateVector::Zero();
+	for (size_t state_idx = 0; state_idx < box_state.size(); state_idx++)
 	{
-		std::cout << "last tracker num = " << trackers_.size() << std::endl;
+		state[state_idx] = box_state[state_idx];
 	}
-	std::cout << "NEW detected obj in current frame = " 
-		<< detections_in.size() << std::endl;
-	
-	predictedBoxes_.clear();
+	// the velocity of a new track is unknown : any speed up to the max
+	// speed, its position gate grows with it until the first updates
+	trackKalmanBank::StateMatrix covariance = trackKalmanBank::StateMatrix::Identity();
+	float speed_var = config_.association_max_speed_ * config_.association_max_speed_;
+	covariance.bottomRightCorner<3, 3>() = speed_var * Eigen::Matrix3f::Identity();
+	kalman_bank_.push_back(
+		state,
+		covariance,
+		detection_in.time_stamp_
+	);
+}
 
-	for (auto it = trackers_.begin(); it != trackers_.end();)
-	{
-		alignedDet predict_det = it->predict();
+void fusion_tracker::remove_track(size_t trk_idx)
+{
+	trackers_.eraseAt(trk_idx);
+	kalman_bank_.erase(trk_idx);
+}
 
-		if (predict_det.confidence3d_ > 0.0)
+int fusion_tracker::retire_tracks(const Config & config_)
+{
+	int retired = 0;
+	for (size_t trk_idx = 0; trk_idx < trackers_.size();)
+	{
+		const kfTracker & trk = trackers_[trk_idx];
+		bool tentative = trk.m_hits < config_.track_min_hits_;
+		if (trk.m_time_since_update > config_.track_max_age_ ||
+			(tentative && trk.m_time_since_update > 0))
 		{
-			predictedBoxes_.push_back(predict_det);
-			it++;
+			// the last track moves to trk_idx, look at it next
+			remove_track(trk_idx);
+			retired++;
 		}
 		else
 		{
-			it = trackers_.erase(it);
-			cerr << "Box invalid at frame: " << frame_count_ << endl;
+			trk_idx++;
 		}
 	}
-	std::cout << "predicted success num = " << predictedBoxes_.size() << std::endl;
-
-	trkNum_ = predictedBoxes_.size();
-	detNum_ = detections_in.size();
-
-	iouMatrix_.clear();
-	iouMatrix_.resize(trkNum_, vector<double>(detNum_, 1));
+	return retired;
+}
 
-	for (unsigned int i = 0; i < trkNum_; i++)
+void fusion_tracker::update_tracks(
+	const std::vector<alignedDet> & detections_in,
+	const std::vector<cv::Point> & pairs,
+	const std::vector<Eigen::Vector3d> & vels,
+	const std::vector<Eigen::Matrix3d> & vel_covs
+)
+{
+	std::vector<size_t> trk_indices(pairs.size());
+	trackKalmanBank::MeasureVectors measurements(pairs.size());
+	trackKalmanBank::MeasureMatrices measurement_noises(pairs.size());
+	for (size_t pair_idx = 0; pair_idx < pairs.size(); pair_idx++)
 	{
-		for (unsigned int j = 0; j < detNum_; j++)
+		const alignedDet & detection_in = detections_in[pairs[pair_idx].y];
+		trk_indices[pair_idx] = pairs[pair_idx].x;
+
+		std::vector<float> box_state = kfTracker::getState(detection_in);
+		for (size_t state_idx = 0; state_idx < box_state.size(); state_idx++)
 		{
-			// use 1-iou because the hungarian algorithm computes a minimum-cost assignment.
-			iouMatrix_[i][j] = 1 - GetIOU(predictedBoxes_[i], detections_in[j]);
+			measurements[pair_idx][state_idx] = box_state[state_idx];
 		}
-	}
+		measurements[pair_idx].tail<3>() = vels[pair_idx].cast<float>();
 
-	HungarianAlgorithm HungAlgo;
-	HungariaAssignment_.clear();
-	HungAlgo.Solve(iouMatrix_, HungariaAssignment_);
-
-	unmatchedTrajectories_.clear();
-	unmatchedDetections_.clear();
-	allItems_.clear();
-	matchedItems_.clear();
+		measurement_noises[pair_idx] = kBoxMeasureNoise * trackKalmanBank::MeasureMatrix::Identity();
+		measurement_noises[pair_idx].bottomRightCorner<3, 3>() = vel_covs[pair_idx].cast<float>();
 
-	if (detNum_ > trkNum_) //	there are unmatched detections
-	{
-		for (unsigned int n = 0; n < detNum_; n++)
-			allItems_.insert(n);
+		trackers_[pairs[pair_idx].x].update(detection_in);
+	}
+	kalman_bank_.update(trk_indices, measurements, measurement_noises);
+}
 
-		for (unsigned int i = 0; i < trkNum_; ++i)
-			matchedItems_.insert(HungariaAssignment_[i]);
+// call after update_tracks
+void fusion_tracker::get_kf_vel(
+	size_t trk_idx,
+	Eigen::Vector3d & vel_
+) const
+{
+	vel_ = kalman_bank_.state(trk_idx).tail<3>().cast<double>();
+}
 
-		set_difference(
-			allItems_.begin(), 
-			allItems_.end(),
-			matchedItems_.begin(), 
-			matchedItems_.end(),
-			insert_iterator<set<int>>(unmatchedDetections_, unmatchedDetections_.begin())
-		);
+void fusion_tracker::tracking(
+	const std::vector<alignedDet> & detections_in,
+	const cv::Mat & img_in,
+	uint64_t time_stamp,
+	const Config & config_,
+	boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer,
+	visualization_msgs::MarkerArray & obj_vel_txt_markerarray,
+	VisHandel * vis_ros_
+)
+{
+	bool verbose = config_.log_verbose_;
+	if (verbose)
+	{
+		std::cout << "--------------- tracking log ---------------" << std::endl;
 	}
-	else if (detNum_ < trkNum_) // there are unmatched trajectory/predictions
+	Timer tracker_timer("tracking time");
+	total_frames_++;
+	frame_count_++;
+	flowImageCache & cur_cache = cur_cache_;
+	build_flow_cache(img_in, cur_cache);
+	if (trackers_.size() == 0 && frame_count_ == 1)
 	{
-		for (unsigned int i = 0; i < trkNum_; ++i)
-			if (HungariaAssignment_[i] == -1) // unassigned label will be set as -1 in the assignment algorithm
-				unmatchedTrajectories_.insert(i);
+		if (verbose)
+		{
+			std::cout << "first tracking frame" << std::endl;
+		}
+		for (size_t obj_idx = 0; obj_idx < detections_in.size(); obj_idx++)
+		{
+			add_track(detections_in[obj_idx], config_);
+		}
+		last_detection_ = detections_in;
+		last_img_ = img_in;
+		std::swap(prev_cache_, cur_cache_);
+		return;
 	}
-	else;
-
-	matchedPairs_.clear();
-	for (unsigned int i = 0; i < trkNum_; ++i)
+	// every track retired : the detections are unmatched in associate and
+	// start new tracks there, no velocity this frame
+	if (verbose)
 	{
-		if (HungariaAssignment_[i] == -1) // pass over invalid values
-			continue;
-		if (1 - iouMatrix_[i][HungariaAssignment_[i]] < iouThreshold_)
+		if (trackers_.size() == 0)
 		{
-			std::cout << "1 - iouMatrix[i][HungariaAssignment[i]] = " 
-				<< 1 - iouMatrix_[i][HungariaAssignment_[i]] << std::endl;
-			unmatchedTrajectories_.insert(i);
-			unmatchedDetections_.insert(HungariaAssignment_[i]);
+			std::cout << "last frame tracker all fail!" << std::endl;
 		}
 		else
 		{
-			matchedPairs_.push_back(cv::Point(i, HungariaAssignment_[i]));
+			std::cout << "last tracker num = " << trackers_.size() << std::endl;
 		}
+		std::cout << "NEW detected obj in current frame = " 
+			<< detections_in.size() << std::endl;
+	}
+	
+	predict_tracks(time_stamp);
+	if (verbose)
+	{
+		std::cout << "predicted success num = " << predictedBoxes_.size() << std::endl;
 	}
 
-	std::cout << "matchedPairs num = " << matchedPairs_.size() << std::endl;
+	associationProfile association_profile;
+	associate(detections_in, config_, association_profile);
+	if (verbose)
+	{
+		std::cout << "association cost matrix / iou / solver / bookkeeping = "
+			<< association_profile.cost_matrix_ms_ << " / "
+			<< association_profile.iou_ms_ << " / "
+			<< association_profile.solver_ms_ << " / "
+			<< association_profile.bookkeeping_ms_ << " ms" << std::endl;
+		std::cout << "matchedPairs num = " << matchedPairs_.size() << std::endl;
+	}
 	vector<alignedDet> match_trackers;
 	vector<alignedDet> match_detections;
+	vector<slotId> match_track_ids;
 	for (unsigned int i = 0; i < matchedPairs_.size(); i++)
 	{
 		int detIdx, trkIdx;
@@ -410,30 +444,35 @@ void fusion_tracker::tracking(
 		detIdx = matchedPairs_[i].y;
 		match_trackers.push_back(trackers_[trkIdx].detection_cur_);
 		match_detections.push_back(detections_in[detIdx]);
+		match_track_ids.push_back(trackers_[trkIdx].m_id);
 	}
-
-	for (auto umd : unmatchedDetections_)
+	if (verbose)
 	{
-		kfTracker new_tracker(detections_in[umd]);
-		trackers_.push_back(new_tracker);
+		tracker_timer.rlog("tracking cost time");
 	}
-	tracker_timer.rlog("tracking cost time");
 
 	std::vector<Eigen::Vector2d> obj_means;
 	std::vector<Eigen::Matrix2d> obj_covariances;
+	if (prev_cache_.img_.data != last_img_.data)
+	{
+		build_flow_cache(last_img_, prev_cache_);
+	}
 	optical_estimator(
-		last_img_, 
-		img_in, 
+		prev_cache_, 
+		cur_cache, 
 		match_trackers, 
 		match_detections, 
+		match_track_ids,
 		config_,
 		obj_means,
 		obj_covariances
 	);
-	std::cout << "--------------- tracking log ---------------" << std::endl;
+	if (verbose)
+	{
+		std::cout << "--------------- tracking log ---------------" << std::endl;
+	}
 
 
-	pcl::PointCloud<pcl::PointXYZRGB>::Ptr undistorted_obj_clouds(new pcl::PointCloud<pcl::PointXYZRGB>);
 	visualization_msgs::Marker obj_vel_arrow;
 	obj_vel_arrow.header.frame_id = "livox";
 	obj_vel_arrow.ns = "obj_vel_arrow";
@@ -455,13 +494,11 @@ void fusion_tracker::tracking(
 	}
 	
 
+	// viewer calls stay on this thread
 	for (size_t obj_idx = 0; obj_idx < match_trackers.size(); obj_idx++)
 	{
-		int detIdx, trkIdx;
-		trkIdx = matchedPairs_[obj_idx].x;
-		detIdx = matchedPairs_[obj_idx].y;
-		Eigen::Vector3f track_center_pcl = match_trackers[obj_idx].vertex3d_.colwise().mean().cast<float>();
-		Eigen::Vector3f detect_center_pcl = match_detections[obj_idx].vertex3d_.colwise().mean().cast<float>();
+		Eigen::Vector3f track_center_pcl = match_trackers[obj_idx].vertex3d().colwise().mean();
+		Eigen::Vector3f detect_center_pcl = match_detections[obj_idx].vertex3d().colwise().mean();
 		pcl::PointXYZ track_center;
 		track_center.x = track_center_pcl[0];
 		track_center.y = track_center_pcl[1];
@@ -483,107 +520,458 @@ void fusion_tracker::tracking(
 			0, 255, 0, 
 			"tracking line" + std::to_string(rand())
 		);
+	}
+
+	// the cost of an object grows with its points, start the biggest first
+	// so a near truck doesn't run last on its own
+	std::vector<size_t> obj_order(match_trackers.size());
+	for (size_t obj_idx = 0; obj_idx < obj_order.size(); obj_idx++)
+	{
+		obj_order[obj_idx] = obj_idx;
+	}
+	std::stable_sort(obj_order.begin(), obj_order.end(), [&](size_t lhs, size_t rhs)
+	{
+		return match_detections[lhs].cloud_.size() > match_detections[rhs].cloud_.size();
+	});
+
+	size_t velocity_threads = config_.velocity_threads_ > 0 ? 
+		config_.velocity_threads_ : config_.integrator_threads_;
+	velocity_threads = std::max<size_t>(velocity_threads, 1);
+	if (!velocity_pool_ || velocity_pool_->threads() != velocity_threads - 1)
+	{
+		velocity_pool_.reset(new ThreadPool(velocity_threads - 1));
+	}
+
+	// every object writes its own tracker and output entries only, matched tracks are distinct
+	Timer velocity_timer("velocity estimation");
+	std::vector<objectVelocitySlot> obj_slots(match_trackers.size());
+	while (slot_clouds_.size() < obj_slots.size())
+	{
+		slot_clouds_.push_back(pcl::PointCloud<pcl::PointXYZRGB>::Ptr(new pcl::PointCloud<pcl::PointXYZRGB>));
+	}
+	for (size_t obj_idx = 0; obj_idx < obj_slots.size(); obj_idx++)
+	{
+		slot_clouds_[obj_idx]->clear();
+		obj_slots[obj_idx].cloud_ = slot_clouds_[obj_idx];
+	}
+	std::vector<Eigen::Vector3d> fused_vels(match_trackers.size());
+	std::vector<Eigen::Matrix3d> fused_vel_covs(match_trackers.size());
+	velocity_pool_->run(obj_order, [&](size_t obj_idx)
+	{
+		int detIdx, trkIdx;
+		trkIdx = matchedPairs_[obj_idx].x;
+		detIdx = matchedPairs_[obj_idx].y;
 		Eigen::Vector3d fused_vel;
 		Eigen::Matrix3d fused_vel_cov;
 		Eigen::Vector3d points_vel;
-		points_estimator(
-			match_trackers[obj_idx], 
-			match_detections[obj_idx],
-			points_vel,
-			obj_means[obj_idx],
-			obj_covariances[obj_idx],
-			trackers_[trkIdx].estimated_vel_,
-			fused_vel,
-			fused_vel_cov,
-			config_
-		);
-		trackers_[trkIdx].update(
-			detections_in[detIdx],
-			fused_vel,
-			fused_vel_cov
-		);
+		bool registered = false;
+		if (config_.velocity_engine_ == "registration" || config_.velocity_engine_compare_)
+		{
+			Timer registration_timer("registration");
+			registered = registration_estimator(
+				trackers_[trkIdx],
+				match_detections[obj_idx],
+				obj_means[obj_idx],
+				obj_covariances[obj_idx],
+				fused_vel,
+				fused_vel_cov,
+				config_
+			);
+			double registration_ms = registration_timer.elapsed(true);
+			if (config_.velocity_engine_compare_)
+			{
+				Eigen::Vector3d points_fused_vel;
+				Eigen::Matrix3d points_fused_vel_cov;
+				points_estimator(
+					match_trackers[obj_idx], 
+					match_detections[obj_idx],
+					points_vel,
+					obj_means[obj_idx],
+					obj_covariances[obj_idx],
+					trackers_[trkIdx].estimated_vel_,
+					points_fused_vel,
+					points_fused_vel_cov,
+					config_
+				);
+				double points_ms = registration_timer.elapsed(true);
+				if (registered)
+				{
+					cout << "track " << trackers_[trkIdx].m_id << " registration / points : " 
+						<< registration_ms << " / " << points_ms << " ms, velocity difference "
+						<< (fused_vel - points_fused_vel).norm() << " m/s" << endl;
+				}
+				if (!registered || config_.velocity_engine_ != "registration")
+				{
+					fused_vel = points_fused_vel;
+					fused_vel_cov = points_fused_vel_cov;
+					registered = true;
+				}
+			}
+		}
+		if (!registered)
+		{
+			points_estimator(
+				match_trackers[obj_idx], 
+				match_detections[obj_idx],
+				points_vel,
+				obj_means[obj_idx],
+				obj_covariances[obj_idx],
+				trackers_[trkIdx].estimated_vel_,
+				fused_vel,
+				fused_vel_cov,
+				config_
+			);
+		}
+		if (config_.velocity_window_size_ > 1)
+		{
+			window_estimator(
+				trackers_[trkIdx],
+				detections_in[detIdx],
+				config_,
+				fused_vel,
+				fused_vel_cov
+			);
+		}
+		fused_vels[obj_idx] = fused_vel;
+		fused_vel_covs[obj_idx] = fused_vel_cov;
+	});
+	double estimation_ms = velocity_timer.elapsed(true);
+	size_t stolen_tasks = velocity_pool_->stolenTasks();
+
+	// all matched tracks in one kf pass, then the posterior velocities undistort
+	update_tracks(detections_in, matchedPairs_, fused_vels, fused_vel_covs);
+	double kf_ms = velocity_timer.elapsed(true);
+
+	velocity_pool_->run(obj_order, [&](size_t obj_idx)
+	{
+		int detIdx, trkIdx;
+		trkIdx = matchedPairs_[obj_idx].x;
+		detIdx = matchedPairs_[obj_idx].y;
 		Eigen::Vector3d out_vel;
-		trackers_[trkIdx].get_kf_vel(out_vel);
+		get_kf_vel(trkIdx, out_vel);
 		trackers_[trkIdx].update_estimated_vel(out_vel);
+		if (config_.velocity_engine_ == "registration" || config_.velocity_engine_compare_)
+		{
+			trackers_[trkIdx].cache_registration(out_vel);
+		}
 
+		objectVelocitySlot & slot = obj_slots[obj_idx];
 		cloud_undistortion(
 			detections_in[detIdx],
 			out_vel,
-			undistorted_obj_clouds,
-			obj_vel_arrow,
-			obj_vel_txt_markerarray
+			trackers_[trkIdx].m_id,
+			slot.cloud_,
+			slot.arrow_,
+			slot.txt_
+		);
+	});
+	if (verbose)
+	{
+		std::cout << "velocity estimation of " << obj_slots.size() << " objects on " 
+			<< velocity_threads << " threads, " << stolen_tasks 
+			<< " stolen = " << estimation_ms << " ms, kf update = " << kf_ms 
+			<< " ms, undistortion = " << velocity_timer.elapsed(true) << " ms" << std::endl;
+	}
+
+	// merge in object order, the published messages don't depend on the schedule
+	undistorted_obj_clouds_.clear();
+	for (size_t obj_idx = 0; obj_idx < obj_slots.size(); obj_idx++)
+	{
+		const objectVelocitySlot & slot = obj_slots[obj_idx];
+		undistorted_obj_clouds_ += *slot.cloud_;
+		obj_vel_arrow.points.insert(
+			obj_vel_arrow.points.end(), 
+			slot.arrow_.points.begin(), 
+			slot.arrow_.points.end()
+		);
+		obj_vel_txt_markerarray.markers.insert(
+			obj_vel_txt_markerarray.markers.end(), 
+			slot.txt_.markers.begin(), 
+			slot.txt_.markers.end()
 		);
 	}
 
-	sensor_msgs::PointCloud2::Ptr undistorted_obj_cloud_msg(new sensor_msgs::PointCloud2);
-	pcl::toROSMsg(*undistorted_obj_clouds, *undistorted_obj_cloud_msg);
-	vis_ros_->undistorted_obj_cloud_publisher(*undistorted_obj_cloud_msg);
+	pcl::toROSMsg(undistorted_obj_clouds_, undistorted_obj_cloud_msg_);
+	vis_ros_->undistorted_obj_cloud_publisher(undistorted_obj_cloud_msg_);
 	vis_ros_->obj_vel_arrow_publisher(obj_vel_arrow);
 	vis_ros_->obj_vel_txt_publisher(obj_vel_txt_markerarray);
 
+	int retired = retire_tracks(config_);
+	if (verbose)
+	{
+		std::cout << "track pool occupancy = " << trackers_.size() << " / " 
+			<< trackers_.slotCount() << " slots, " << retired << " retired" << std::endl;
+	}
+
 	last_detection_ = detections_in;
 	last_img_ = img_in;
+	std::swap(prev_cache_, cur_cache_);
 }
 
-cv::RotatedRect fusion_tracker::alignedDet2rotaterect(alignedDet detection_in)
+void fusion_tracker::predict_tracks(uint64_t time_stamp)
 {
-    cv::Point2f det_center;
-    for (size_t pt_idx = 0; pt_idx < detection_in.vertex3d_.rows(); pt_idx++)
-    {
-        det_center.x += detection_in.vertex3d_(pt_idx, 0);
-        det_center.y += detection_in.vertex3d_(pt_idx, 1);
-    }
-    det_center.x /= detection_in.vertex3d_.rows();
-    det_center.y /= detection_in.vertex3d_.rows();
-
-    float det_width = sqrt(
-        pow(detection_in.vertex3d_(0,0) - detection_in.vertex3d_(1,0), 2) + 
-        pow(detection_in.vertex3d_(0,1) - detection_in.vertex3d_(1,1), 2)
-    );
-    float det_height = sqrt(
-        pow(detection_in.vertex3d_(0,0) - detection_in.vertex3d_(3,0), 2) + 
-        pow(detection_in.vertex3d_(0,1) - detection_in.vertex3d_(3,1), 2)
-    );
-    cv::Size2f det_size(det_width, det_height);
+	predictedBoxes_.clear();
 
-    Eigen::Vector2f base_dir(-1.0, 0.0);
-    Eigen::Vector2f angle_dir(
-        detection_in.vertex3d_(1,0) - detection_in.vertex3d_(0,0),
-        detection_in.vertex3d_(1,1) - detection_in.vertex3d_(0,1)
-    );
-    float det_angle = base_dir.dot(angle_dir) / (base_dir.norm() * angle_dir.norm());
-    det_angle = acos(det_angle) * 180.0 / M_PI;
+	// nominal 10 Hz frame interval if the timestamps can't be used
+	kalman_bank_.predict(time_stamp, 0.1);
 
-    cv::RotatedRect rect(
-        det_center, 
-        det_size,
-        det_angle
-    );
+	for (size_t trk_idx = 0; trk_idx < trackers_.size();)
+	{
+		Eigen::Vector3d predicted_center = kalman_bank_.state(trk_idx).head<3>().cast<double>();
+		detRecord predict_det = trackers_[trk_idx].predict(time_stamp, predicted_center);
 
-    return rect;
+		if (predict_det.confidence3d_ > 0.0)
+		{
+			predictedBoxes_.push_back(predict_det);
+			trk_idx++;
+		}
+		else
+		{
+			remove_track(trk_idx);
+			cerr << "Box invalid at frame: " << frame_count_ << endl;
+		}
+	}
 }
 
-double fusion_tracker::GetIOU(alignedDet bb_test, alignedDet bb_gt)
+// predictedBoxes_[i] belongs to trackers_[i], call after predict_tracks
+void fusion_tracker::associate(
+	const std::vector<alignedDet> & detections_in,
+	const Config & config_,
+	associationProfile & profile
+)
 {
-	/* a 2d projection iou method */
-    cv::RotatedRect rect1 = alignedDet2rotaterect(bb_test);
-    cv::RotatedRect rect2 = alignedDet2rotaterect(bb_gt);
-    float areaRect1 = rect1.size.width * rect1.size.height;
-    float areaRect2 = rect2.size.width * rect2.size.height;
-    vector<cv::Point2f> vertices;
-
-    int intersectionType = cv::rotatedRectangleIntersection(rect1, rect2, vertices);
-    if (vertices.size()==0)
-        return 0.0;
-    else{
-        vector<cv::Point2f> order_pts;
+	Timer stage_timer("association stage");
 
-        cv::convexHull(cv::Mat(vertices), order_pts, true);
-        double area = cv::contourArea(order_pts);
-        float inner = (float) (area / (areaRect1 + areaRect2 - area + 0.0001));
+	trkNum_ = predictedBoxes_.size();
+	detNum_ = detections_in.size();
 
-        return inner;
-    }
+	// ------- cost matrix : rects, gate and broadphase -------
+	iouMatrix_.clear();
+	iouMatrix_.resize(trkNum_, vector<double>(detNum_, 1));
+
+	FrameArena * arena = frame_memory_ ? &frame_memory_->arena() : NULL;
+	arenaVector<cv::RotatedRect> trk_rects{ArenaAllocator<cv::RotatedRect>(arena)};
+	arenaVector<cv::RotatedRect> det_rects{ArenaAllocator<cv::RotatedRect>(arena)};
+	trk_rects.reserve(trkNum_);
+	det_rects.reserve(detNum_);
+	for (unsigned int i = 0; i < trkNum_; i++)
+	{
+		trk_rects.push_back(alignedDet2rotaterect(predictedBoxes_[i]));
+	}
+	for (unsigned int j = 0; j < detNum_; j++)
+	{
+		det_rects.push_back(alignedDet2rotaterect(detections_in[j]));
+	}
+
+	arenaVector<cv::Point> candidate_pairs{ArenaAllocator<cv::Point>(arena)};
+	for (unsigned int i = 0; i < trkNum_; i++)
+	{
+		double trk_radius = 0.5 * std::hypot(trk_rects[i].size.width, trk_rects[i].size.height);
+		// gate of the track : the innovation of the detection center against
+		// the predicted kf position, S = H P H^T + R on x, y. The predicted P
+		// of a new track carries its unknown velocity.
+		Eigen::Vector2d trk_center = kalman_bank_.state(i).head<2>().cast<double>();
+		Eigen::Matrix2d innovation_cov = kalman_bank_.covariance(i).topLeftCorner<2, 2>().cast<double>();
+		innovation_cov += kBoxMeasureNoise * Eigen::Matrix2d::Identity();
+		Eigen::Matrix2d innovation_info = innovation_cov.inverse();
+		for (unsigned int j = 0; j < detNum_; j++)
+		{
+			double det_radius = 0.5 * std::hypot(det_rects[j].size.width, det_rects[j].size.height);
+			Eigen::Vector2d innovation(
+				det_rects[j].center.x - trk_center[0],
+				det_rects[j].center.y - trk_center[1]
+			);
+			double dx = trk_rects[i].center.x - det_rects[j].center.x;
+			double dy = trk_rects[i].center.y - det_rects[j].center.y;
+			double dist2 = dx * dx + dy * dy;
+			// gate : the detection is outside the innovation ellipse
+			// broadphase : the bounding circles don't touch, the iou is 0
+			if (innovation.dot(innovation_info * innovation) > kGateChi2 || 
+				dist2 > (trk_radius + det_radius) * (trk_radius + det_radius))
+			{
+				continue;
+			}
+			candidate_pairs.push_back(cv::Point(i, j));
+		}
+	}
+	profile.cost_matrix_ms_ = stage_timer.elapsed(true);
+
+	// ------- iou -------
+	for (size_t pair_idx = 0; pair_idx < candidate_pairs.size(); pair_idx++)
+	{
+		int i = candidate_pairs[pair_idx].x;
+		int j = candidate_pairs[pair_idx].y;
+		// use 1-iou because the hungarian algorithm computes a minimum-cost assignment.
+		iouMatrix_[i][j] = 1 - GetIOU(trk_rects[i], det_rects[j]);
+	}
+	profile.iou_evaluations_ = candidate_pairs.size();
+	profile.iou_ms_ = stage_timer.elapsed(true);
+	if (config_.log_verbose_)
+	{
+		std::cout << "iou evaluations = " << profile.iou_evaluations_ 
+			<< " / " << trkNum_ * detNum_ << std::endl;
+	}
+
+	// ------- assignment solver -------
+	HungariaAssignment_.clear();
+	if (config_.assignment_warm_start_)
+	{
+		vector<double> row_duals(trkNum_, 0.0);
+		vector<bool> warm_rows(trkNum_, false);
+		for (unsigned int i = 0; i < trkNum_; i++)
+		{
+			row_duals[i] = trackers_[i].assignment_dual_;
+			warm_rows[i] = trackers_[i].has_assignment_dual_;
+		}
+		double warm_cost = warmHungarian_.Solve(
+			iouMatrix_, 
+			HungariaAssignment_, 
+			row_duals, 
+			warm_rows
+		);
+		for (unsigned int i = 0; i < trkNum_; i++)
+		{
+			trackers_[i].assignment_dual_ = row_duals[i];
+			trackers_[i].has_assignment_dual_ = !warmHungarian_.usedFallback();
+		}
+		profile.repaired_rows_ = warmHungarian_.repairedRows();
+		if (config_.log_verbose_)
+		{
+			std::cout << "warm start assignment repaired rows = " 
+				<< warmHungarian_.repairedRows() << " / " << std::max(trkNum_, detNum_)
+				<< (warmHungarian_.usedFallback() ? " (full solve fallback)" : "") << std::endl;
+		}
+
+		if (config_.assignment_verify_ && trkNum_ > 0 && detNum_ > 0)
+		{
+			HungarianAlgorithm HungAlgo;
+			vector<int> full_assignment;
+			double full_cost = HungAlgo.Solve(iouMatrix_, full_assignment);
+			if (std::abs(full_cost - warm_cost) > 1e-6)
+			{
+				cerr << "warm start assignment cost " << warm_cost 
+					<< " != full solve cost " << full_cost 
+					<< " at frame: " << frame_count_ << endl;
+			}
+		}
+	}
+	else if (trkNum_ > 0 && detNum_ > 0)
+	{
+		HungarianAlgorithm HungAlgo;
+		HungAlgo.Solve(iouMatrix_, HungariaAssignment_);
+		profile.repaired_rows_ = std::max(trkNum_, detNum_);
+	}
+	else
+	{
+		// nothing to assign, HungarianAlgorithm needs a non empty matrix
+		HungariaAssignment_.assign(trkNum_, -1);
+		profile.repaired_rows_ = 0;
+	}
+	profile.solver_ms_ = stage_timer.elapsed(true);
+
+	// ------- bookkeeping : matched / unmatched sets, new tracks -------
+
+	unmatchedTrajectories_.clear();
+	unmatchedDetections_.clear();
+	allItems_.clear();
+	matchedItems_.clear();
+
+	if (detNum_ > trkNum_) //	there are unmatched detections
+	{
+		for (unsigned int n = 0; n < detNum_; n++)
+			allItems_.insert(n);
+
+		for (unsigned int i = 0; i < trkNum_; ++i)
+			matchedItems_.insert(HungariaAssignment_[i]);
+
+		set_difference(
+			allItems_.begin(), 
+			allItems_.end(),
+			matchedItems_.begin(), 
+			matchedItems_.end(),
+			insert_iterator<set<int>>(unmatchedDetections_, unmatchedDetections_.begin())
+		);
+	}
+	else if (detNum_ < trkNum_) // there are unmatched trajectory/predictions
+	{
+		for (unsigned int i = 0; i < trkNum_; ++i)
+			if (HungariaAssignment_[i] == -1) // unassigned label will be set as -1 in the assignment algorithm
+				unmatchedTrajectories_.insert(i);
+	}
+	else;
+
+	matchedPairs_.clear();
+	for (unsigned int i = 0; i < trkNum_; ++i)
+	{
+		if (HungariaAssignment_[i] == -1) // pass over invalid values
+			continue;
+		if (1 - iouMatrix_[i][HungariaAssignment_[i]] < iouThreshold_)
+		{
+			if (config_.log_verbose_)
+			{
+				std::cout << "1 - iouMatrix[i][HungariaAssignment[i]] = " 
+					<< 1 - iouMatrix_[i][HungariaAssignment_[i]] << std::endl;
+			}
+			unmatchedTrajectories_.insert(i);
+			unmatchedDetections_.insert(HungariaAssignment_[i]);
+		}
+		else
+		{
+			matchedPairs_.push_back(cv::Point(i, HungariaAssignment_[i]));
+		}
+	}
+
+	for (auto umd : unmatchedDetections_)
+	{
+		add_track(detections_in[umd], config_);
+	}
+	profile.bookkeeping_ms_ = stage_timer.elapsed(true);
+}
+
+cv::RotatedRect fusion_tracker::alignedDet2rotaterect(const detRecord & detection_in)
+{
+    cv::Point2f det_center;
+    for (size_t pt_idx = 0; pt_idx < detection_in.vertex3d().rows(); pt_idx++)
+    {
+        det_center.x += detection_in.vertex3d()(pt_idx, 0);
+        det_center.y += detection_in.vertex3d()(pt_idx, 1);
+    }
+    det_center.x /= detection_in.vertex3d().rows();
+    det_center.y /= detection_in.vertex3d().rows();
+
+    float det_width = sqrt(
+        pow(detection_in.vertex3d()(0,0) - detection_in.vertex3d()(1,0), 2) + 
+        pow(detection_in.vertex3d()(0,1) - detection_in.vertex3d()(1,1), 2)
+    );
+    float det_height = sqrt(
+        pow(detection_in.vertex3d()(0,0) - detection_in.vertex3d()(3,0), 2) + 
+        pow(detection_in.vertex3d()(0,1) - detection_in.vertex3d()(3,1), 2)
+    );
+    cv::Size2f det_size(det_width, det_height);
+
+    Eigen::Vector2f base_dir(-1.0, 0.0);
+    Eigen::Vector2f angle_dir(
+        detection_in.vertex3d()(1,0) - detection_in.vertex3d()(0,0),
+        detection_in.vertex3d()(1,1) - detection_in.vertex3d()(0,1)
+    );
+    float det_angle = base_dir.dot(angle_dir) / (base_dir.norm() * angle_dir.norm());
+    det_angle = acos(det_angle) * 180.0 / M_PI;
+
+    cv::RotatedRect rect(
+        det_center, 
+        det_size,
+        det_angle
+    );
+
+    return rect;
+}
+
+double fusion_tracker::GetIOU(const detRecord & bb_test, const detRecord & bb_gt)
+{
+	/* a 2d projection iou method */
+    cv::RotatedRect rect1 = alignedDet2rotaterect(bb_test);
+    cv::RotatedRect rect2 = alignedDet2rotaterect(bb_gt);
+    return GetIOU(rect1, rect2);
 
 
 	// /* a 2d image based iou method */
@@ -613,11 +1001,52 @@ double fusion_tracker::GetIOU(alignedDet bb_test, alignedDet bb_gt)
 	// return score;
 }
 
+double fusion_tracker::GetIOU(const cv::RotatedRect & rect1, const cv::RotatedRect & rect2)
+{
+    float areaRect1 = rect1.size.width * rect1.size.height;
+    float areaRect2 = rect2.size.width * rect2.size.height;
+    vector<cv::Point2f> vertices;
+
+    int intersectionType = cv::rotatedRectangleIntersection(rect1, rect2, vertices);
+    if (vertices.size()==0)
+        return 0.0;
+    else{
+        vector<cv::Point2f> order_pts;
+
+        cv::convexHull(cv::Mat(vertices), order_pts, true);
+        double area = cv::contourArea(order_pts);
+        float inner = (float) (area / (areaRect1 + areaRect2 - area + 0.0001));
+
+        return inner;
+    }
+
+}
+
+void fusion_tracker::build_flow_cache(
+	const cv::Mat & img_in,
+	flowImageCache & cache
+)
+{
+	cache.img_ = img_in;
+	cv::cvtColor(
+		img_in,
+		cache.gray_,
+		cv::COLOR_RGB2GRAY
+	);
+	cv::buildOpticalFlowPyramid(
+		cache.gray_,
+		cache.pyramid_,
+		kFlowWinSize,
+		kFlowMaxLevel
+	);
+}
+
 void fusion_tracker::optical_estimator(
-	cv::Mat prev_,
-	cv::Mat cur_,
+	const flowImageCache & prev_cache,
+	const flowImageCache & cur_cache,
 	const std::vector<alignedDet> & prev_detection,
 	const std::vector<alignedDet> & cur_detection,
+	const std::vector<slotId> & track_ids,
 	const Config & config_,
 	std::vector<Eigen::Vector2d> & obj_means,
 	std::vector<Eigen::Matrix2d> & obj_covariances
@@ -626,135 +1055,242 @@ void fusion_tracker::optical_estimator(
 	Timer lk_timer("optical flow time");
 
 	int obj_num = prev_detection.size();
-	Mat mask = Mat::zeros(
-		prev_.size(), 
-		prev_.type()
-	);
-	cv::Mat prev_gray, cur_gray;
-	vector<cv::Point2f> cur_pts;
-	vector<cv::Point2f> prev_pts;
-	vector<cv::Point2f> tracked_cur_pts;
-	vector<cv::Point2f> tracked_prev_pts;
-	if (prev_pts_.size() == 0)
-	{
-		cv::cvtColor(
-			prev_,
-			prev_gray,
-			cv::COLOR_RGB2GRAY
-		);
-		cv::goodFeaturesToTrack(
-			prev_gray,
-			prev_pts, 
-			config_.maxCorners_,
-			config_.qualityLevel_, 
-			config_.minDistance_,
-			Mat(), 
-			config_.blockSize_, 
-			false, config_.Harris_k_value_
+
+	vector<cv::Rect> cur_boxes;
+	vector<double> box_depths;
+	for (size_t obj_idx = 0; obj_idx < cur_detection.size(); obj_idx++)
+	{
+		cur_boxes.push_back(cur_detection[obj_idx].vertex2d());
+		box_depths.push_back(cur_detection[obj_idx].vertex3d().colwise().mean().norm());
+	}
+	vector<vector<Point2f>> obj_features_prev(obj_num);
+	vector<vector<Point2f>> obj_features_cur(obj_num);
+	std::vector<std::vector<uchar>> inlier_status(obj_num);
+	obj_means.assign(obj_num, Eigen::Vector2d::Zero());
+	obj_covariances.assign(obj_num, kNoPixelMotionVar * Eigen::Matrix2d::Identity());
+
+	if (config_.optical_flow_engine_ != "dense")
+	{
+		// features live across frames, new corners only for objects without enough
+		feature_tracks_.update(
+			prev_cache,
+			cur_cache,
+			track_ids,
+			cur_boxes,
+			box_depths,
+			config_,
+			obj_features_prev,
+			obj_features_cur
 		);
-		for (size_t pt_idx = 0; pt_idx < prev_pts.size(); pt_idx++)
+		if (config_.log_verbose_)
 		{
-			for (size_t obj_idx = 0; obj_idx < obj_num; obj_idx++)
+			std::cout << "feature tracks alive / detected corners / replenished objs = "
+				<< feature_tracks_.trackedFeatures() << " / "
+				<< feature_tracks_.detectedCorners() << " / "
+				<< feature_tracks_.replenishedObjects() << std::endl;
+			std::cout << "objects per flow level =";
+			for (size_t level = 0; level < feature_tracks_.levelObjects().size(); level++)
 			{
-				if (
-					prev_pts[pt_idx].x >= prev_detection[obj_idx].vertex2d_.x
-					&& prev_pts[pt_idx].x <= prev_detection[obj_idx].vertex2d_.x + prev_detection[obj_idx].vertex2d_.width
-					&& prev_pts[pt_idx].y >= prev_detection[obj_idx].vertex2d_.y
-					&& prev_pts[pt_idx].y <= prev_detection[obj_idx].vertex2d_.y + prev_detection[obj_idx].vertex2d_.height
-				)
-				{
-					tracked_prev_pts.push_back(prev_pts[pt_idx]);
-					break;
-				}
+				std::cout << " " << feature_tracks_.levelObjects()[level];
 			}
+			std::cout << std::endl;
+
+			lk_timer.rlog("ransac timer cost : ");
+		}
+
+		Timer motion_timer("pixel motion time");
+		estimate_pixel_motion(
+			obj_features_prev,
+			obj_features_cur,
+			config_,
+			inlier_status,
+			obj_means,
+			obj_covariances
+		);
+		if (config_.log_verbose_)
+		{
+			motion_timer.rlog("pixel motion cost (" + config_.pixel_motion_estimator_ + ")");
 		}
 	}
-	else
+
+	// dense flow for every object, or in "auto" for the objects the
+	// sparse features left with too few inliers
+	std::vector<int> dense_objs;
+	for (int obj_idx = 0; obj_idx < obj_num; obj_idx++)
 	{
-		tracked_prev_pts = prev_pts_;
-		prev_gray = prev_gray_;
+		int inlier_num = std::count(inlier_status[obj_idx].begin(), inlier_status[obj_idx].end(), 1);
+		if (config_.optical_flow_engine_ == "dense" || 
+			(config_.optical_flow_engine_ == "auto" && inlier_num < config_.dense_min_inliers_))
+		{
+			dense_objs.push_back(obj_idx);
+		}
 	}
-	
+	if (dense_objs.size() > 0)
+	{
+		Timer dense_timer("dense flow time");
+		dense_estimator(
+			prev_cache,
+			cur_cache,
+			prev_detection,
+			cur_detection,
+			box_depths,
+			dense_objs,
+			config_,
+			obj_means,
+			obj_covariances
+		);
+		if (config_.log_verbose_)
+		{
+			dense_timer.rlog("dense flow cost (" + std::to_string(dense_objs.size()) + " objs)");
+		}
+	}
+}
 
-	cv::cvtColor(
-		cur_,
-		cur_gray,
-		cv::COLOR_RGB2GRAY
-	);
+// dense flow (DIS, Farneback before OpenCV 4) cur -> prev on the union of
+// both boxes at the flow level of the object, every dense_stride pixel of
+// the visible object is a displacement sample for the robust translation
+void fusion_tracker::dense_estimator(
+	const flowImageCache & prev_cache,
+	const flowImageCache & cur_cache,
+	const std::vector<alignedDet> & prev_detection,
+	const std::vector<alignedDet> & cur_detection,
+	const std::vector<double> & box_depths,
+	const std::vector<int> & dense_objs,
+	const Config & config_,
+	std::vector<Eigen::Vector2d> & obj_means,
+	std::vector<Eigen::Matrix2d> & obj_covariances
+)
+{
+	const cv::Mat & cur_gray = cur_cache.gray_;
+	cv::Rect image_rect(0, 0, cur_gray.cols, cur_gray.rows);
+	std::vector<cv::Rect> cur_boxes;
+	for (size_t obj_idx = 0; obj_idx < cur_detection.size(); obj_idx++)
+	{
+		cur_boxes.push_back(cur_detection[obj_idx].vertex2d() & image_rect);
+	}
+	cv::Mat labels;
+	paintLabelMap(cur_boxes, box_depths, cur_gray.size(), labels);
 
-	cv::goodFeaturesToTrack(
-		cur_gray,
-		cur_pts, 
-		config_.maxCorners_, 
-		config_.qualityLevel_, 
-		config_.minDistance_,
-		Mat(), 
-		config_.blockSize_, 
-		false, config_.Harris_k_value_
-	);
-	for (size_t pt_idx = 0; pt_idx < cur_pts.size(); pt_idx++)
+	int pyramid_levels = std::min(pyramidLevels(prev_cache), pyramidLevels(cur_cache));
+	int max_flow_level = std::max(0, std::min(config_.flow_max_level_, pyramid_levels - 1));
+
+	// objects are independent, every slot is written by one worker
+	cv::parallel_for_(cv::Range(0, dense_objs.size()), [&](const cv::Range & range)
 	{
-		for (size_t obj_idx = 0; obj_idx < cur_detection.size(); obj_idx++)
+		for (int dense_idx = range.start; dense_idx < range.end; dense_idx++)
 		{
-			if (
-				cur_pts[pt_idx].x >= cur_detection[obj_idx].vertex2d_.x
-				&& cur_pts[pt_idx].x <= cur_detection[obj_idx].vertex2d_.x + cur_detection[obj_idx].vertex2d_.width
-				&& cur_pts[pt_idx].y >= cur_detection[obj_idx].vertex2d_.y
-				&& cur_pts[pt_idx].y <= cur_detection[obj_idx].vertex2d_.y + cur_detection[obj_idx].vertex2d_.height
-			)
+			int obj_idx = dense_objs[dense_idx];
+			int level = flowLevel(cur_boxes[obj_idx], max_flow_level, config_.flow_min_box_px_);
+			int scale = 1 << level;
+			const cv::Mat & prev_level = pyramidImage(prev_cache, level);
+			const cv::Mat & cur_level = pyramidImage(cur_cache, level);
+
+			cv::Rect region = prev_detection[obj_idx].vertex2d() | cur_detection[obj_idx].vertex2d();
+			region.x -= config_.roi_margin_;
+			region.y -= config_.roi_margin_;
+			region.width += 2 * config_.roi_margin_;
+			region.height += 2 * config_.roi_margin_;
+			cv::Rect level_region(
+				region.x / scale,
+				region.y / scale,
+				(region.width + scale - 1) / scale,
+				(region.height + scale - 1) / scale
+			);
+			level_region &= cv::Rect(0, 0, cur_level.cols, cur_level.rows);
+			// too small for dense flow, the object keeps its sparse moments
+			// or the uninformative ones
+			if (level_region.width < 16 || level_region.height < 16)
 			{
-				tracked_cur_pts.push_back(cur_pts[pt_idx]);
-				break;
+				continue;
 			}
-		}
-	}
 
-	vector<uchar> status;
-	vector<float> err;
-	Timer calcOpticalFlowPyrLK_timer("calcOpticalFlowPyrLK time");
-	cv::calcOpticalFlowPyrLK(
-		cur_gray, 
-		prev_gray, 
-		tracked_cur_pts, 
-		tracked_prev_pts, 
-		status, 
-		err, 
-		cv::Size(20, 20), 3
-	);
-	calcOpticalFlowPyrLK_timer.rlog("calcOpticalFlowPyrLK cost");
-	vector<Point2f> matchedpoints1;
-	vector<Point2f> matchedpoints2;
-	vector<Point2f> obj_features_prev[obj_num];
-	vector<Point2f> obj_features_cur[obj_num];
-	for(uint i = 0; i < tracked_cur_pts.size(); i++)
-	{
-		// Select good points
-		if(status[i] == 1) 
-		{
-			for (size_t obj_idx = 0; obj_idx < obj_num; obj_idx++)
+			cv::Mat flow;
+#if CV_VERSION_MAJOR >= 4
+			cv::Ptr<cv::DISOpticalFlow> dis = 
+				cv::DISOpticalFlow::create(cv::DISOpticalFlow::PRESET_ULTRAFAST);
+			dis->calc(cur_level(level_region), prev_level(level_region), flow);
+#else
+			cv::calcOpticalFlowFarneback(
+				cur_level(level_region), 
+				prev_level(level_region), 
+				flow, 
+				0.5, 2, 9, 2, 5, 1.1, 0
+			);
+#endif
+
+			std::vector<cv::Point2f> features_prev, features_cur;
+			for (int y = 0; y < level_region.height; y += config_.dense_stride_)
 			{
-				if (
-					tracked_prev_pts[i].x >= prev_detection[obj_idx].vertex2d_.x
-					&& tracked_prev_pts[i].x <= prev_detection[obj_idx].vertex2d_.x + prev_detection[obj_idx].vertex2d_.width
-					&& tracked_prev_pts[i].y >= prev_detection[obj_idx].vertex2d_.y
-					&& tracked_prev_pts[i].y <= prev_detection[obj_idx].vertex2d_.y + prev_detection[obj_idx].vertex2d_.height
-				)
+				for (int x = 0; x < level_region.width; x += config_.dense_stride_)
 				{
-					// line(mask,tracked_prev_pts[i], tracked_cur_pts[i], cv::Scalar(0, 255, 255), 2);
-					// circle(mask, tracked_prev_pts[i], 1, cv::Scalar(0, 255, 0), -1);
-					obj_features_prev[obj_idx].push_back(tracked_prev_pts[i]);
-					obj_features_cur[obj_idx].push_back(tracked_cur_pts[i]);
-					break;
+					cv::Point2f cur_pt(
+						(level_region.x + x) * scale,
+						(level_region.y + y) * scale
+					);
+					if (labelAt(labels, cur_pt) != obj_idx)
+					{
+						continue;
+					}
+					const cv::Point2f & pix_flow = flow.at<cv::Point2f>(y, x);
+					features_cur.push_back(cur_pt);
+					features_prev.push_back(cur_pt + pix_flow * (float)scale);
 				}
 			}
+
+			std::vector<uchar> inlier_status;
+			robust_pixel_motion(features_prev, features_cur, config_, inlier_status);
+			pixel_motion_moments(
+				features_prev,
+				features_cur,
+				inlier_status,
+				obj_means[obj_idx],
+				obj_covariances[obj_idx]
+			);
 		}
-	}
+	});
+}
 
-	lk_timer.rlog("ransac timer cost : ");
+// inlier status, mean and diagonal covariance of the displacement of every
+// object, "ransac" : epipolar RANSAC, "irls" : robust translation
+void fusion_tracker::estimate_pixel_motion(
+	const std::vector<std::vector<cv::Point2f>> & obj_features_prev,
+	const std::vector<std::vector<cv::Point2f>> & obj_features_cur,
+	const Config & config_,
+	std::vector<std::vector<uchar>> & inlier_status,
+	std::vector<Eigen::Vector2d> & obj_means,
+	std::vector<Eigen::Matrix2d> & obj_covariances
+)
+{
+	int obj_num = obj_features_prev.size();
+	inlier_status.assign(obj_num, std::vector<uchar>());
+	obj_means.assign(obj_num, Eigen::Vector2d::Zero());
+	obj_covariances.assign(obj_num, kNoPixelMotionVar * Eigen::Matrix2d::Identity());
+
+	if (config_.pixel_motion_estimator_ == "irls")
+	{
+		// objects are independent, every slot is written by one worker
+		cv::parallel_for_(cv::Range(0, obj_num), [&](const cv::Range & range)
+		{
+			for (int obj_idx = range.start; obj_idx < range.end; obj_idx++)
+			{
+				robust_pixel_motion(
+					obj_features_prev[obj_idx],
+					obj_features_cur[obj_idx],
+					config_,
+					inlier_status[obj_idx]
+				);
+				pixel_motion_moments(
+					obj_features_prev[obj_idx],
+					obj_features_cur[obj_idx],
+					inlier_status[obj_idx],
+					obj_means[obj_idx],
+					obj_covariances[obj_idx]
+				);
+			}
+		});
+		return;
+	}
 
-	Timer ransac_timer("optical flow time");
-	std::vector<uchar> ransac_status[obj_num];
-	std::pair<std::vector<Point2f>, std::vector<Point2f>>  pixels_vel[obj_num];
 	for (size_t obj_idx = 0; obj_idx < obj_num; obj_idx++)
 	{
 		if (obj_features_prev[obj_idx].size() == 0)
@@ -765,66 +1301,122 @@ void fusion_tracker::optical_estimator(
 			cv::findFundamentalMat(
 				obj_features_prev[obj_idx], 
 				obj_features_cur[obj_idx], 
-				ransac_status[obj_idx], 
+				inlier_status[obj_idx], 
 				CV_FM_RANSAC
 			);
+		pixel_motion_moments(
+			obj_features_prev[obj_idx],
+			obj_features_cur[obj_idx],
+			inlier_status[obj_idx],
+			obj_means[obj_idx],
+			obj_covariances[obj_idx]
+		);
+	}
+}
 
-		int rand_r = (rand() % 255) + 0;
-		int rand_g = (rand() % 255) + 0;
-		int rand_b = (rand() % 255) + 0;
-		for (size_t pix_idx = 0; pix_idx < ransac_status[obj_idx].size(); pix_idx++)
-		{
-			if (ransac_status[obj_idx][pix_idx] != 0)
-			{
-				line(
-					mask,
-					obj_features_prev[obj_idx][pix_idx], 
-					obj_features_cur[obj_idx][pix_idx], 
-					cv::Scalar(rand_r, rand_g, rand_b), 2
-				);
-				pixels_vel[obj_idx].first.push_back(obj_features_prev[obj_idx][pix_idx]);
-				pixels_vel[obj_idx].second.push_back(obj_features_cur[obj_idx][pix_idx]);
-			}
-		}
+static double median_of(std::vector<double> values)
+{
+	size_t mid = values.size() / 2;
+	std::nth_element(values.begin(), values.begin() + mid, values.end());
+	return values[mid];
+}
+
+// median start, huber IRLS on the 2d displacement, the scale comes from the
+// MAD of the residuals, features beyond 3 sigma are outliers
+void fusion_tracker::robust_pixel_motion(
+	const std::vector<cv::Point2f> & features_prev,
+	const std::vector<cv::Point2f> & features_cur,
+	const Config & config_,
+	std::vector<uchar> & inlier_status
+)
+{
+	size_t pix_num = features_prev.size();
+	inlier_status.assign(pix_num, 0);
+	if (pix_num == 0)
+	{
+		return;
 	}
-	ransac_timer.rlog("ransac cost");
 
-	std::vector<Eigen::Vector2d> means;
-	std::vector<Eigen::Matrix2d> covariances;
-	means.resize(obj_num);
-	covariances.resize(obj_num);
-	for (size_t obj_idx = 0; obj_idx < obj_num; obj_idx++)
+	std::vector<double> dx(pix_num), dy(pix_num), residuals(pix_num);
+	for (size_t pix_idx = 0; pix_idx < pix_num; pix_idx++)
 	{
-		Eigen::Vector2d mean_;
-		mean_.setZero();
-		Eigen::Matrix2d covariance_;
-		covariance_.setZero();
-		if (pixels_vel[obj_idx].first.size())
+		dx[pix_idx] = features_cur[pix_idx].x - features_prev[pix_idx].x;
+		dy[pix_idx] = features_cur[pix_idx].y - features_prev[pix_idx].y;
+	}
+	double tx = median_of(dx);
+	double ty = median_of(dy);
+	double sigma = config_.pixel_motion_min_sigma_;
+
+	for (int iter = 0; iter <= config_.pixel_motion_irls_iterations_; iter++)
+	{
+		for (size_t pix_idx = 0; pix_idx < pix_num; pix_idx++)
 		{
-			for (size_t pix_idx = 0; pix_idx < pixels_vel[obj_idx].first.size(); pix_idx++)
-			{
-				mean_[0] += (pixels_vel[obj_idx].second[pix_idx].x - pixels_vel[obj_idx].first[pix_idx].x);
-				mean_[1] += (pixels_vel[obj_idx].second[pix_idx].y - pixels_vel[obj_idx].first[pix_idx].y);
-			}
-			mean_ /= (float)pixels_vel[obj_idx].first.size();
-			for (size_t pix_idx = 0; pix_idx < pixels_vel[obj_idx].first.size(); pix_idx++)
-			{
-				covariance_(0, 0) += pow((pixels_vel[obj_idx].second[pix_idx].x - pixels_vel[obj_idx].first[pix_idx].x - mean_[0]), 2) / pixels_vel[obj_idx].first.size();
-				covariance_(1, 1) += pow((pixels_vel[obj_idx].second[pix_idx].y - pixels_vel[obj_idx].first[pix_idx].y - mean_[1]), 2) / pixels_vel[obj_idx].first.size();
-			}
-			covariances[obj_idx] = covariance_;
-			means[obj_idx] = mean_;
+			residuals[pix_idx] = std::hypot(dx[pix_idx] - tx, dy[pix_idx] - ty);
 		}
+		sigma = std::max(config_.pixel_motion_min_sigma_, 1.4826 * median_of(residuals));
+		if (iter == config_.pixel_motion_irls_iterations_)
+		{
+			break;
+		}
+
+		double huber_k = 1.345 * sigma;
+		double weight_sum = 0.0, sum_x = 0.0, sum_y = 0.0;
+		for (size_t pix_idx = 0; pix_idx < pix_num; pix_idx++)
+		{
+			double weight = residuals[pix_idx] <= huber_k ? 1.0 : huber_k / residuals[pix_idx];
+			weight_sum += weight;
+			sum_x += weight * dx[pix_idx];
+			sum_y += weight * dy[pix_idx];
+		}
+		tx = sum_x / weight_sum;
+		ty = sum_y / weight_sum;
 	}
-	obj_means = means;
-	obj_covariances = covariances;
 
-	Mat img;
-	cv::add(prev_, mask, img);
-	// cv::imshow("obj optical flow", img);
+	for (size_t pix_idx = 0; pix_idx < pix_num; pix_idx++)
+	{
+		inlier_status[pix_idx] = residuals[pix_idx] <= 3.0 * sigma ? 1 : 0;
+	}
+}
 
-	prev_pts_ = tracked_cur_pts;
-	prev_gray_ = cur_gray;
+void fusion_tracker::pixel_motion_moments(
+	const std::vector<cv::Point2f> & features_prev,
+	const std::vector<cv::Point2f> & features_cur,
+	const std::vector<uchar> & inlier_status,
+	Eigen::Vector2d & mean_,
+	Eigen::Matrix2d & covariance_
+)
+{
+	mean_.setZero();
+	covariance_ = kNoPixelMotionVar * Eigen::Matrix2d::Identity();
+	int inlier_num = 0;
+	for (size_t pix_idx = 0; pix_idx < inlier_status.size(); pix_idx++)
+	{
+		if (inlier_status[pix_idx] != 0)
+		{
+			mean_[0] += (features_cur[pix_idx].x - features_prev[pix_idx].x);
+			mean_[1] += (features_cur[pix_idx].y - features_prev[pix_idx].y);
+			inlier_num++;
+		}
+	}
+	if (inlier_num == 0)
+	{
+		return;
+	}
+	mean_ /= (float)inlier_num;
+	// one inlier has no spread, its mean is kept without weight
+	if (inlier_num == 1)
+	{
+		return;
+	}
+	covariance_.setZero();
+	for (size_t pix_idx = 0; pix_idx < inlier_status.size(); pix_idx++)
+	{
+		if (inlier_status[pix_idx] != 0)
+		{
+			covariance_(0, 0) += pow((features_cur[pix_idx].x - features_prev[pix_idx].x - mean_[0]), 2) / inlier_num;
+			covariance_(1, 1) += pow((features_cur[pix_idx].y - features_prev[pix_idx].y - mean_[1]), 2) / inlier_num;
+		}
+	}
 }
 
 void fusion_tracker::points_estimator(
@@ -836,7 +1428,7 @@ void fusion_tracker::points_estimator(
 	const Eigen::Vector3d & estimated_vel,
 	Eigen::Vector3d & fused_vel,
 	Eigen::Matrix3d & fused_vel_cov,
-	Config config_
+	const Config & config_
 )
 {
 	if (
@@ -847,28 +1439,28 @@ void fusion_tracker::points_estimator(
 		return;
 	}
 
-	ceres::Problem vel_problem;
-	ceres::LossFunction* loss_function = new ceres::HuberLoss(1.0);
-
 	Eigen::Vector3d init_vel_points;
 	init_vel_points.setZero();
-	double vel_weight = 1.0;
 
-	Eigen::Vector3d target_centroid = cur_detection.vertex3d_.colwise().mean();
+	Eigen::Vector3d target_centroid = cur_detection.vertex3d().colwise().mean().cast<double>();
     Eigen::Vector3d direction_weight = {1.0, 1.0, 1.0};
 
+	cloudView sampled_cloud;
+	bool sampled = sample_velocity_points(cur_detection.cloud_, config_, sampled_cloud);
+	const cloudView & vel_cloud = sampled ? sampled_cloud : cur_detection.cloud_;
+
 	// get obj motion direction ! (along the longest side of the detection cube)
 	pcl::PointXYZ arrow_start, arrow_end;
 	arrow_start.x = target_centroid[0];
 	arrow_start.y = target_centroid[1];
 	arrow_start.z = target_centroid[2];
 	Eigen::Vector3d cube_side_1, cube_side_2;
-	cube_side_1[0] = cur_detection.vertex3d_(0, 0) - cur_detection.vertex3d_(3, 0);
-	cube_side_1[1] = cur_detection.vertex3d_(0, 1) - cur_detection.vertex3d_(3, 1);
-	cube_side_1[2] = cur_detection.vertex3d_(0, 2) - cur_detection.vertex3d_(3, 2);
-	cube_side_2[0] = cur_detection.vertex3d_(0, 0) - cur_detection.vertex3d_(1, 0);
-	cube_side_2[1] = cur_detection.vertex3d_(0, 1) - cur_detection.vertex3d_(1, 1);
-	cube_side_2[2] = cur_detection.vertex3d_(0, 2) - cur_detection.vertex3d_(1, 2);
+	cube_side_1[0] = cur_detection.vertex3d()(0, 0) - cur_detection.vertex3d()(3, 0);
+	cube_side_1[1] = cur_detection.vertex3d()(0, 1) - cur_detection.vertex3d()(3, 1);
+	cube_side_1[2] = cur_detection.vertex3d()(0, 2) - cur_detection.vertex3d()(3, 2);
+	cube_side_2[0] = cur_detection.vertex3d()(0, 0) - cur_detection.vertex3d()(1, 0);
+	cube_side_2[1] = cur_detection.vertex3d()(0, 1) - cur_detection.vertex3d()(1, 1);
+	cube_side_2[2] = cur_detection.vertex3d()(0, 2) - cur_detection.vertex3d()(1, 2);
 	if (cube_side_1.norm() > cube_side_2.norm())
 	{
 		arrow_end.x = arrow_start.x + cube_side_1[0];
@@ -896,16 +1488,179 @@ void fusion_tracker::points_estimator(
 		optimal_direction = estimated_vel;
 	}
 
-	for (size_t pt_idx = 0; pt_idx < cur_detection.cloud_.size(); pt_idx++)
+	// heading from the compactness of the motion compensated cloud instead
+	// of the cube side, the speed seeds the fine solver
+	bool bev_seeded = false;
+	double bev_speed = 0.0;
+	if (config_.point_vel_direction_ == "bev")
 	{
-		ceres::CostFunction* cost_function;
+		Eigen::Vector2d bev_vel;
+		if (bev_velocity_search(vel_cloud, config_, bev_vel) && 
+			bev_vel.norm() >= config_.bev_search_min_speed_)
+		{
+			optimal_direction = Eigen::Vector3d(bev_vel[0], bev_vel[1], 0.0).normalized();
+			bev_speed = bev_vel.norm();
+			bev_seeded = true;
+		}
+	}
 
-		cost_function = POINT_COST::Create(
-			cur_detection.cloud_.points[pt_idx], 
+	pointVelocityTerms vel_terms;
+	point_velocity_terms(
+		vel_cloud,
+		target_centroid,
+		optimal_direction,
+		direction_weight,
+		vel_terms
+	);
+
+	double vel_weight = 1.0;
+	if (config_.point_vel_solver_ == "ceres" || config_.point_vel_validate_)
+	{
+		ceres_point_velocity(
+			vel_cloud,
+			target_centroid,
+			optimal_direction,
+			direction_weight,
+			vel_weight
+		);
+	}
+	if (config_.point_vel_solver_ != "ceres")
+	{
+		// warm start : the last estimate along the direction, or the ceres start
+		double init_vel = 1.0;
+		if (bev_seeded)
+		{
+			init_vel = bev_speed;
+		}
+		else if (estimated_vel.norm() > 0.0)
+		{
+			init_vel = estimated_vel.dot(optimal_direction) / optimal_direction.squaredNorm();
+		}
+		double ceres_weight = vel_weight;
+		irls_point_velocity(
+			vel_terms,
+			init_vel,
+			config_.point_vel_max_iterations_,
+			vel_weight
+		);
+
+		if (config_.point_vel_validate_ && 
+			std::abs(vel_weight - ceres_weight) > 1e-3 * std::max(1.0, std::abs(ceres_weight)))
+		{
+			cerr << "point velocity irls " << vel_weight 
+				<< " != ceres " << ceres_weight
+				<< " at frame: " << frame_count_ << endl;
+		}
+	}
+	init_vel_points = vel_weight * optimal_direction;
+
+	if (sampled && config_.point_vel_budget_compare_)
+	{
+		// the same fit on every point, for the runtime / error trade off of the budget
+		Timer compare_timer("point budget compare");
+		pointVelocityTerms compare_terms;
+		point_velocity_terms(
+			cur_detection.cloud_,
 			target_centroid,
 			optimal_direction,
 			direction_weight,
-			(float)cur_detection.cloud_.size()
+			compare_terms
+		);
+		double full_weight;
+		irls_point_velocity(
+			compare_terms,
+			vel_weight,
+			config_.point_vel_max_iterations_,
+			full_weight
+		);
+		double full_ms = compare_timer.elapsed(true);
+		// timing only, the sampled fit is the one above
+		point_velocity_terms(
+			vel_cloud,
+			target_centroid,
+			optimal_direction,
+			direction_weight,
+			compare_terms
+		);
+		double sampled_weight;
+		irls_point_velocity(
+			compare_terms,
+			vel_weight,
+			config_.point_vel_max_iterations_,
+			sampled_weight
+		);
+		double sampled_ms = compare_timer.elapsed(true);
+		cout << "point budget " << config_.point_vel_sampling_ << " " 
+			<< vel_cloud.size() << " / " << cur_detection.cloud_.size() << " points : "
+			<< sampled_ms << " / " << full_ms << " ms, speed error "
+			<< std::abs(vel_weight - full_weight) * optimal_direction.norm() 
+			<< " m/s at frame: " << frame_count_ << endl;
+	}
+
+	Eigen::Vector3d points_vel = init_vel_points;
+	Eigen::Matrix3d points_vel_cov;
+	points_vel_cov.setZero();
+	double cov_vel_optimized;
+	if (point_velocity_covariance(vel_terms, vel_weight, cov_vel_optimized))
+	{
+		// residuals are divided by the point count n, so the information is
+		// ~ 1 / n and the variance grows with n. N / n gives the variance of
+		// the full cloud of N points
+		cov_vel_optimized *= static_cast<double>(cur_detection.cloud_.size()) / vel_cloud.size();
+		points_vel_cov(0,0) = abs(cov_vel_optimized) * points_vel[0] * points_vel[0];
+		points_vel_cov(1,1) = abs(cov_vel_optimized) * points_vel[1] * points_vel[1];
+		points_vel_cov(2,2) = abs(cov_vel_optimized) * points_vel[2] * points_vel[2];
+	}
+	else
+	{
+		// the points don't constrain the speed, leave it to the pixel velocity
+		points_vel_cov = config_.point_vel_degenerate_var_ * Eigen::Matrix3d::Identity();
+		cerr << "point velocity degenerate, " << cur_detection.cloud_.size() 
+			<< " points at frame: " << frame_count_ << endl;
+	}
+
+	Eigen::Vector3d fusion_vel;
+	Eigen::Matrix3d fusion_vel_cov;
+	vel_fusion(
+		cur_detection,
+		prev_detection,
+		points_vel,
+		points_vel_cov,
+		pix_vel,
+		pix_vel_cov,
+		fusion_vel,
+		fusion_vel_cov,
+		config_
+	);
+
+	fused_vel = fusion_vel;
+	fused_vel_cov = fusion_vel_cov;
+}
+
+// the POINT_COST problem : one huber (delta 1) residual block of 3 squared
+// axis distances per point, solved by ceres
+void fusion_tracker::ceres_point_velocity(
+	const cloudView & cloud,
+	const Eigen::Vector3d & target_centroid,
+	const Eigen::Vector3d & direction,
+	const Eigen::Vector3d & axis_weight,
+	double & vel_weight
+)
+{
+	ceres::Problem vel_problem;
+	ceres::LossFunction* loss_function = new ceres::HuberLoss(1.0);
+	vel_weight = 1.0;
+
+	for (size_t pt_idx = 0; pt_idx < cloud.size(); pt_idx++)
+	{
+		ceres::CostFunction* cost_function;
+
+		cost_function = POINT_COST::Create(
+			cloud[pt_idx], 
+			target_centroid,
+			direction,
+			axis_weight,
+			(float)cloud.size()
 		); 
 
 		vel_problem.AddResidualBlock(
@@ -918,70 +1673,567 @@ void fusion_tracker::points_estimator(
 	ceres::Solver::Options options;
 	options.max_num_iterations = 50;
 	options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-	options.minimizer_progress_to_stdout = true;
+	options.minimizer_progress_to_stdout = false;
 	options.logging_type = ceres::SILENT;
 
 	ceres::Solver::Summary summary;
-	chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
 	ceres::Solve(options, &vel_problem, &summary);
-	chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
-	chrono::duration<double> time_used = chrono::duration_cast<chrono::duration<double>>(t2 - t1);
-	// std::cout << "solve time cost = " << time_used.count() * 1000.0 << " ms .\n";
-	init_vel_points = vel_weight * optimal_direction;
+}
 
-	ceres::Covariance::Options cov_options;
-	cov_options.algorithm_type = ceres::DENSE_SVD;
-	cov_options.null_space_rank = -1;
-	ceres::Covariance covariance(cov_options);
-	std::vector<std::pair<const double*, const double*> > covariance_blocks; 
-	covariance_blocks.push_back(std::make_pair(&vel_weight, &vel_weight)); 
-	CHECK(covariance.Compute(covariance_blocks, &vel_problem));
-	double cov_vel_optimized;
-	covariance.GetCovarianceBlock(
-		&vel_weight,
-		&vel_weight,
-		&cov_vel_optimized
+// BEV cells occupied by the cloud moved back by vel * t. stamps / stamp
+// mark the cells of this hypothesis without clearing the grid.
+static int occupiedCells(
+	const Eigen::ArrayXf & xs,
+	const Eigen::ArrayXf & ys,
+	const Eigen::ArrayXf & ts,
+	const Eigen::Vector2f & vel,
+	const Eigen::Vector2f & origin,
+	float inv_cell,
+	int grid_cols,
+	int grid_rows,
+	std::vector<int> & stamps,
+	int stamp
+)
+{
+	Eigen::ArrayXi cols = ((xs - vel[0] * ts - origin[0]) * inv_cell).floor().cast<int>();
+	Eigen::ArrayXi rows = ((ys - vel[1] * ts - origin[1]) * inv_cell).floor().cast<int>();
+	cols = cols.max(0).min(grid_cols - 1);
+	rows = rows.max(0).min(grid_rows - 1);
+	int cells = 0;
+	for (int pt_idx = 0; pt_idx < cols.size(); pt_idx++)
+	{
+		int & cell_stamp = stamps[rows[pt_idx] * grid_cols + cols[pt_idx]];
+		if (cell_stamp != stamp)
+		{
+			cell_stamp = stamp;
+			cells++;
+		}
+	}
+	return cells;
+}
+
+// coarse to fine search over (vx, vy) : the hypothesis which leaves the
+// fewest occupied BEV cells after moving every point back by vel * t. Ties
+// go to the slower hypothesis, a static cloud doesn't pick a speed. false
+// if the points carry no time spread.
+bool fusion_tracker::bev_velocity_search(
+	const cloudView & cloud,
+	const Config & config_,
+	Eigen::Vector2d & best_vel
+)
+{
+	best_vel.setZero();
+	int pt_num = cloud.size();
+	if (pt_num < 2)
+	{
+		return false;
+	}
+	Eigen::ArrayXf xs(pt_num), ys(pt_num), ts(pt_num);
+	for (int pt_idx = 0; pt_idx < pt_num; pt_idx++)
+	{
+		xs[pt_idx] = cloud[pt_idx].x;
+		ys[pt_idx] = cloud[pt_idx].y;
+		ts[pt_idx] = cloud[pt_idx].intensity;
+	}
+	// times around the middle of the scan keep the moved cloud centered
+	float t_mid = 0.5f * (ts.minCoeff() + ts.maxCoeff());
+	ts -= t_mid;
+	float t_half = ts.abs().maxCoeff();
+	if (t_half <= 0.0f)
+	{
+		return false;
+	}
+
+	float max_speed = config_.bev_search_max_speed_;
+	float cell = config_.bev_search_cell_;
+	float margin = max_speed * t_half + cell;
+	Eigen::Vector2f origin(xs.minCoeff() - margin, ys.minCoeff() - margin);
+
+	Eigen::Vector2f center(0.0f, 0.0f);
+	float step = config_.bev_search_coarse_step_;
+	int half_span = std::max(1, static_cast<int>(std::ceil(max_speed / step)));
+	for (int level = 0; level < config_.bev_search_levels_; level++)
+	{
+		float inv_cell = 1.0f / cell;
+		int grid_cols = static_cast<int>((xs.maxCoeff() + margin - origin[0]) * inv_cell) + 1;
+		int grid_rows = static_cast<int>((ys.maxCoeff() + margin - origin[1]) * inv_cell) + 1;
+
+		std::vector<Eigen::Vector2f> hypotheses;
+		for (int iy = -half_span; iy <= half_span; iy++)
+		{
+			for (int ix = -half_span; ix <= half_span; ix++)
+			{
+				Eigen::Vector2f vel = center + step * Eigen::Vector2f(ix, iy);
+				if (vel.norm() <= max_speed + step)
+				{
+					hypotheses.push_back(vel);
+				}
+			}
+		}
+
+		// hypotheses are independent, every score is written by one worker
+		std::vector<int> scores(hypotheses.size());
+		cv::parallel_for_(cv::Range(0, hypotheses.size()), [&](const cv::Range & range)
+		{
+			std::vector<int> stamps(grid_cols * grid_rows, -1);
+			for (int hyp_idx = range.start; hyp_idx < range.end; hyp_idx++)
+			{
+				scores[hyp_idx] = occupiedCells(
+					xs, ys, ts, hypotheses[hyp_idx], origin, inv_cell, 
+					grid_cols, grid_rows, stamps, hyp_idx
+				);
+			}
+		}, cv::getNumThreads());
+
+		size_t best_idx = 0;
+		for (size_t hyp_idx = 1; hyp_idx < hypotheses.size(); hyp_idx++)
+		{
+			if (scores[hyp_idx] < scores[best_idx] || 
+				(scores[hyp_idx] == scores[best_idx] && 
+				hypotheses[hyp_idx].squaredNorm() < hypotheses[best_idx].squaredNorm()))
+			{
+				best_idx = hyp_idx;
+			}
+		}
+		center = hypotheses[best_idx];
+
+		// the next level covers the neighbouring hypotheses of this one at
+		// half the step, the cell shrinks with the displacement it resolves
+		half_span = 2;
+		step *= 0.5f;
+		cell = std::max<float>(config_.bev_search_min_cell_, 0.5f * cell);
+	}
+	best_vel = center.cast<double>();
+	return true;
+}
+
+// per object point budget of the velocity fit. "time" keeps one point per
+// equal-count slice of the scan time (intensity), which keeps the time
+// spread that drives the fit. "voxel" keeps one point per voxel and then
+// time-slices what is left. false if the cloud is within the budget.
+bool fusion_tracker::sample_velocity_points(
+	const cloudView & cloud,
+	const Config & config_,
+	cloudView & sampled_cloud
+)
+{
+	size_t budget = config_.point_vel_budget_;
+	if (budget == 0 || cloud.size() <= budget)
+	{
+		return false;
+	}
+
+	std::vector<int> candidates;
+	candidates.reserve(cloud.size());
+	if (config_.point_vel_sampling_ == "voxel")
+	{
+		double inv_leaf = 1.0 / config_.point_vel_voxel_size_;
+		std::unordered_set<int64_t> occupied;
+		occupied.reserve(cloud.size());
+		for (size_t pt_idx = 0; pt_idx < cloud.size(); pt_idx++)
+		{
+			const pcl::PointXYZI & pt = cloud[pt_idx];
+			int64_t vx = static_cast<int64_t>(std::floor(pt.x * inv_leaf)) & 0x1FFFFF;
+			int64_t vy = static_cast<int64_t>(std::floor(pt.y * inv_leaf)) & 0x1FFFFF;
+			int64_t vz = static_cast<int64_t>(std::floor(pt.z * inv_leaf)) & 0x1FFFFF;
+			if (occupied.insert((vx << 42) | (vy << 21) | vz).second)
+			{
+				candidates.push_back(pt_idx);
+			}
+		}
+	}
+	else
+	{
+		for (size_t pt_idx = 0; pt_idx < cloud.size(); pt_idx++)
+		{
+			candidates.push_back(pt_idx);
+		}
+	}
+
+	std::stable_sort(candidates.begin(), candidates.end(), [&](int lhs, int rhs)
+	{
+		return cloud[lhs].intensity < cloud[rhs].intensity;
+	});
+	size_t sample_num = std::min(budget, candidates.size());
+	std::shared_ptr<pcl::PointCloud<pcl::PointXYZI>> samples(new pcl::PointCloud<pcl::PointXYZI>);
+	samples->reserve(sample_num);
+	for (size_t slice = 0; slice < sample_num; slice++)
+	{
+		// middle of the slice, the first and last slices keep the ends of the scan
+		size_t begin = slice * candidates.size() / sample_num;
+		size_t end = (slice + 1) * candidates.size() / sample_num;
+		samples->push_back(cloud[candidates[(begin + end) / 2]]);
+	}
+	sampled_cloud = cloudView(samples);
+	return true;
+}
+
+// per point terms of the POINT_COST objective : with e_k = a_k - v * b_k the
+// residuals are r_k = w_k * e_k^2 / N. axis 1 : motion direction, axis 2 : z,
+// axis 3 : z x direction, which doesn't depend on v.
+void fusion_tracker::point_velocity_terms(
+	const cloudView & cloud,
+	const Eigen::Vector3d & target_centroid,
+	const Eigen::Vector3d & direction,
+	const Eigen::Vector3d & axis_weight,
+	pointVelocityTerms & terms
+)
+{
+	int pt_num = cloud.size();
+	terms.a1_.resize(pt_num);
+	terms.b1_.resize(pt_num);
+	terms.a2_.resize(pt_num);
+	terms.b2_.resize(pt_num);
+	terms.r3_sq_.resize(pt_num);
+	terms.w1_ = pt_num > 0 ? axis_weight[0] / pt_num : 0.0;
+	terms.w2_ = pt_num > 0 ? axis_weight[1] / pt_num : 0.0;
+	if (pt_num == 0 || direction.norm() == 0.0)
+	{
+		terms.a1_.resize(0);
+		terms.b1_.resize(0);
+		terms.a2_.resize(0);
+		terms.b2_.resize(0);
+		terms.r3_sq_.resize(0);
+		return;
+	}
+
+	Eigen::Vector3d axis1 = direction.normalized();
+	Eigen::Vector3d axis2(0.0, 0.0, 1.0);
+	Eigen::Vector3d axis3 = axis2.cross(direction);
+	if (axis3.norm() > 0.0)
+	{
+		axis3.normalize();
+	}
+	for (int pt_idx = 0; pt_idx < pt_num; pt_idx++)
+	{
+		const pcl::PointXYZI & pt = cloud[pt_idx];
+		Eigen::Vector3d offset(
+			pt.x - target_centroid[0],
+			pt.y - target_centroid[1],
+			pt.z - target_centroid[2]
+		);
+		terms.a1_[pt_idx] = axis1.dot(offset);
+		terms.b1_[pt_idx] = direction.norm() * pt.intensity;
+		terms.a2_[pt_idx] = offset[2];
+		terms.b2_[pt_idx] = direction[2] * pt.intensity;
+		double dst3 = axis3.dot(offset);
+		double r3 = axis_weight[2] * dst3 * dst3 / pt_num;
+		terms.r3_sq_[pt_idx] = r3 * r3;
+	}
+}
+
+// same objective as ceres_point_velocity without a problem per object :
+// newton steps on the huber IRLS weighted problem over the float arrays of
+// the terms. The objective is convex in v, so this is the ceres minimum.
+void fusion_tracker::irls_point_velocity(
+	const pointVelocityTerms & terms,
+	double init_vel,
+	int max_iterations,
+	double & vel_weight
+)
+{
+	int pt_num = terms.a1_.size();
+	vel_weight = init_vel;
+	if (pt_num == 0)
+	{
+		return;
+	}
+	const Eigen::ArrayXf & a1 = terms.a1_;
+	const Eigen::ArrayXf & b1 = terms.b1_;
+	const Eigen::ArrayXf & a2 = terms.a2_;
+	const Eigen::ArrayXf & b2 = terms.b2_;
+	float w1 = terms.w1_;
+	float w2 = terms.w2_;
+
+	// steps leaving the bracket of the minimum (gradient sign change) are
+	// replaced by bisection. Only gradients are compared, float can't
+	// resolve cost differences this small.
+	float v = init_vel;
+	float bracket_lo = -std::numeric_limits<float>::infinity();
+	float bracket_hi = std::numeric_limits<float>::infinity();
+	for (int iter = 0; iter < max_iterations; iter++)
+	{
+		Eigen::ArrayXf e1 = a1 - v * b1;
+		Eigen::ArrayXf e2 = a2 - v * b2;
+		Eigen::ArrayXf r1 = w1 * e1.square();
+		Eigen::ArrayXf r2 = w2 * e2.square();
+		Eigen::ArrayXf j1 = -2.0f * w1 * e1 * b1;
+		Eigen::ArrayXf j2 = -2.0f * w2 * e2 * b2;
+		Eigen::ArrayXf sq = r1.square() + r2.square() + terms.r3_sq_;
+		Eigen::ArrayXf huber_weight = (sq <= 1.0f).select(Eigen::ArrayXf::Ones(pt_num), sq.sqrt().inverse());
+
+		// newton on the IRLS weighted problem, r'' = 2 * w * b^2
+		float gradient = (huber_weight * (j1 * r1 + j2 * r2)).sum();
+		float hessian = (huber_weight * (
+			j1.square() + j2.square() + 
+			2.0f * (w1 * r1 * b1.square() + w2 * r2 * b2.square())
+		)).sum();
+		if (hessian <= 0.0f || gradient == 0.0f)
+		{
+			break;
+		}
+		float step = -gradient / hessian;
+		if (std::abs(step) <= 1e-6f * std::max(1.0f, std::abs(v)))
+		{
+			v += step;
+			break;
+		}
+		if (gradient > 0.0f)
+		{
+			bracket_hi = v;
+		}
+		else
+		{
+			bracket_lo = v;
+		}
+		float next_v = v + step;
+		if (!(next_v > bracket_lo && next_v < bracket_hi) && 
+			std::isfinite(bracket_lo) && std::isfinite(bracket_hi))
+		{
+			next_v = 0.5f * (bracket_lo + bracket_hi);
+		}
+		v = next_v;
+	}
+	vel_weight = v;
+}
+
+// variance of v : inverse of the gauss newton information J^T W J with the
+// huber IRLS weights at v, one more pass over the terms. false if the
+// points don't constrain v (no points, no time spread, motion along z x d).
+bool fusion_tracker::point_velocity_covariance(
+	const pointVelocityTerms & terms,
+	double vel_weight,
+	double & vel_cov
+)
+{
+	vel_cov = 0.0;
+	int pt_num = terms.a1_.size();
+	if (pt_num == 0)
+	{
+		return false;
+	}
+	float v = vel_weight;
+	Eigen::ArrayXf e1 = terms.a1_ - v * terms.b1_;
+	Eigen::ArrayXf e2 = terms.a2_ - v * terms.b2_;
+	Eigen::ArrayXf j1 = -2.0f * terms.w1_ * e1 * terms.b1_;
+	Eigen::ArrayXf j2 = -2.0f * terms.w2_ * e2 * terms.b2_;
+	Eigen::ArrayXf sq = 
+		(terms.w1_ * e1.square()).square() + 
+		(terms.w2_ * e2.square()).square() + 
+		terms.r3_sq_;
+	Eigen::ArrayXf huber_weight = (sq <= 1.0f).select(Eigen::ArrayXf::Ones(pt_num), sq.sqrt().inverse());
+	double information = (huber_weight * (j1.square() + j2.square())).cast<double>().sum();
+
+	if (!std::isfinite(information) || information <= 1e-12)
+	{
+		return false;
+	}
+	vel_cov = 1.0 / information;
+	return std::isfinite(vel_cov);
+}
+
+// adds the frame velocity and box center to the track window and replaces
+// them with the window solution at the frame time. Centers and velocities
+// are kept in the global frame, global = pose^-1 * local. The frame
+// estimate is kept while the window doesn't constrain the velocity.
+// A frame stays in the window for K solves and the kf takes every solve as
+// a new measurement, so the window covariance is inflated by the K frames
+// it holds : each frame enters the kf about once, not K times.
+bool fusion_tracker::window_estimator(
+	kfTracker & trk,
+	const alignedDet & cur_detection,
+	const Config & config_,
+	Eigen::Vector3d & vel,
+	Eigen::Matrix3d & vel_cov
+)
+{
+	trk.velocity_window_.configure(
+		config_.velocity_window_size_,
+		config_.velocity_window_acceleration_,
+		config_.velocity_window_position_var_,
+		config_.velocity_window_epoch_
 	);
 
-	Eigen::Vector3d points_vel = init_vel_points;
-	Eigen::Matrix3d points_vel_cov;
-	points_vel_cov.setZero();
-	points_vel_cov(0,0) = abs(cov_vel_optimized) * points_vel[0] * points_vel[0];
-	points_vel_cov(1,1) = abs(cov_vel_optimized) * points_vel[1] * points_vel[1];
-	points_vel_cov(2,2) = abs(cov_vel_optimized) * points_vel[2] * points_vel[2];
+	const Eigen::Matrix4d & local_to_global = PoseTable::global().inverse(cur_detection.pose_idx_);
+	Eigen::Matrix3d rotation = local_to_global.block<3, 3>(0, 0);
+	Eigen::Vector3d center = cur_detection.vertex3d().colwise().mean().cast<double>();
+
+	windowFrame frame;
+	frame.time_stamp_ = cur_detection.time_stamp_;
+	frame.center_ = rotation * center + local_to_global.block<3, 1>(0, 3);
+	frame.vel_ = rotation * vel;
+	frame.vel_cov_ = rotation * vel_cov * rotation.transpose();
+	trk.velocity_window_.add(frame);
+
+	Eigen::Vector3d window_vel;
+	Eigen::Matrix3d window_vel_cov;
+	if (!trk.velocity_window_.solve(cur_detection.time_stamp_, window_vel, window_vel_cov))
+	{
+		return false;
+	}
+	vel = rotation.transpose() * window_vel;
+	vel_cov = static_cast<double>(trk.velocity_window_.size()) * 
+		rotation.transpose() * window_vel_cov * rotation;
+	return true;
+}
+
+// velocity from the translation which registers the motion compensated
+// object cloud onto the cached cloud of the last frame, fused with the pixel
+// velocity like the points fit. The query points are moved into the frame
+// of the last cloud so the ego motion doesn't count as object motion.
+// false if the track has no cached cloud or the registration has too few
+// correspondences.
+bool fusion_tracker::registration_estimator(
+	const kfTracker & trk,
+	const alignedDet & cur_detection,
+	const Eigen::Vector2d & pix_vel,
+	const Eigen::Matrix2d & pix_vel_cov,
+	Eigen::Vector3d & fused_vel,
+	Eigen::Matrix3d & fused_vel_cov,
+	const Config & config_
+)
+{
+	const alignedDet & prev_detection = trk.detection_cur_;
+	if (!trk.registration_tree_ || !trk.registration_cloud_ || 
+		trk.registration_cloud_->size() < config_.registration_min_points_ ||
+		cur_detection.cloud_.size() < config_.registration_min_points_)
+	{
+		return false;
+	}
+	double dt = 0.1;
+	if (cur_detection.time_stamp_ > prev_detection.time_stamp_ && prev_detection.time_stamp_ > 0)
+	{
+		dt = (cur_detection.time_stamp_ - prev_detection.time_stamp_) / 1e9;
+	}
+
+	cloudView sampled_cloud;
+	bool sampled = sample_velocity_points(cur_detection.cloud_, config_, sampled_cloud);
+	const cloudView & query_cloud = sampled ? sampled_cloud : cur_detection.cloud_;
+
+	// current frame -> frame of the cached cloud, global = pose^-1 * local
+	Eigen::Matrix4d prev_from_cur = 
+		PoseTable::global().pose(prev_detection.pose_idx_) * PoseTable::global().inverse(cur_detection.pose_idx_);
+	pcl::PointCloud<pcl::PointXYZ> source;
+	motionCompensate(query_cloud, trk.estimated_vel_, source);
+	pcl::transformPointCloud(source, source, prev_from_cur.cast<float>());
+
+	Eigen::Vector3d translation = prev_from_cur.block<3, 3>(0, 0) * trk.estimated_vel_ * dt;
+	double residual_var;
+	int inlier_num;
+	if (!register_translation(
+		source,
+		*trk.registration_tree_,
+		*trk.registration_cloud_,
+		config_,
+		translation,
+		residual_var,
+		inlier_num
+	))
+	{
+		return false;
+	}
+
+	// back to the current frame
+	Eigen::Matrix3d cur_from_prev = prev_from_cur.block<3, 3>(0, 0).transpose();
+	Eigen::Vector3d registration_vel = cur_from_prev * translation / dt;
+	// mean of inlier_num offsets, per axis
+	Eigen::Matrix3d registration_vel_cov = 
+		std::max(residual_var / inlier_num, 1e-6) / (dt * dt) * Eigen::Matrix3d::Identity();
 
-	Eigen::Vector3d fusion_vel;
-	Eigen::Matrix3d fusion_vel_cov;
 	vel_fusion(
 		cur_detection,
 		prev_detection,
-		points_vel,
-		points_vel_cov,
+		registration_vel,
+		registration_vel_cov,
 		pix_vel,
 		pix_vel_cov,
-		fusion_vel,
-		fusion_vel_cov,
+		fused_vel,
+		fused_vel_cov,
 		config_
 	);
+	return true;
+}
 
-	fused_vel = fusion_vel;
-	fused_vel_cov = fusion_vel_cov;
+// translation only point to point ICP : source + translation onto target.
+// Pairs farther than registration_max_distance are rejected, stops at
+// registration_max_iterations or when the update drops below
+// registration_epsilon. residual_var : per axis variance of the inlier
+// offsets at the solution.
+bool fusion_tracker::register_translation(
+	const pcl::PointCloud<pcl::PointXYZ> & source,
+	const pcl::KdTreeFLANN<pcl::PointXYZ> & target_tree,
+	const pcl::PointCloud<pcl::PointXYZ> & target,
+	const Config & config_,
+	Eigen::Vector3d & translation,
+	double & residual_var,
+	int & inlier_num
+)
+{
+	double max_dist2 = config_.registration_max_distance_ * config_.registration_max_distance_;
+	std::vector<int> nn_idx(1);
+	std::vector<float> nn_dist2(1);
+	residual_var = 0.0;
+	inlier_num = 0;
+	for (int iter = 0; iter < config_.registration_max_iterations_; iter++)
+	{
+		// every pair contributes target - source, the mean is the new translation
+		Eigen::Vector3d offset_sum(0.0, 0.0, 0.0);
+		double offset_sq_sum = 0.0;
+		int pair_num = 0;
+		for (size_t pt_idx = 0; pt_idx < source.size(); pt_idx++)
+		{
+			// source is the current cloud : it sits at target + translation
+			pcl::PointXYZ query;
+			query.x = source.points[pt_idx].x - translation[0];
+			query.y = source.points[pt_idx].y - translation[1];
+			query.z = source.points[pt_idx].z - translation[2];
+			if (target_tree.nearestKSearch(query, 1, nn_idx, nn_dist2) < 1 || 
+				nn_dist2[0] > max_dist2)
+			{
+				continue;
+			}
+			const pcl::PointXYZ & nn = target.points[nn_idx[0]];
+			Eigen::Vector3d offset(
+				source.points[pt_idx].x - nn.x,
+				source.points[pt_idx].y - nn.y,
+				source.points[pt_idx].z - nn.z
+			);
+			offset_sum += offset;
+			offset_sq_sum += offset.squaredNorm();
+			pair_num++;
+		}
+		if (pair_num < static_cast<int>(config_.registration_min_points_))
+		{
+			return false;
+		}
+		Eigen::Vector3d next_translation = offset_sum / pair_num;
+		double update = (next_translation - translation).norm();
+		translation = next_translation;
+		residual_var = std::max(0.0, 
+			(offset_sq_sum / pair_num - translation.squaredNorm()) / 3.0);
+		inlier_num = pair_num;
+		if (update < config_.registration_epsilon_)
+		{
+			break;
+		}
+	}
+	return inlier_num > 0;
 }
 
 void fusion_tracker::vel_fusion(
-	const alignedDet cur_detection,
-	const alignedDet prev_detection,
-	const Eigen::Vector3d points_vel,
-	const Eigen::Matrix3d points_vel_cov,
-	const Eigen::Vector2d pix_vel,
-	const Eigen::Matrix2d pix_vel_cov,
+	const alignedDet & cur_detection,
+	const alignedDet & prev_detection,
+	const Eigen::Vector3d & points_vel,
+	const Eigen::Matrix3d & points_vel_cov,
+	const Eigen::Vector2d & pix_vel,
+	const Eigen::Matrix2d & pix_vel_cov,
 	Eigen::Vector3d & fusion_vel,
 	Eigen::Matrix3d & fusion_vel_cov,
-	Config config_
+	const Config & config_
 )
 {
-	Eigen::Vector3d cur_centroid = cur_detection.vertex3d_.colwise().mean().cast<double>();
-	Eigen::Vector3d prev_centroid = prev_detection.vertex3d_.colwise().mean().cast<double>();
+	Eigen::Vector3d cur_centroid = cur_detection.vertex3d().colwise().mean().cast<double>();
+	Eigen::Vector3d prev_centroid = prev_detection.vertex3d().colwise().mean().cast<double>();
 
 	Eigen::Vector4d cur_centroid_global(
 		cur_centroid[0],
@@ -995,8 +2247,8 @@ void fusion_tracker::vel_fusion(
 		prev_centroid[2],
 		1.0
 	);
-	cur_centroid_global = cur_detection.global_pose_.inverse() * cur_centroid_global;
-	prev_centroid_global = prev_detection.global_pose_.inverse() * prev_centroid_global;
+	cur_centroid_global = PoseTable::global().inverse(cur_detection.pose_idx_) * cur_centroid_global;
+	prev_centroid_global = PoseTable::global().inverse(prev_detection.pose_idx_) * prev_centroid_global;
 
 	Eigen::Vector3d pix_vel_3d;
 	double width_u, height_v;
@@ -1009,7 +2261,7 @@ void fusion_tracker::vel_fusion(
 	pix_moved[1] = -(width_u - config_.camera_intrinsic_(0, 2)) * pix_moved[0] / config_.camera_intrinsic_(0, 0);
 	pix_moved[2] = -(height_v - config_.camera_intrinsic_(1, 2)) * pix_moved[0] / config_.camera_intrinsic_(1, 1);
 	pix_moved[3] = 1.0;
-	pix_moved = cur_detection.global_pose_.inverse() * pix_moved;
+	pix_moved = PoseTable::global().inverse(cur_detection.pose_idx_) * pix_moved;
 	pix_vel_3d = (pix_moved - prev_centroid_global).segment(0, 3) * 10.0;
 
 
@@ -1055,44 +2307,36 @@ void fusion_tracker::vel_fusion(
 }
 
 void cloud_undistortion(
-    const alignedDet detection_in,
-    const Eigen::Vector3d vel_,
+    const alignedDet & detection_in,
+    const Eigen::Vector3d & vel_,
+	slotId track_id,
 	pcl::PointCloud<pcl::PointXYZRGB>::Ptr clouds_buffer,
 	visualization_msgs::Marker & arrow_buffer,
 	visualization_msgs::MarkerArray & txt_buffer
 )
 {
-	Eigen::Vector3d target_centroid = detection_in.vertex3d_.colwise().mean();
-	int rand_r = (rand() % 155) + 100;
-	int rand_g = (rand() % 155) + 100;
-	int rand_b = (rand() % 155) + 100;
-
-	pcl::PointCloud<pcl::PointXYZRGB> cur_cloud_rgb;
-	pcl::copyPointCloud(detection_in.cloud_, cur_cloud_rgb);
-	for (size_t pt_idx = 0; pt_idx < cur_cloud_rgb.size(); pt_idx++)
-	{
-		cur_cloud_rgb.points[pt_idx].r = rand_r;
-		cur_cloud_rgb.points[pt_idx].g = rand_g;
-		cur_cloud_rgb.points[pt_idx].b = rand_b;
-	}
+	Eigen::Vector3d target_centroid = detection_in.vertex3d().colwise().mean().cast<double>();
+	// same color for a track in every frame and on every thread, a track
+	// which reuses the slot of a retired one gets another color
+	unsigned int color_seed = static_cast<unsigned int>((track_id * 0x9e3779b97f4a7c15ull) >> 32);
+	int rand_r = (color_seed % 155) + 100;
+	int rand_g = ((color_seed >> 8) % 155) + 100;
+	int rand_b = ((color_seed >> 16) % 155) + 100;
 
 	Eigen::Vector3d undistort_vel = vel_;
-	pcl::PointCloud<pcl::PointXYZRGB> prev_cloud_rgb;
+	clouds_buffer->reserve(clouds_buffer->size() + detection_in.cloud_.size());
 	for (size_t pt_idx = 0; pt_idx < detection_in.cloud_.size(); pt_idx++)
 	{
+		const pcl::PointXYZI & pt = detection_in.cloud_[pt_idx];
 		pcl::PointXYZRGB pt_temp;
-		pt_temp.x = 
-			detection_in.cloud_.points[pt_idx].x - undistort_vel[0] * detection_in.cloud_.points[pt_idx].intensity;
-		pt_temp.y = 
-			detection_in.cloud_.points[pt_idx].y - undistort_vel[1] * detection_in.cloud_.points[pt_idx].intensity;
-		pt_temp.z = 
-			detection_in.cloud_.points[pt_idx].z - undistort_vel[2] * detection_in.cloud_.points[pt_idx].intensity;
+		pt_temp.x = pt.x - undistort_vel[0] * pt.intensity;
+		pt_temp.y = pt.y - undistort_vel[1] * pt.intensity;
+		pt_temp.z = pt.z - undistort_vel[2] * pt.intensity;
 		pt_temp.r = rand_r;
 		pt_temp.g = rand_g;
 		pt_temp.b = rand_b;
-		prev_cloud_rgb.push_back(pt_temp);
+		clouds_buffer->push_back(pt_temp);
 	}
-	(*clouds_buffer) += prev_cloud_rgb;
 
 	pcl::PointXYZ arrow_start, optimal_vel_arrow;
 	arrow_start.x = target_centroid[0];
@@ -1116,7 +2360,8 @@ void cloud_undistortion(
 	visualization_msgs::Marker obj_vel_txt;
 	obj_vel_txt.header.frame_id = "livox";
 	obj_vel_txt.ns = "obj_vel_txt";
-	obj_vel_txt.id = rand() % 1000;
+	// the marker of a retired track is taken over by the next track in its slot
+	obj_vel_txt.id = SlotMap<kfTracker>::slotOf(track_id);
 	obj_vel_txt.lifetime = ros::Duration(0);
 	obj_vel_txt.action = visualization_msgs::Marker::ADD;
 	obj_vel_txt.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
@@ -0,0 +1,392 @@
+// association_benchmark.cpp
+// Synthetic crowded scenes for Frame::detection_align and
+// fusion_tracker::associate, timed per stage against the object count.
+//
+// usage : association_benchmark [frames] [density] [max_speed] [clutter] [miss_rate] [max_objects]
+//   density   : objects per 1000 m^2
+//   max_speed : m/s, every object gets a random speed in [0, max_speed]
+//   clutter   : false 3d detections per true object and frame
+//   miss_rate : probability an object is not detected in a frame
+
+#include <algorithm>
+#include <random>
+#include <cstdio>
+
+#include "tracker/tracker.h"
+
+struct syntheticObject
+{
+    Eigen::Vector3d center_;
+    Eigen::Vector3d size_;
+    double yaw_;
+    Eigen::Vector3d vel_;
+};
+
+struct stageTimes
+{
+    double align_[4];
+    double track_[4];
+    double iou_evaluations_;
+    double tracks_;
+    double repaired_rows_;
+    int frames_;
+
+    stageTimes()
+    {
+        std::fill(align_, align_ + 4, 0.0);
+        std::fill(track_, track_ + 4, 0.0);
+        iou_evaluations_ = 0.0;
+        tracks_ = 0.0;
+        repaired_rows_ = 0.0;
+        frames_ = 0;
+    }
+    double align_total() const { return align_[0] + align_[1] + align_[2] + align_[3]; }
+    double track_total() const { return track_[0] + track_[1] + track_[2] + track_[3]; }
+};
+
+class associationBenchmark
+{
+private:
+    Config config_;
+    std::mt19937 rng_;
+
+    int frames_ = 10;
+    double density_ = 20.0;
+    double max_speed_ = 15.0;
+    double clutter_ = 0.1;
+    double miss_rate_ = 0.05;
+    int max_objects_ = 2000;
+    int cloud_size_ = 200;
+
+public:
+    associationBenchmark(int argc, char** argv);
+    ~associationBenchmark();
+
+    bool run();
+
+private:
+    void spawn_scene(int obj_num, std::vector<syntheticObject> & objects);
+    syntheticObject random_object(double scene_len);
+    Eigen::Matrix<double, 8, 3> object_vertexs(const syntheticObject & obj);
+    void detect_scene(
+        const std::vector<syntheticObject> & objects,
+        double scene_len,
+        Frame & frame,
+        frameCubes & cubes,
+        frameBboxs & bboxs,
+        std::vector<pcl::PointCloud<pcl::PointXYZI>> & obj_clouds
+    );
+    stageTimes run_scale(int obj_num);
+};
+
+associationBenchmark::associationBenchmark(int argc, char** argv)
+{
+    if (argc > 1) frames_ = std::max(2, std::atoi(argv[1]));
+    if (argc > 2) density_ = std::atof(argv[2]);
+    if (argc > 3) max_speed_ = std::atof(argv[3]);
+    if (argc > 4) clutter_ = std::atof(argv[4]);
+    if (argc > 5) miss_rate_ = std::atof(argv[5]);
+    if (argc > 6) max_objects_ = std::atoi(argv[6]);
+    rng_.seed(42);
+}
+
+associationBenchmark::~associationBenchmark() {}
+
+syntheticObject associationBenchmark::random_object(double scene_len)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    syntheticObject obj;
+    // in front of the lidar, x is the depth axis
+    obj.center_ = Eigen::Vector3d(
+        5.0 + scene_len * unit(rng_),
+        scene_len * (unit(rng_) - 0.5),
+        -1.0
+    );
+    obj.size_ = Eigen::Vector3d(
+        3.5 + 2.0 * unit(rng_),
+        1.6 + 0.4 * unit(rng_),
+        1.4 + 0.4 * unit(rng_)
+    );
+    obj.yaw_ = 2.0 * M_PI * unit(rng_);
+    double speed = max_speed_ * unit(rng_);
+    obj.vel_ = Eigen::Vector3d(speed * cos(obj.yaw_), speed * sin(obj.yaw_), 0.0);
+    return obj;
+}
+
+void associationBenchmark::spawn_scene(
+    int obj_num,
+    std::vector<syntheticObject> & objects
+)
+{
+    double scene_len = std::sqrt(obj_num * 1000.0 / density_);
+    objects.clear();
+    for (int obj_idx = 0; obj_idx < obj_num; obj_idx++)
+    {
+        objects.push_back(random_object(scene_len));
+    }
+}
+
+// vertex order of the detection files : 0-3 bottom face, 4-7 above 0-3
+Eigen::Matrix<double, 8, 3> associationBenchmark::object_vertexs(
+    const syntheticObject & obj
+)
+{
+    double corners[4][2] = {
+        { 0.5 * obj.size_[0],  0.5 * obj.size_[1]},
+        { 0.5 * obj.size_[0], -0.5 * obj.size_[1]},
+        {-0.5 * obj.size_[0], -0.5 * obj.size_[1]},
+        {-0.5 * obj.size_[0],  0.5 * obj.size_[1]}
+    };
+    Eigen::Matrix<double, 8, 3> vertexs;
+    for (size_t corner_idx = 0; corner_idx < 4; corner_idx++)
+    {
+        double x = obj.center_[0]
+            + cos(obj.yaw_) * corners[corner_idx][0] - sin(obj.yaw_) * corners[corner_idx][1];
+        double y = obj.center_[1]
+            + sin(obj.yaw_) * corners[corner_idx][0] + cos(obj.yaw_) * corners[corner_idx][1];
+        vertexs.row(corner_idx) << x, y, obj.center_[2] - 0.5 * obj.size_[2];
+        vertexs.row(corner_idx + 4) << x, y, obj.center_[2] + 0.5 * obj.size_[2];
+    }
+    return vertexs;
+}
+
+void associationBenchmark::detect_scene(
+    const std::vector<syntheticObject> & objects,
+    double scene_len,
+    Frame & frame,
+    frameCubes & cubes,
+    frameBboxs & bboxs,
+    std::vector<pcl::PointCloud<pcl::PointXYZI>> & obj_clouds
+)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, 1.0);
+
+    std::vector<syntheticObject> detected;
+    for (size_t obj_idx = 0; obj_idx < objects.size(); obj_idx++)
+    {
+        if (unit(rng_) < miss_rate_)
+        {
+            continue;
+        }
+        syntheticObject obj = objects[obj_idx];
+        obj.center_ += 0.1 * Eigen::Vector3d(noise(rng_), noise(rng_), 0.0);
+        obj.yaw_ += 0.02 * noise(rng_);
+        detected.push_back(obj);
+    }
+    int clutter_num = clutter_ * objects.size();
+    for (int clutter_idx = 0; clutter_idx < clutter_num; clutter_idx++)
+    {
+        detected.push_back(random_object(scene_len));
+    }
+    std::shuffle(detected.begin(), detected.end(), rng_);
+
+    cubes.clear();
+    bboxs.clear();
+    obj_clouds.clear();
+    for (size_t obj_idx = 0; obj_idx < detected.size(); obj_idx++)
+    {
+        cube3d cube("car", 0.5 + 0.5 * unit(rng_), object_vertexs(detected[obj_idx]));
+        cubes.push_back(cube);
+
+        cv::Rect rect;
+        frame.detection3dProj2d(&cube, &rect);
+        rect.x += 2.0 * noise(rng_);
+        rect.y += 2.0 * noise(rng_);
+        // obBBOX keeps the image rows in x and the columns in y
+        bboxs.push_back(obBBOX(
+            "car",
+            0.5 + 0.5 * unit(rng_),
+            rect.y,
+            rect.y + rect.height,
+            rect.x,
+            rect.x + rect.width
+        ));
+
+        pcl::PointCloud<pcl::PointXYZI> obj_cloud;
+        for (int pt_idx = 0; pt_idx < cloud_size_; pt_idx++)
+        {
+            Eigen::Vector3d pt =
+                (cube.cube_vertexs().row(0).transpose() +
+                unit(rng_) * (cube.cube_vertexs().row(1) - cube.cube_vertexs().row(0)).transpose() +
+                unit(rng_) * (cube.cube_vertexs().row(3) - cube.cube_vertexs().row(0)).transpose() +
+                unit(rng_) * (cube.cube_vertexs().row(4) - cube.cube_vertexs().row(0)).transpose()).cast<double>();
+            pcl::PointXYZI point;
+            point.x = pt[0];
+            point.y = pt[1];
+            point.z = pt[2];
+            point.intensity = 0.1 * unit(rng_);
+            obj_cloud.push_back(point);
+        }
+        obj_clouds.push_back(obj_cloud);
+    }
+    // bbox list order is unrelated to the cube list order
+    std::shuffle(bboxs.begin(), bboxs.end(), rng_);
+}
+
+stageTimes associationBenchmark::run_scale(int obj_num)
+{
+    stageTimes times;
+    std::vector<syntheticObject> objects;
+    spawn_scene(obj_num, objects);
+    double scene_len = std::sqrt(obj_num * 1000.0 / density_);
+
+    imageWithTime raw_img(0,
+        cv::Mat(config_.imageRows_, config_.imageCols_, CV_8UC3, cv::Scalar::all(0)));
+    Eigen::Matrix4d pose = Eigen::Matrix4d::Identity();
+
+    fusion_tracker tracker;
+    uint64_t frame_time = 1000000000;
+    for (int frame_idx = 0; frame_idx < frames_; frame_idx++)
+    {
+        frame_time += 100000000;
+        FramePacket packet;
+        packet.raw_img_ = raw_img;
+        packet.label_img_ = raw_img;
+        packet.pcds_ = pcdsWithTime(frame_time, pcdWithTime(hubLidarNum));
+        packet.pose_ = poseWithTime(frame_time, pose);
+        Frame frame(std::move(packet), config_);
+
+        frameCubes cubes;
+        frameBboxs bboxs;
+        std::vector<pcl::PointCloud<pcl::PointXYZI>> obj_clouds;
+        detect_scene(objects, scene_len, frame, cubes, bboxs, obj_clouds);
+
+        std::vector<alignedDet> aligned_detections;
+        associationProfile align_profile;
+        frame.detection_align(
+            &obj_clouds,
+            &raw_img.second,
+            &cubes,
+            &bboxs,
+            &pose,
+            aligned_detections,
+            &align_profile
+        );
+
+        tracker.predict_tracks(frame_time);
+        if (frame_idx == 0)
+        {
+            for (size_t det_idx = 0; det_idx < aligned_detections.size(); det_idx++)
+            {
+                tracker.add_track(aligned_detections[det_idx], config_);
+            }
+        }
+        else
+        {
+            associationProfile track_profile;
+            times.tracks_ += tracker.predictedBoxes_.size();
+            tracker.associate(aligned_detections, config_, track_profile);
+
+            // no velocity measurement, the kf velocity follows the positions
+            std::vector<Eigen::Vector3d> kf_vels(tracker.matchedPairs_.size());
+            std::vector<Eigen::Matrix3d> vel_covs(
+                tracker.matchedPairs_.size(), 
+                1e4 * Eigen::Matrix3d::Identity()
+            );
+            for (size_t pair_idx = 0; pair_idx < tracker.matchedPairs_.size(); pair_idx++)
+            {
+                tracker.get_kf_vel(tracker.matchedPairs_[pair_idx].x, kf_vels[pair_idx]);
+            }
+            tracker.update_tracks(aligned_detections, tracker.matchedPairs_, kf_vels, vel_covs);
+            tracker.retire_tracks(config_);
+
+            times.align_[0] += align_profile.cost_matrix_ms_;
+            times.align_[1] += align_profile.iou_ms_;
+            times.align_[2] += align_profile.solver_ms_;
+            times.align_[3] += align_profile.bookkeeping_ms_;
+            times.track_[0] += track_profile.cost_matrix_ms_;
+            times.track_[1] += track_profile.iou_ms_;
+            times.track_[2] += track_profile.solver_ms_;
+            times.track_[3] += track_profile.bookkeeping_ms_;
+            times.iou_evaluations_ += track_profile.iou_evaluations_;
+            times.repaired_rows_ += track_profile.repaired_rows_;
+            times.frames_++;
+        }
+
+        for (size_t obj_idx = 0; obj_idx < objects.size(); obj_idx++)
+        {
+            objects[obj_idx].center_ += 0.1 * objects[obj_idx].vel_;
+        }
+    }
+
+    double frames = std::max(1, times.frames_);
+    for (size_t stage_idx = 0; stage_idx < 4; stage_idx++)
+    {
+        times.align_[stage_idx] /= frames;
+        times.track_[stage_idx] /= frames;
+    }
+    times.iou_evaluations_ /= frames;
+    times.tracks_ /= frames;
+    times.repaired_rows_ /= frames;
+    return times;
+}
+
+bool associationBenchmark::run()
+{
+    if (!config_.readParam())
+    {
+        std::cout << "ERROR! read param fail!" << std::endl;
+        return false;
+    }
+    // the per frame tracking logs would bury the table
+    config_.log_verbose_ = false;
+
+    const int scales[] = {10, 20, 50, 100, 200, 500, 1000, 2000};
+
+    std::cout << "\n------------- association benchmark -------------" << std::endl;
+    std::cout << "frames = " << frames_ << ", density = " << density_
+        << " obj/1000m^2, max speed = " << max_speed_
+        << " m/s, clutter = " << clutter_
+        << ", miss rate = " << miss_rate_ << std::endl;
+
+    for (int warm_start = 0; warm_start < 2; warm_start++)
+    {
+        config_.assignment_warm_start_ = warm_start;
+        config_.assignment_verify_ = false;
+        std::cout << "\nassignment warm start : " << (warm_start ? "on" : "off") << std::endl;
+        printf("%7s | %-35s | %-35s | %9s %9s %9s | %6s\n",
+            "objects",
+            "detection_align (cost/iou/solve/book)",
+            "tracking (cost/iou/solve/book)",
+            "iou evals", "per track", "repaired", "growth");
+
+        double last_total = 0.0;
+        int last_num = 0;
+        for (size_t scale_idx = 0; scale_idx < sizeof(scales) / sizeof(scales[0]); scale_idx++)
+        {
+            int obj_num = scales[scale_idx];
+            if (obj_num > max_objects_)
+            {
+                break;
+            }
+            rng_.seed(42);
+            stageTimes times = run_scale(obj_num);
+
+            // exponent of the total cost between two object counts, 1 is linear
+            double total = times.align_total() + times.track_total();
+            double growth = 0.0;
+            if (last_num > 0 && last_total > 0.0 && total > 0.0)
+            {
+                growth = log(total / last_total) / log((double)obj_num / last_num);
+            }
+            printf("%7d | %8.3f %8.3f %8.3f %8.3f ms | %8.3f %8.3f %8.3f %8.3f ms | %9.0f %9.2f %9.0f | %6.2f\n",
+                obj_num,
+                times.align_[0], times.align_[1], times.align_[2], times.align_[3],
+                times.track_[0], times.track_[1], times.track_[2], times.track_[3],
+                times.iou_evaluations_,
+                times.iou_evaluations_ / std::max(1.0, times.tracks_),
+                times.repaired_rows_, growth);
+            fflush(stdout);
+            last_total = total;
+            last_num = obj_num;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    associationBenchmark benchmark(argc, argv);
+    return benchmark.run() ? 0 : 1;
+}
@@ -0,0 +1,378 @@
+// optical_benchmark.cpp
+// Per object pixel motion of fusion_tracker::estimate_pixel_motion on
+// synthetic feature pairs, every estimator against the same scenes. The
+// error is the pixel velocity error in px per frame.
+//
+// The second table renders textured and low texture boxes moving over a
+// static background and runs fusion_tracker::optical_estimator with every
+// optical_flow_engine. Coverage is the share of objects with an estimate.
+//
+// usage : optical_benchmark [frames] [objects] [features] [outlier_ratio] [noise_px]
+//   features      : feature pairs per object
+//   outlier_ratio : share of the features with an unrelated displacement
+//   noise_px      : sigma of the inlier displacement noise
+
+#include <algorithm>
+#include <random>
+#include <cstdio>
+
+#include "tracker/tracker.h"
+
+class opticalBenchmark
+{
+private:
+    Config config_;
+    std::mt19937 rng_;
+
+    int frames_ = 20;
+    int obj_num_ = 50;
+    int feature_num_ = 100;
+    double outlier_ratio_ = 0.2;
+    double noise_px_ = 0.5;
+
+public:
+    opticalBenchmark(int argc, char** argv);
+    ~opticalBenchmark();
+
+    bool run();
+
+private:
+    void make_scene(
+        std::vector<std::vector<cv::Point2f>> & obj_features_prev,
+        std::vector<std::vector<cv::Point2f>> & obj_features_cur,
+        std::vector<Eigen::Vector2d> & true_motion
+    );
+    void run_estimator(const std::string & estimator);
+
+    void make_patches(
+        std::vector<cv::Mat> & patches,
+        std::vector<cv::Point2f> & positions,
+        std::vector<cv::Point2f> & motions,
+        std::vector<double> & depths
+    );
+    void render_frame(
+        const cv::Mat & background,
+        const std::vector<cv::Mat> & patches,
+        const std::vector<cv::Point2f> & positions,
+        const std::vector<double> & depths,
+        cv::Mat & img
+    );
+    void run_engine(const std::string & engine);
+};
+
+opticalBenchmark::opticalBenchmark(int argc, char** argv)
+{
+    if (argc > 1) frames_ = std::max(1, std::atoi(argv[1]));
+    if (argc > 2) obj_num_ = std::atoi(argv[2]);
+    if (argc > 3) feature_num_ = std::atoi(argv[3]);
+    if (argc > 4) outlier_ratio_ = std::atof(argv[4]);
+    if (argc > 5) noise_px_ = std::atof(argv[5]);
+}
+
+opticalBenchmark::~opticalBenchmark() {}
+
+void opticalBenchmark::make_scene(
+    std::vector<std::vector<cv::Point2f>> & obj_features_prev,
+    std::vector<std::vector<cv::Point2f>> & obj_features_cur,
+    std::vector<Eigen::Vector2d> & true_motion
+)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, noise_px_);
+
+    obj_features_prev.assign(obj_num_, std::vector<cv::Point2f>());
+    obj_features_cur.assign(obj_num_, std::vector<cv::Point2f>());
+    true_motion.resize(obj_num_);
+    for (int obj_idx = 0; obj_idx < obj_num_; obj_idx++)
+    {
+        // box somewhere in the image, motion of up to 20 px per frame
+        cv::Point2f box_tl(1400.0 * unit(rng_), 500.0 * unit(rng_));
+        cv::Point2f box_size(20.0 + 100.0 * unit(rng_), 20.0 + 60.0 * unit(rng_));
+        true_motion[obj_idx] = Eigen::Vector2d(40.0 * unit(rng_) - 20.0, 10.0 * unit(rng_) - 5.0);
+        for (int pix_idx = 0; pix_idx < feature_num_; pix_idx++)
+        {
+            cv::Point2f prev_pt(
+                box_tl.x + box_size.x * unit(rng_),
+                box_tl.y + box_size.y * unit(rng_)
+            );
+            cv::Point2f motion;
+            if (unit(rng_) < outlier_ratio_)
+            {
+                // background or a wrong LK match
+                motion = cv::Point2f(80.0 * unit(rng_) - 40.0, 40.0 * unit(rng_) - 20.0);
+            }
+            else
+            {
+                motion = cv::Point2f(
+                    true_motion[obj_idx][0] + noise(rng_),
+                    true_motion[obj_idx][1] + noise(rng_)
+                );
+            }
+            obj_features_prev[obj_idx].push_back(prev_pt);
+            obj_features_cur[obj_idx].push_back(prev_pt + motion);
+        }
+    }
+}
+
+void opticalBenchmark::run_estimator(const std::string & estimator)
+{
+    config_.pixel_motion_estimator_ = estimator;
+    rng_.seed(7);
+
+    fusion_tracker tracker;
+    std::vector<double> errors;
+    double total_ms = 0.0;
+    double inlier_sum = 0.0;
+    for (int frame_idx = 0; frame_idx < frames_; frame_idx++)
+    {
+        std::vector<std::vector<cv::Point2f>> obj_features_prev, obj_features_cur;
+        std::vector<Eigen::Vector2d> true_motion;
+        make_scene(obj_features_prev, obj_features_cur, true_motion);
+
+        std::vector<std::vector<uchar>> inlier_status;
+        std::vector<Eigen::Vector2d> obj_means;
+        std::vector<Eigen::Matrix2d> obj_covariances;
+        Timer estimator_timer("pixel motion");
+        tracker.estimate_pixel_motion(
+            obj_features_prev,
+            obj_features_cur,
+            config_,
+            inlier_status,
+            obj_means,
+            obj_covariances
+        );
+        total_ms += estimator_timer.elapsed();
+
+        for (int obj_idx = 0; obj_idx < obj_num_; obj_idx++)
+        {
+            errors.push_back((obj_means[obj_idx] - true_motion[obj_idx]).norm());
+            inlier_sum += std::count(inlier_status[obj_idx].begin(), inlier_status[obj_idx].end(), 1);
+        }
+    }
+
+    std::sort(errors.begin(), errors.end());
+    double mean_error = 0.0;
+    for (size_t err_idx = 0; err_idx < errors.size(); err_idx++)
+    {
+        mean_error += errors[err_idx] / errors.size();
+    }
+    double p95_error = errors[std::min(errors.size() - 1, (size_t)(0.95 * errors.size()))];
+    double inlier_share = inlier_sum / ((double)frames_ * obj_num_ * feature_num_);
+    printf("%10s | %10.3f ms | %10.3f us | %10.3f px | %10.3f px | %8.3f\n",
+        estimator.c_str(),
+        total_ms / frames_,
+        1000.0 * total_ms / (frames_ * obj_num_),
+        mean_error,
+        p95_error,
+        inlier_share);
+}
+
+// half of the boxes carry texture, the other half is flat with one edge
+void opticalBenchmark::make_patches(
+    std::vector<cv::Mat> & patches,
+    std::vector<cv::Point2f> & positions,
+    std::vector<cv::Point2f> & motions,
+    std::vector<double> & depths
+)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    patches.clear();
+    positions.clear();
+    motions.clear();
+    depths.clear();
+    for (int obj_idx = 0; obj_idx < obj_num_; obj_idx++)
+    {
+        int width = 30 + 170 * unit(rng_);
+        int height = 20 + 100 * unit(rng_);
+        cv::Mat patch(height, width, CV_8UC3);
+        if (obj_idx % 2 == 0)
+        {
+            cv::randu(patch, cv::Scalar::all(0), cv::Scalar::all(255));
+            cv::GaussianBlur(patch, patch, cv::Size(5, 5), 1.5);
+        }
+        else
+        {
+            patch.setTo(cv::Scalar::all(60 + 120 * unit(rng_)));
+            cv::rectangle(
+                patch,
+                cv::Rect(0, height / 2, width, height / 4),
+                cv::Scalar::all(20), -1
+            );
+        }
+        patches.push_back(patch);
+        positions.push_back(cv::Point2f(
+            100 + (1320 - width) * unit(rng_),
+            60 + (448 - height) * unit(rng_)
+        ));
+        motions.push_back(cv::Point2f(8.0 * unit(rng_) - 4.0, 4.0 * unit(rng_) - 2.0));
+        depths.push_back(5.0 + 50.0 * unit(rng_));
+    }
+}
+
+void opticalBenchmark::render_frame(
+    const cv::Mat & background,
+    const std::vector<cv::Mat> & patches,
+    const std::vector<cv::Point2f> & positions,
+    const std::vector<double> & depths,
+    cv::Mat & img
+)
+{
+    img = background.clone();
+    cv::Rect image_rect(0, 0, img.cols, img.rows);
+    std::vector<int> far_to_near(patches.size());
+    for (size_t obj_idx = 0; obj_idx < patches.size(); obj_idx++)
+    {
+        far_to_near[obj_idx] = obj_idx;
+    }
+    std::sort(far_to_near.begin(), far_to_near.end(),
+        [&depths](int a, int b) { return depths[a] > depths[b]; });
+    for (size_t order_idx = 0; order_idx < far_to_near.size(); order_idx++)
+    {
+        int obj_idx = far_to_near[order_idx];
+        cv::Rect box(
+            cvRound(positions[obj_idx].x),
+            cvRound(positions[obj_idx].y),
+            patches[obj_idx].cols,
+            patches[obj_idx].rows
+        );
+        cv::Rect visible = box & image_rect;
+        if (visible.area() == 0)
+        {
+            continue;
+        }
+        cv::Mat img_roi = img(visible);
+        patches[obj_idx](visible - box.tl()).copyTo(img_roi);
+    }
+}
+
+void opticalBenchmark::run_engine(const std::string & engine)
+{
+    config_.optical_flow_engine_ = engine;
+    config_.pixel_motion_estimator_ = "irls";
+    rng_.seed(11);
+
+    cv::Mat background(config_.imageRows_, config_.imageCols_, CV_8UC3);
+    cv::randu(background, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::GaussianBlur(background, background, cv::Size(7, 7), 2.0);
+
+    std::vector<cv::Mat> patches;
+    std::vector<cv::Point2f> positions, motions;
+    std::vector<double> depths;
+    make_patches(patches, positions, motions, depths);
+
+    // one track per object, 0 is never a valid slot id
+    std::vector<slotId> track_ids;
+    for (int obj_idx = 0; obj_idx < obj_num_; obj_idx++)
+    {
+        track_ids.push_back(obj_idx + 1);
+    }
+
+    fusion_tracker tracker;
+    flowImageCache prev_cache;
+    std::vector<alignedDet> prev_detection;
+    double total_ms = 0.0;
+    double error_sum = 0.0;
+    int estimated = 0;
+    int evaluated = 0;
+    for (int frame_idx = 0; frame_idx < frames_; frame_idx++)
+    {
+        cv::Mat img;
+        render_frame(background, patches, positions, depths, img);
+        flowImageCache cur_cache;
+        tracker.build_flow_cache(img, cur_cache);
+
+        std::vector<alignedDet> cur_detection(obj_num_);
+        for (int obj_idx = 0; obj_idx < obj_num_; obj_idx++)
+        {
+            cur_detection[obj_idx].setVertex2d(cv::Rect(
+                cvRound(positions[obj_idx].x),
+                cvRound(positions[obj_idx].y),
+                patches[obj_idx].cols,
+                patches[obj_idx].rows
+            ));
+            cur_detection[obj_idx].vertex3d().setZero();
+            cur_detection[obj_idx].vertex3d().col(0).setConstant(depths[obj_idx]);
+        }
+
+        if (frame_idx > 0)
+        {
+            std::vector<Eigen::Vector2d> obj_means;
+            std::vector<Eigen::Matrix2d> obj_covariances;
+            Timer engine_timer("optical estimator");
+            tracker.optical_estimator(
+                prev_cache,
+                cur_cache,
+                prev_detection,
+                cur_detection,
+                track_ids,
+                config_,
+                obj_means,
+                obj_covariances
+            );
+            total_ms += engine_timer.elapsed();
+
+            for (int obj_idx = 0; obj_idx < obj_num_; obj_idx++)
+            {
+                evaluated++;
+                if (obj_covariances[obj_idx](0, 0) >= kNoPixelMotionVar)
+                {
+                    continue;
+                }
+                Eigen::Vector2d true_motion(motions[obj_idx].x, motions[obj_idx].y);
+                error_sum += (obj_means[obj_idx] - true_motion).norm();
+                estimated++;
+            }
+        }
+
+        prev_cache = cur_cache;
+        prev_detection = cur_detection;
+        for (int obj_idx = 0; obj_idx < obj_num_; obj_idx++)
+        {
+            positions[obj_idx] += motions[obj_idx];
+        }
+    }
+
+    int flow_frames = std::max(1, frames_ - 1);
+    printf("%10s | %10.3f ms | %10.3f us | %10.3f px | %8.3f\n",
+        engine.c_str(),
+        total_ms / flow_frames,
+        1000.0 * total_ms / (flow_frames * std::max(1, obj_num_)),
+        estimated > 0 ? error_sum / estimated : 0.0,
+        evaluated > 0 ? (double)estimated / evaluated : 0.0);
+}
+
+bool opticalBenchmark::run()
+{
+    if (!config_.readParam())
+    {
+        std::cout << "ERROR! read param fail!" << std::endl;
+        return false;
+    }
+    // no flow stage logs between the report rows
+    config_.log_verbose_ = false;
+
+    std::cout << "\n------------- optical benchmark -------------" << std::endl;
+    std::cout << "frames = " << frames_ << ", objects = " << obj_num_
+        << ", features per object = " << feature_num_
+        << ", outlier ratio = " << outlier_ratio_
+        << ", noise = " << noise_px_ << " px" << std::endl;
+    printf("%10s | %13s | %13s | %13s | %13s | %8s\n",
+        "estimator", "per frame", "per object", "mean error", "p95 error", "inliers");
+
+    run_estimator("ransac");
+    run_estimator("irls");
+
+    std::cout << "\noptical flow engines on rendered frames" << std::endl;
+    printf("%10s | %13s | %13s | %13s | %8s\n",
+        "engine", "per frame", "per object", "mean error", "coverage");
+    run_engine("sparse");
+    run_engine("dense");
+    run_engine("auto");
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    opticalBenchmark benchmark(argc, argv);
+    return benchmark.run() ? 0 : 1;
+}
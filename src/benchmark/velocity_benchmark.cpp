@@ -0,0 +1,506 @@
+// velocity_benchmark.cpp
+// Per object velocity estimators of fusion_tracker on synthetic boxes with
+// a known velocity. A box moves during the scan, every lidar point hits it
+// at its own scan time, so the cloud carries the motion distortion the
+// estimators remove. Rays are evenly spaced over the 0.1 s scan as in the
+// time model of full_detection, their direction follows a Livox-like
+// rosette over the box, so neighbouring times are spread over the object.
+//
+// The estimator rows give the point velocity alone (the pixel velocity gets
+// a huge covariance). vel_fusion and cloud_undistortion are timed on their
+// own with an image flow which matches the box motion. Clouds above the
+// point budget also check that the variance of the sample is the variance
+// of the full cloud, the benchmark exits with 1 if it isn't.
+//
+// usage : velocity_benchmark [objects] [max_speed] [range_noise]
+//   objects     : boxes per point count
+//   max_speed   : speeds are drawn up to max_speed (m/s)
+//   range_noise : sigma of the lidar range noise (m)
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <cstdio>
+
+#include "tracker/tracker.h"
+
+class velocityBenchmark
+{
+private:
+    Config config_;
+    std::mt19937 rng_;
+
+    int obj_num_ = 20;
+    double max_speed_ = 15.0;
+    double range_noise_ = 0.02;
+
+    typedef struct syntheticObject
+    {
+        alignedDet prev_detection_;
+        alignedDet cur_detection_;
+        Eigen::Vector3d true_vel_;
+        Eigen::Vector2d pix_vel_;
+    } syntheticObject;
+
+public:
+    velocityBenchmark(int argc, char** argv);
+    ~velocityBenchmark();
+
+    bool run();
+
+private:
+    // box of half size half_extent at center, yaw about z, seen from the
+    // origin while it moves with vel. cloud : pt_num hits, time in intensity
+    void scan_box(
+        const Eigen::Vector3d & center,
+        const Eigen::Vector3d & half_extent,
+        double yaw,
+        const Eigen::Vector3d & vel,
+        int pt_num,
+        pcl::PointCloud<pcl::PointXYZI> & cloud
+    );
+    void make_detection(
+        const Eigen::Vector3d & center,
+        const Eigen::Vector3d & half_extent,
+        double yaw,
+        const Eigen::Vector3d & vel,
+        int pt_num,
+        uint64_t time_stamp,
+        alignedDet & detection
+    );
+    void make_objects(int pt_num, std::vector<syntheticObject> & objects);
+    Eigen::Vector2d project(const Eigen::Vector3d & pt) const;
+
+    void run_estimator(
+        const std::string & name,
+        const std::vector<syntheticObject> & objects,
+        int pt_num
+    );
+    void run_fusion(const std::vector<syntheticObject> & objects, int pt_num);
+    // the point velocity variance of a budget sample must be the variance
+    // of the full cloud, false if the median ratio is off by more than 2x
+    bool check_sampled_variance(const std::vector<syntheticObject> & objects, int pt_num);
+};
+
+velocityBenchmark::velocityBenchmark(int argc, char** argv)
+{
+    if (argc > 1) obj_num_ = std::max(1, std::atoi(argv[1]));
+    if (argc > 2) max_speed_ = std::atof(argv[2]);
+    if (argc > 3) range_noise_ = std::atof(argv[3]);
+}
+
+velocityBenchmark::~velocityBenchmark() {}
+
+// the projection vel_fusion inverts : x is the depth
+Eigen::Vector2d velocityBenchmark::project(const Eigen::Vector3d & pt) const
+{
+    return Eigen::Vector2d(
+        (-pt[1]) * config_.camera_intrinsic_(0, 0) / pt[0] + config_.camera_intrinsic_(0, 2),
+        (-pt[2]) * config_.camera_intrinsic_(1, 1) / pt[0] + config_.camera_intrinsic_(1, 2)
+    );
+}
+
+void velocityBenchmark::scan_box(
+    const Eigen::Vector3d & center,
+    const Eigen::Vector3d & half_extent,
+    double yaw,
+    const Eigen::Vector3d & vel,
+    int pt_num,
+    pcl::PointCloud<pcl::PointXYZI> & cloud
+)
+{
+    std::normal_distribution<double> noise(0.0, range_noise_);
+    Eigen::Matrix3d rotation = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+
+    // rosette over the angular window of the box
+    double azimuth = std::atan2(center[1], center[0]);
+    double elevation = std::atan2(center[2], center.head<2>().norm());
+    double window = 1.2 * half_extent.norm() / center.norm();
+
+    cloud.clear();
+    int ray_num = 4 * pt_num;
+    for (int ray_idx = 0; ray_idx < ray_num; ray_idx++)
+    {
+        double t = 0.1 * ray_idx / ray_num;
+        double theta = 2.0 * M_PI * 97.0 * t / 0.1;
+        double radius = window * std::sin(2.0 * M_PI * 13.7 * t / 0.1 + 0.3 * theta);
+        double ray_az = azimuth + radius * std::cos(theta);
+        double ray_el = elevation + radius * std::sin(theta);
+        Eigen::Vector3d dir(
+            std::cos(ray_el) * std::cos(ray_az),
+            std::cos(ray_el) * std::sin(ray_az),
+            std::sin(ray_el)
+        );
+
+        // slab test in the box frame at the time of the ray
+        Eigen::Vector3d box_center = center + vel * t;
+        Eigen::Vector3d origin = rotation.transpose() * (-box_center);
+        Eigen::Vector3d box_dir = rotation.transpose() * dir;
+        double t_near = -std::numeric_limits<double>::max();
+        double t_far = std::numeric_limits<double>::max();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (std::abs(box_dir[axis]) < 1e-12)
+            {
+                if (std::abs(origin[axis]) > half_extent[axis])
+                {
+                    t_near = std::numeric_limits<double>::max();
+                }
+                continue;
+            }
+            double t0 = (-half_extent[axis] - origin[axis]) / box_dir[axis];
+            double t1 = (half_extent[axis] - origin[axis]) / box_dir[axis];
+            t_near = std::max(t_near, std::min(t0, t1));
+            t_far = std::min(t_far, std::max(t0, t1));
+        }
+        if (t_near > t_far || t_near <= 0.0)
+        {
+            continue;
+        }
+        Eigen::Vector3d hit = (t_near + noise(rng_)) * dir;
+        pcl::PointXYZI pt;
+        pt.x = hit[0];
+        pt.y = hit[1];
+        pt.z = hit[2];
+        pt.intensity = t;
+        cloud.push_back(pt);
+    }
+
+    // evenly strided hits keep the whole scan time
+    if ((int)cloud.size() > pt_num)
+    {
+        pcl::PointCloud<pcl::PointXYZI> strided;
+        for (int pt_idx = 0; pt_idx < pt_num; pt_idx++)
+        {
+            strided.push_back(cloud.points[(size_t)pt_idx * cloud.size() / pt_num]);
+        }
+        cloud = strided;
+    }
+}
+
+void velocityBenchmark::make_detection(
+    const Eigen::Vector3d & center,
+    const Eigen::Vector3d & half_extent,
+    double yaw,
+    const Eigen::Vector3d & vel,
+    int pt_num,
+    uint64_t time_stamp,
+    alignedDet & detection
+)
+{
+    Eigen::Matrix3d rotation = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+    // vertex order of the detector cubes : 0-1 along the length, 0-3 across, 0-4 up
+    for (int vertex_idx = 0; vertex_idx < 8; vertex_idx++)
+    {
+        bool far_x = vertex_idx % 4 == 1 || vertex_idx % 4 == 2;
+        bool far_y = vertex_idx % 4 == 2 || vertex_idx % 4 == 3;
+        bool far_z = vertex_idx >= 4;
+        Eigen::Vector3d corner(
+            far_x ? half_extent[0] : -half_extent[0],
+            far_y ? half_extent[1] : -half_extent[1],
+            far_z ? half_extent[2] : -half_extent[2]
+        );
+        detection.vertex3d().row(vertex_idx) = (center + rotation * corner).transpose().cast<float>();
+    }
+    std::shared_ptr<pcl::PointCloud<pcl::PointXYZI>> cloud(new pcl::PointCloud<pcl::PointXYZI>);
+    scan_box(center, half_extent, yaw, vel, pt_num, *cloud);
+    detection.cloud_ = cloudView(cloud);
+
+    Eigen::Vector2d box_min = project(center), box_max = box_min;
+    for (int vertex_idx = 0; vertex_idx < 8; vertex_idx++)
+    {
+        Eigen::Vector2d uv = project(detection.vertex3d().row(vertex_idx).transpose().cast<double>());
+        box_min = box_min.cwiseMin(uv);
+        box_max = box_max.cwiseMax(uv);
+    }
+    detection.setVertex2d(cv::Rect(
+        cvRound(box_min[0]), cvRound(box_min[1]),
+        cvRound(box_max[0] - box_min[0]), cvRound(box_max[1] - box_min[1])
+    ));
+    detection.class_id_ = ClassTable::intern("car");
+    detection.confidence2d_ = 1.0;
+    detection.confidence3d_ = 1.0;
+    // pose 0 of the table is the identity
+    detection.pose_idx_ = 0;
+    detection.time_stamp_ = time_stamp;
+}
+
+void velocityBenchmark::make_objects(int pt_num, std::vector<syntheticObject> & objects)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const uint64_t frame_ns = 100000000;
+    const uint64_t cur_stamp = 1000 * frame_ns;
+
+    objects.resize(obj_num_);
+    for (int obj_idx = 0; obj_idx < obj_num_; obj_idx++)
+    {
+        syntheticObject & obj = objects[obj_idx];
+        Eigen::Vector3d half_extent(
+            1.5 + 1.5 * unit(rng_),
+            0.8 + 0.3 * unit(rng_),
+            0.7 + 0.3 * unit(rng_)
+        );
+        Eigen::Vector3d center(10.0 + 30.0 * unit(rng_), 16.0 * unit(rng_) - 8.0, -0.8);
+        double yaw = 2.0 * M_PI * unit(rng_);
+        double speed = max_speed_ * unit(rng_);
+        obj.true_vel_ = Eigen::Vector3d(speed * std::cos(yaw), speed * std::sin(yaw), 0.0);
+
+        Eigen::Vector3d prev_center = center - 0.1 * obj.true_vel_;
+        make_detection(prev_center, half_extent, yaw, obj.true_vel_, pt_num, cur_stamp - frame_ns, obj.prev_detection_);
+        make_detection(center, half_extent, yaw, obj.true_vel_, pt_num, cur_stamp, obj.cur_detection_);
+        obj.pix_vel_ = project(center) - project(prev_center);
+    }
+}
+
+void velocityBenchmark::run_estimator(
+    const std::string & name,
+    const std::vector<syntheticObject> & objects,
+    int pt_num
+)
+{
+    fusion_tracker tracker;
+    // the pixel velocity can't pull the result
+    Eigen::Matrix2d pix_vel_cov = kNoPixelMotionVar * Eigen::Matrix2d::Identity();
+    double total_ms = 0.0;
+    double error_sum = 0.0;
+    double point_sum = 0.0;
+    int estimated = 0;
+    for (size_t obj_idx = 0; obj_idx < objects.size(); obj_idx++)
+    {
+        const syntheticObject & obj = objects[obj_idx];
+        point_sum += obj.cur_detection_.cloud_.size();
+        Eigen::Vector3d fused_vel = Eigen::Vector3d::Zero();
+        Eigen::Matrix3d fused_vel_cov;
+        bool valid = true;
+        if (config_.velocity_engine_ == "registration")
+        {
+            // the last frame of the track, cached outside the timing
+            kfTracker trk(obj.prev_detection_);
+            trk.cache_registration(Eigen::Vector3d::Zero());
+            Timer estimator_timer("registration");
+            valid = tracker.registration_estimator(
+                trk,
+                obj.cur_detection_,
+                Eigen::Vector2d::Zero(),
+                pix_vel_cov,
+                fused_vel,
+                fused_vel_cov,
+                config_
+            );
+            total_ms += estimator_timer.elapsed();
+        }
+        else
+        {
+            Eigen::Vector3d points_vel;
+            Timer estimator_timer("points estimator");
+            tracker.points_estimator(
+                obj.prev_detection_,
+                obj.cur_detection_,
+                points_vel,
+                Eigen::Vector2d::Zero(),
+                pix_vel_cov,
+                Eigen::Vector3d::Zero(),
+                fused_vel,
+                fused_vel_cov,
+                config_
+            );
+            total_ms += estimator_timer.elapsed();
+        }
+        if (valid && fused_vel.allFinite())
+        {
+            error_sum += (fused_vel - obj.true_vel_).head<2>().norm();
+            estimated++;
+        }
+    }
+
+    printf("%24s | %7d | %10.1f us | %10.3f Mpt/s | %8.3f m/s | %8.3f\n",
+        name.c_str(),
+        pt_num,
+        1000.0 * total_ms / objects.size(),
+        total_ms > 0.0 ? point_sum / (1000.0 * total_ms) : 0.0,
+        estimated > 0 ? error_sum / estimated : 0.0,
+        (double)estimated / objects.size());
+}
+
+void velocityBenchmark::run_fusion(const std::vector<syntheticObject> & objects, int pt_num)
+{
+    fusion_tracker tracker;
+    Eigen::Matrix2d pix_vel_cov = 0.25 * Eigen::Matrix2d::Identity();
+    Eigen::Matrix3d points_vel_cov = Eigen::Matrix3d::Identity();
+    double fusion_ms = 0.0;
+    double undistortion_ms = 0.0;
+    double error_sum = 0.0;
+    double point_sum = 0.0;
+    for (size_t obj_idx = 0; obj_idx < objects.size(); obj_idx++)
+    {
+        const syntheticObject & obj = objects[obj_idx];
+        point_sum += obj.cur_detection_.cloud_.size();
+
+        // a point velocity off by 1 m/s across the line of sight, the
+        // image flow should pull it back
+        Eigen::Vector3d radial = obj.cur_detection_.vertex3d().colwise().mean().transpose().cast<double>().normalized();
+        Eigen::Vector3d across = radial.cross(Eigen::Vector3d::UnitZ()).normalized();
+        Eigen::Vector3d points_vel = obj.true_vel_ + across;
+
+        Eigen::Vector3d fused_vel;
+        Eigen::Matrix3d fused_vel_cov;
+        Timer fusion_timer("vel fusion");
+        tracker.vel_fusion(
+            obj.cur_detection_,
+            obj.prev_detection_,
+            points_vel,
+            points_vel_cov,
+            obj.pix_vel_,
+            pix_vel_cov,
+            fused_vel,
+            fused_vel_cov,
+            config_
+        );
+        fusion_ms += fusion_timer.elapsed(true);
+        error_sum += (fused_vel - obj.true_vel_).head<2>().norm();
+
+        pcl::PointCloud<pcl::PointXYZRGB>::Ptr clouds_buffer(new pcl::PointCloud<pcl::PointXYZRGB>);
+        visualization_msgs::Marker arrow_buffer;
+        visualization_msgs::MarkerArray txt_buffer;
+        fusion_timer.elapsed(true);
+        cloud_undistortion(
+            obj.cur_detection_,
+            obj.true_vel_,
+            obj_idx,
+            clouds_buffer,
+            arrow_buffer,
+            txt_buffer
+        );
+        undistortion_ms += fusion_timer.elapsed();
+    }
+    printf("%24s | %7d | %10.1f us | %14s | %8.3f m/s | %8s\n",
+        "vel_fusion (1 m/s off)",
+        pt_num,
+        1000.0 * fusion_ms / objects.size(),
+        "-",
+        error_sum / objects.size(),
+        "-");
+    printf("%24s | %7d | %10.1f us | %10.3f Mpt/s | %12s | %8s\n",
+        "cloud_undistortion",
+        pt_num,
+        1000.0 * undistortion_ms / objects.size(),
+        undistortion_ms > 0.0 ? point_sum / (1000.0 * undistortion_ms) : 0.0,
+        "-",
+        "-");
+}
+
+bool velocityBenchmark::check_sampled_variance(const std::vector<syntheticObject> & objects, int pt_num)
+{
+    fusion_tracker tracker;
+    // the fused variance is the point velocity variance
+    Eigen::Matrix2d pix_vel_cov = kNoPixelMotionVar * Eigen::Matrix2d::Identity();
+    Config full_config = config_;
+    full_config.point_vel_budget_ = 0;
+    std::vector<double> ratios;
+    for (size_t obj_idx = 0; obj_idx < objects.size(); obj_idx++)
+    {
+        const syntheticObject & obj = objects[obj_idx];
+        Eigen::Vector3d points_vel;
+        Eigen::Vector3d full_vel = Eigen::Vector3d::Zero();
+        Eigen::Vector3d sampled_vel = Eigen::Vector3d::Zero();
+        Eigen::Matrix3d full_cov = Eigen::Matrix3d::Zero();
+        Eigen::Matrix3d sampled_cov = Eigen::Matrix3d::Zero();
+        tracker.points_estimator(
+            obj.prev_detection_, obj.cur_detection_, points_vel,
+            Eigen::Vector2d::Zero(), pix_vel_cov, Eigen::Vector3d::Zero(),
+            full_vel, full_cov, full_config
+        );
+        tracker.points_estimator(
+            obj.prev_detection_, obj.cur_detection_, points_vel,
+            Eigen::Vector2d::Zero(), pix_vel_cov, Eigen::Vector3d::Zero(),
+            sampled_vel, sampled_cov, config_
+        );
+        double full_var = full_cov.topLeftCorner<2, 2>().trace();
+        double sampled_var = sampled_cov.topLeftCorner<2, 2>().trace();
+        if (std::isfinite(full_var) && std::isfinite(sampled_var) && full_var > 0.0 && sampled_var > 0.0)
+        {
+            ratios.push_back(sampled_var / full_var);
+        }
+    }
+    if (ratios.empty())
+    {
+        return true;
+    }
+    std::nth_element(ratios.begin(), ratios.begin() + ratios.size() / 2, ratios.end());
+    double median_ratio = ratios[ratios.size() / 2];
+    bool agree = median_ratio > 0.5 && median_ratio < 2.0;
+    printf("%24s | %7d | sampled / full variance %.3f (median of %zu) %s\n",
+        "budget variance check",
+        pt_num,
+        median_ratio,
+        ratios.size(),
+        agree ? "ok" : "FAILED");
+    return agree;
+}
+
+bool velocityBenchmark::run()
+{
+    if (!config_.readParam())
+    {
+        std::cout << "ERROR! read param fail!" << std::endl;
+        return false;
+    }
+    // per frame logs off, estimator warnings still reach cerr
+    config_.log_verbose_ = false;
+
+    std::cout << "\n------------- velocity benchmark -------------" << std::endl;
+    std::cout << "objects = " << obj_num_ << ", max speed = " << max_speed_
+        << " m/s, range noise = " << range_noise_ << " m" << std::endl;
+    printf("%24s | %7s | %13s | %16s | %12s | %8s\n",
+        "estimator", "points", "per object", "throughput", "mean error", "coverage");
+
+    const int pt_nums[] = {10, 100, 1000, 5000, 20000};
+    Config base_config = config_;
+    bool variance_agrees = true;
+    for (int pt_num : pt_nums)
+    {
+        rng_.seed(5);
+        std::vector<syntheticObject> objects;
+        make_objects(pt_num, objects);
+
+        config_ = base_config;
+        config_.velocity_engine_ = "points";
+        config_.point_vel_direction_ = "cube";
+        config_.point_vel_validate_ = false;
+        config_.point_vel_budget_ = 0;
+
+        config_.point_vel_solver_ = "ceres";
+        run_estimator("points ceres", objects, pt_num);
+        config_.point_vel_solver_ = "irls";
+        run_estimator("points irls", objects, pt_num);
+
+        config_.point_vel_budget_ = base_config.point_vel_budget_ > 0 ? base_config.point_vel_budget_ : 800;
+        config_.point_vel_sampling_ = "time";
+        run_estimator("points irls budget time", objects, pt_num);
+        config_.point_vel_sampling_ = "voxel";
+        run_estimator("points irls budget voxel", objects, pt_num);
+
+        config_.point_vel_sampling_ = "time";
+        if (static_cast<size_t>(pt_num) > config_.point_vel_budget_)
+        {
+            variance_agrees = check_sampled_variance(objects, pt_num) && variance_agrees;
+        }
+        config_.point_vel_direction_ = "bev";
+        run_estimator("points irls bev", objects, pt_num);
+
+        config_.point_vel_direction_ = "cube";
+        config_.velocity_engine_ = "registration";
+        run_estimator("registration", objects, pt_num);
+
+        config_ = base_config;
+        run_fusion(objects, pt_num);
+        printf("\n");
+    }
+    return variance_agrees;
+}
+
+int main(int argc, char** argv)
+{
+    velocityBenchmark benchmark(argc, argv);
+    return benchmark.run() ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+// incremental_hungarian_test.cpp
+// IncrementalHungarian::Solve against HungarianAlgorithm::Solve on warm
+// started frame sequences. Every frame tracks (rows) and detections
+// (columns) are added and removed and the costs are perturbed, the row
+// duals are carried over as fusion_tracker::associate does. The warm
+// solve must reach the cost of the full solve with a valid assignment.
+//
+// usage : incremental_hungarian_test [sequences] [frames]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "tracker/Hungarian.h"
+#include "tracker/IncrementalHungarian.h"
+
+typedef struct testTrack
+{
+    double x_;
+    double y_;
+    double dual_;
+    bool has_dual_;
+} testTrack;
+
+typedef struct testDetection
+{
+    double x_;
+    double y_;
+} testDetection;
+
+class incrementalHungarianTest
+{
+public:
+    incrementalHungarianTest(int argc, char** argv);
+
+    bool run();
+
+private:
+    // 1 - iou like costs : 1 out of reach, many ties at 1
+    void build_costs(
+        const std::vector<testTrack> & tracks,
+        const std::vector<testDetection> & detections,
+        std::vector<std::vector<double>> & costs
+    );
+    void step_scene(
+        std::vector<testTrack> & tracks,
+        std::vector<testDetection> & detections
+    );
+    bool check_frame(
+        IncrementalHungarian & warm_solver,
+        std::vector<testTrack> & tracks,
+        const std::vector<std::vector<double>> & costs
+    );
+
+    std::mt19937 rng_;
+    int sequences_ = 60;
+    int frames_ = 100;
+    int solves_ = 0;
+    int failures_ = 0;
+    int fallbacks_ = 0;
+};
+
+incrementalHungarianTest::incrementalHungarianTest(int argc, char** argv)
+{
+    if (argc > 1) sequences_ = std::max(1, std::atoi(argv[1]));
+    if (argc > 2) frames_ = std::max(1, std::atoi(argv[2]));
+    rng_.seed(7);
+}
+
+void incrementalHungarianTest::build_costs(
+    const std::vector<testTrack> & tracks,
+    const std::vector<testDetection> & detections,
+    std::vector<std::vector<double>> & costs
+)
+{
+    costs.assign(tracks.size(), std::vector<double>(detections.size(), 1.0));
+    for (size_t i = 0; i < tracks.size(); i++)
+    {
+        for (size_t j = 0; j < detections.size(); j++)
+        {
+            double dist = std::hypot(tracks[i].x_ - detections[j].x_, tracks[i].y_ - detections[j].y_);
+            costs[i][j] = std::min(1.0, dist / 3.0);
+        }
+    }
+}
+
+void incrementalHungarianTest::step_scene(
+    std::vector<testTrack> & tracks,
+    std::vector<testDetection> & detections
+)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, 0.3);
+
+    // cost perturbation : the tracks move
+    for (size_t i = 0; i < tracks.size(); i++)
+    {
+        tracks[i].x_ += noise(rng_);
+        tracks[i].y_ += noise(rng_);
+    }
+    // row remove / add : retired and new tracks, a new track has no dual
+    for (size_t i = 0; i < tracks.size();)
+    {
+        if (unit(rng_) < 0.05)
+        {
+            tracks[i] = tracks.back();
+            tracks.pop_back();
+            continue;
+        }
+        i++;
+    }
+    int born = static_cast<int>(unit(rng_) * 4);
+    for (int birth_idx = 0; birth_idx < born; birth_idx++)
+    {
+        testTrack track;
+        track.x_ = 60.0 * unit(rng_);
+        track.y_ = 60.0 * unit(rng_);
+        track.dual_ = 0.0;
+        track.has_dual_ = false;
+        tracks.push_back(track);
+    }
+    // column remove / add : missed objects and clutter around the tracks
+    detections.clear();
+    for (size_t i = 0; i < tracks.size(); i++)
+    {
+        if (unit(rng_) < 0.1)
+        {
+            continue;
+        }
+        testDetection detection;
+        detection.x_ = tracks[i].x_ + noise(rng_);
+        detection.y_ = tracks[i].y_ + noise(rng_);
+        detections.push_back(detection);
+    }
+    int clutter = static_cast<int>(unit(rng_) * 5);
+    for (int clutter_idx = 0; clutter_idx < clutter; clutter_idx++)
+    {
+        testDetection detection;
+        detection.x_ = 60.0 * unit(rng_);
+        detection.y_ = 60.0 * unit(rng_);
+        detections.push_back(detection);
+    }
+    std::shuffle(detections.begin(), detections.end(), rng_);
+}
+
+bool incrementalHungarianTest::check_frame(
+    IncrementalHungarian & warm_solver,
+    std::vector<testTrack> & tracks,
+    const std::vector<std::vector<double>> & costs
+)
+{
+    size_t row_num = tracks.size();
+    size_t col_num = row_num > 0 ? costs[0].size() : 0;
+    std::vector<double> row_duals(row_num, 0.0);
+    std::vector<bool> warm_rows(row_num, false);
+    for (size_t i = 0; i < row_num; i++)
+    {
+        row_duals[i] = tracks[i].dual_;
+        warm_rows[i] = tracks[i].has_dual_;
+    }
+
+    std::vector<int> warm_assignment;
+    double warm_cost = warm_solver.Solve(costs, warm_assignment, row_duals, warm_rows);
+    for (size_t i = 0; i < row_num; i++)
+    {
+        tracks[i].dual_ = row_duals[i];
+        tracks[i].has_dual_ = !warm_solver.usedFallback();
+    }
+    fallbacks_ += warm_solver.usedFallback() ? 1 : 0;
+
+    HungarianAlgorithm full_solver;
+    std::vector<int> full_assignment;
+    double full_cost = row_num > 0 && col_num > 0 ? full_solver.Solve(costs, full_assignment) : 0.0;
+    solves_++;
+
+    // the assignment is valid and has the cost it reports
+    bool valid = warm_assignment.size() == row_num;
+    std::vector<bool> col_used(col_num, false);
+    double assignment_cost = 0.0;
+    int matched = 0;
+    for (size_t i = 0; valid && i < row_num; i++)
+    {
+        int col = warm_assignment[i];
+        if (col < 0)
+        {
+            continue;
+        }
+        if (col >= static_cast<int>(col_num) || col_used[col])
+        {
+            valid = false;
+            break;
+        }
+        col_used[col] = true;
+        assignment_cost += costs[i][col];
+        matched++;
+    }
+    valid = valid && matched == static_cast<int>(std::min(row_num, col_num));
+
+    if (!valid || std::abs(warm_cost - full_cost) > 1e-6 || std::abs(assignment_cost - warm_cost) > 1e-6)
+    {
+        printf("solve %d (%zu x %zu) : warm cost %.9f, assignment cost %.9f, full cost %.9f%s\n",
+            solves_, row_num, col_num, warm_cost, assignment_cost, full_cost,
+            valid ? "" : ", invalid assignment");
+        failures_++;
+        return false;
+    }
+    return true;
+}
+
+bool incrementalHungarianTest::run()
+{
+    for (int seq_idx = 0; seq_idx < sequences_; seq_idx++)
+    {
+        IncrementalHungarian warm_solver;
+        std::vector<testTrack> tracks;
+        std::vector<testDetection> detections;
+        std::vector<std::vector<double>> costs;
+        for (int frame_idx = 0; frame_idx < frames_; frame_idx++)
+        {
+            step_scene(tracks, detections);
+            build_costs(tracks, detections, costs);
+            check_frame(warm_solver, tracks, costs);
+        }
+    }
+
+    // random dense costs, no structure shared between frames
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<int> shape(0, 12);
+    IncrementalHungarian warm_solver;
+    std::vector<testTrack> tracks;
+    for (int frame_idx = 0; frame_idx < frames_; frame_idx++)
+    {
+        tracks.resize(shape(rng_), testTrack{0.0, 0.0, 0.0, false});
+        size_t col_num = shape(rng_);
+        std::vector<std::vector<double>> costs(tracks.size(), std::vector<double>(col_num));
+        for (size_t i = 0; i < tracks.size(); i++)
+        {
+            for (size_t j = 0; j < col_num; j++)
+            {
+                costs[i][j] = unit(rng_) < 0.5 ? 1.0 : unit(rng_);
+            }
+        }
+        check_frame(warm_solver, tracks, costs);
+    }
+
+    printf("incremental hungarian : %d solves, %d failures, %d full solve fallbacks\n",
+        solves_, failures_, fallbacks_);
+    return failures_ == 0;
+}
+
+int main(int argc, char** argv)
+{
+    incrementalHungarianTest test(argc, argv);
+    return test.run() ? 0 : 1;
+}